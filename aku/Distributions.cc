@@ -17,6 +17,11 @@ using namespace std;
 
 namespace aku {
 
+// Number of samples drawn and scored at a time in the Monte Carlo
+// estimates of the mixture divergences
+static const int mc_sample_block_size = 1000;
+
+
 void
 GaussianAccumulator::get_accumulated_mean(Vector &mean) const
 {
@@ -355,6 +360,19 @@ Gaussian::accumulated(int accum_pos) const
 }
 
 
+bool
+Gaussian::has_statistics() const
+{
+  for (int i = 0; i < (int)m_accums.size(); i++)
+  {
+    if (m_accums[i] != NULL && m_accums[i]->accumulated() &&
+        (m_accums[i]->gamma() != 0 || m_accums[i]->aux_gamma() != 0))
+      return true;
+  }
+  return false;
+}
+
+
 void
 Gaussian::ismooth_statistics(int source, int target, double smoothing)
 {
@@ -939,6 +957,14 @@ Gaussian::kullback_leibler(Gaussian &g) const
 
 void
 Gaussian::draw_sample(Vector &sample)
+{
+  draw_sample(sample, mtw::rnd, ziggurat::rnd);
+}
+
+
+void
+Gaussian::draw_sample(Vector &sample, mtw::Rnd &rnd,
+                      ziggurat::Rnd &normal_rnd)
 {
   get_mean(sample);
   if (chol == NULL)
@@ -949,7 +975,7 @@ Gaussian::draw_sample(Vector &sample)
   }
   Vector ziggies(dim());
   for (int i=0; i<dim(); i++)
-    ziggies(i) = ziggurat::rnd.rnor();
+    ziggies(i) = normal_rnd.rnor();
   Blas_Mat_Vec_Mult(*chol, ziggies, sample, 1.0, 1.0);
 }
 
@@ -1109,10 +1135,18 @@ DiagonalGaussian::kullback_leibler(Gaussian &g) const
 
 void
 DiagonalGaussian::draw_sample(Vector &sample)
+{
+  draw_sample(sample, mtw::rnd, ziggurat::rnd);
+}
+
+
+void
+DiagonalGaussian::draw_sample(Vector &sample, mtw::Rnd &rnd,
+                              ziggurat::Rnd &normal_rnd)
 {
   get_mean(sample);
   for (int i=0; i<dim(); i++)
-    sample(i) += sqrt(m_covariance(i)) * ziggurat::rnd.rnor();
+    sample(i) += sqrt(m_covariance(i)) * normal_rnd.rnor();
 }
 
 
@@ -2188,6 +2222,23 @@ Mixture::accumulated(int accum_pos) const
 }
 
 
+bool
+Mixture::has_statistics() const
+{
+  for (int a = 0; a < (int)m_accums.size(); a++)
+  {
+    if (m_accums[a] == NULL || !m_accums[a]->accumulated)
+      continue;
+    if (m_accums[a]->aux_gamma != 0)
+      return true;
+    for (int i = 0; i < size(); i++)
+      if (m_accums[a]->gamma[i] != 0)
+        return true;
+  }
+  return false;
+}
+
+
 void 
 Mixture::dump_statistics(std::ostream &os) const
 {
@@ -2447,18 +2498,17 @@ Mixture::component_index(int p)
 void
 Mixture::update_components(const std::vector<int> &cmap)
 {
+  int num_kept = 0;
   for (int i = 0; i < (int)m_pointers.size(); i++)
   {
     if (cmap[m_pointers[i]] < 0)
-    {
-      // Delete this component
-      m_pointers.erase(m_pointers.begin()+i);
-      m_weights.erase(m_weights.begin()+i);
-      i--; // Continue from the next component
-    }
-    else
-      m_pointers[i] = cmap[m_pointers[i]];
+      continue; // Delete this component
+    m_pointers[num_kept] = cmap[m_pointers[i]];
+    m_weights[num_kept] = m_weights[i];
+    num_kept++;
   }
+  m_pointers.resize(num_kept);
+  m_weights.resize(num_kept);
   normalize_weights();
 }
 
@@ -2473,64 +2523,148 @@ Mixture::remove_component(int index)
 }
 
 
+void
+Mixture::remove_components(const std::vector<bool> &remove)
+{
+  assert( remove.size() == m_pointers.size() );
+  int num_kept = 0;
+  for (int i = 0; i < (int)m_pointers.size(); i++)
+  {
+    if (remove[i])
+      continue;
+    m_pointers[num_kept] = m_pointers[i];
+    m_weights[num_kept] = m_weights[i];
+    num_kept++;
+  }
+  m_pointers.resize(num_kept);
+  m_weights.resize(num_kept);
+  normalize_weights();
+}
+
+
 double
-Mixture::cross_entropy(Mixture &g, int samples)
+Mixture::cross_entropy(Mixture &g, int samples, uint32_t seed)
 {
+  mtw::Rnd rnd(seed);
+  ziggurat::Rnd normal_rnd(seed);
+  std::vector<Vector> block;
+  std::vector<double> g_likelihoods;
   double ce=0;
-  Vector sample;
-  for (int i=0; i<samples; i++) {
-    draw_sample(sample);
-    g.get_pool()->reset_cache();
-    ce += util::safe_log(g.compute_likelihood(sample));
+  for (int i=0; i<samples; i+=(int)block.size()) {
+    block.resize(std::min(mc_sample_block_size, samples-i));
+    for (int s=0; s<(int)block.size(); s++)
+      draw_sample(block[s], rnd, normal_rnd);
+    g.compute_likelihoods(block, g_likelihoods);
+    for (int s=0; s<(int)block.size(); s++)
+      ce += util::safe_log(g_likelihoods[s]);
   }
   return ce/samples;
 }
 
 
 double
-Mixture::kullback_leibler(Mixture &g, int samples)
+Mixture::kullback_leibler(Mixture &g, int samples, uint32_t seed)
 {
+  mtw::Rnd rnd(seed);
+  ziggurat::Rnd normal_rnd(seed);
+  std::vector<Vector> block;
+  std::vector<double> f_likelihoods, g_likelihoods;
   double kl=0;
-  Vector sample;
-  for (int i=0; i<samples; i++) {
-    draw_sample(sample);
-    m_pool->reset_cache();
-    g.get_pool()->reset_cache();
-    kl += util::safe_log(compute_likelihood(sample)/g.compute_likelihood(sample));
+  for (int i=0; i<samples; i+=(int)block.size()) {
+    block.resize(std::min(mc_sample_block_size, samples-i));
+    for (int s=0; s<(int)block.size(); s++)
+      draw_sample(block[s], rnd, normal_rnd);
+    compute_likelihoods(block, f_likelihoods);
+    g.compute_likelihoods(block, g_likelihoods);
+    for (int s=0; s<(int)block.size(); s++)
+      kl += util::safe_log(f_likelihoods[s]/g_likelihoods[s]);
   }
   return kl/samples;
 }
 
 
 double
-Mixture::bhattacharyya(Mixture &g, int samples)
+Mixture::bhattacharyya(Mixture &g, int samples, uint32_t seed)
 {
+  mtw::Rnd rnd(seed);
+  ziggurat::Rnd normal_rnd(seed);
+  std::vector<Vector> block;
+  std::vector<double> f_likelihoods, g_likelihoods;
   double bh=0;
-  double f_val, g_val;
-  Vector sample;
-  for (int i=0; i<samples; i++) {
-    if (mtw::rnd.f() <0.5)
-      draw_sample(sample);
-    else
-      g.draw_sample(sample);
-    m_pool->reset_cache();
-    f_val = compute_likelihood(sample);
-    g_val = g.compute_likelihood(sample);
-    bh += sqrt(f_val*g_val) / (0.5*(f_val+g_val));
+  for (int i=0; i<samples; i+=(int)block.size()) {
+    block.resize(std::min(mc_sample_block_size, samples-i));
+    for (int s=0; s<(int)block.size(); s++) {
+      if (rnd.f() <0.5)
+        draw_sample(block[s], rnd, normal_rnd);
+      else
+        g.draw_sample(block[s], rnd, normal_rnd);
+    }
+    compute_likelihoods(block, f_likelihoods);
+    g.compute_likelihoods(block, g_likelihoods);
+    for (int s=0; s<(int)block.size(); s++) {
+      double f_val = f_likelihoods[s];
+      double g_val = g_likelihoods[s];
+      bh += sqrt(f_val*g_val) / (0.5*(f_val+g_val));
+    }
   }
   return bh/samples;
 }
 
 
+void
+Mixture::compute_likelihoods(const std::vector<Vector> &samples,
+                             std::vector<double> &likelihoods)
+{
+  likelihoods.resize(samples.size());
+
+  // Adapted components cache the transformed feature, so they must be
+  // evaluated one sample at a time
+  std::vector<PDF*> cached_pdfs;
+  for (int i = 0; i < (int)m_pointers.size(); i++)
+    if (m_pool->get_pdf(m_pointers[i])->has_feature_cache())
+      cached_pdfs.push_back(m_pool->get_pdf(m_pointers[i]));
+
+#ifndef USE_SUBSPACE_COV
+  if (cached_pdfs.empty()) {
+#pragma omp parallel for schedule(static)
+    for (int s = 0; s < (int)samples.size(); s++) {
+      double l = 0;
+      for (int i = 0; i < (int)m_pointers.size(); i++)
+        l += m_weights[i]*m_pool->get_pdf(m_pointers[i])->compute_likelihood(samples[s]);
+      likelihoods[s] = l;
+    }
+    return;
+  }
+#endif
+
+  // Reset the caches for each sample.  Subspace Gaussians also keep
+  // per-sample projections in the pool.
+  for (int s = 0; s < (int)samples.size(); s++) {
+    m_pool->reset_cache();
+    for (int i = 0; i < (int)cached_pdfs.size(); i++)
+      cached_pdfs[i]->reset_feature_cache();
+    likelihoods[s] = compute_likelihood(samples[s]);
+  }
+}
+
+
 void
 Mixture::draw_sample(Vector &sample)
 {
-  double randval = mtw::rnd.f();
+  draw_sample(sample, mtw::rnd, ziggurat::rnd);
+}
+
+
+void
+Mixture::draw_sample(Vector &sample, mtw::Rnd &rnd,
+                     ziggurat::Rnd &normal_rnd)
+{
+  double randval = rnd.f();
   double cumsum = 0;
   for (unsigned int i=0; i<m_weights.size(); i++) {
     cumsum += m_weights[i];
     if (randval <= cumsum) {
-      m_pool->get_pdf(m_pointers[i])->draw_sample(sample);
+      m_pool->get_pdf(m_pointers[i])->draw_sample(sample, rnd, normal_rnd);
       return;
     }    
   }
@@ -2614,6 +2748,24 @@ PDFPool::delete_pdf(int index)
 }
 
 
+void
+PDFPool::delete_pdfs(const std::vector<int> &index_map)
+{
+  assert( index_map.size() == m_pool.size() );
+  int num_kept = 0;
+  for (int i = 0; i < (int)m_pool.size(); i++)
+  {
+    if (index_map[i] < 0)
+      continue;
+    assert( index_map[i] == num_kept );
+    m_pool[num_kept++] = m_pool[i];
+  }
+  m_pool.resize(num_kept);
+  reset_cache();
+  m_likelihoods.resize(m_pool.size());
+}
+
+
 void
 PDFPool::reset_cache()
 {
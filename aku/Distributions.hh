@@ -57,6 +57,9 @@ public:
   virtual void stop_accumulating() = 0;
   /* Tells if this pdf has been accumulated */
   virtual bool accumulated(int accum_pos = 0) const = 0;
+  /* Tells if any accumulator has nonzero occupancy, pdfs without
+     statistics are left out of the dumps */
+  virtual bool has_statistics() const = 0;
   /* Use the accumulated statistics to update the current model parameters. */
   virtual void estimate_parameters(EstimationMode mode) = 0;
   /* Set the update mode */
@@ -68,12 +71,22 @@ public:
   virtual double compute_likelihood(const Vector &f) const = 0;
   /* The log likelihood of the current feature given this model */
   virtual double compute_log_likelihood(const Vector &f) const = 0;
+  /* Tells if the likelihoods are computed from a transformed feature
+     that is cached until reset_feature_cache() is called.  Such pdfs
+     can not be evaluated for several features in parallel. */
+  virtual bool has_feature_cache() const { return false; }
+  /* Forget the cached transformed feature */
+  virtual void reset_feature_cache() { }
 
 
   // SAMPLING
 
   /* Draw a random sample from this distribution */
   virtual void draw_sample(Vector &sample) = 0;
+  /* Draw a random sample using the given generators for uniform and
+     normal variates instead of the global ones */
+  virtual void draw_sample(Vector &sample, mtw::Rnd &rnd,
+                           ziggurat::Rnd &normal_rnd) = 0;
   
   // IO
 
@@ -122,6 +135,14 @@ public:
    *  \param index PDF index
    */
   void delete_pdf(int index);
+
+  /** Deletes several pdfs from the pool in one pass.
+   * \param index_map Maps each old index to the new one, -1 for the
+   *                  pdfs to be deleted. The new indices must preserve
+   *                  the order of the remaining pdfs and be consecutive
+   *                  from zero.
+   */
+  void delete_pdfs(const std::vector<int> &index_map);
   
   /// Read the distributions from a .gk -file
   void read_gk(const std::string &filename);
@@ -438,6 +459,7 @@ public:
   virtual void stop_accumulating();
   /* Tells if this Gaussian has been accumulated */
   virtual bool accumulated(int accum_pos = 0) const;
+  virtual bool has_statistics() const;
   /* Use the accumulated statistics to update the current model parameters. */
   virtual void estimate_parameters(EstimationMode mode) { estimate_parameters(mode, 0, 0, 1, 2, 0, false); }
   virtual void estimate_parameters(EstimationMode mode, double minvar,
@@ -508,6 +530,8 @@ public:
   virtual double kullback_leibler(Gaussian &g) const;
   /// Draw a random sample from this Gaussian
   virtual void draw_sample(Vector &sample);
+  virtual void draw_sample(Vector &sample, mtw::Rnd &rnd,
+                           ziggurat::Rnd &normal_rnd);
 
   /** Tells if full statistics have been accumulated for this Gaussian
    * \param accum_pos Accumulator position
@@ -592,6 +616,8 @@ public:
 
   // Faster implementations for DiagonalGaussian
   virtual void draw_sample(Vector &sample);
+  virtual void draw_sample(Vector &sample, mtw::Rnd &rnd,
+                           ziggurat::Rnd &normal_rnd);
   virtual double kullback_leibler(Gaussian &g) const;
 
   /// Is this a diagonal covariance gaussian?
@@ -828,6 +854,13 @@ public:
    */
   void remove_component(int index);
 
+  /** Deletes the marked components from the mixture in one pass and
+   * normalizes the weights
+   * \param remove Flags indexed by component, true for the components
+   *               to be deleted
+   */
+  void remove_components(const std::vector<bool> &remove);
+
   // For accessing the accumulator
   double get_accumulated_gamma(int accum, int index) { return m_accums[accum]->gamma[index]; }
 
@@ -835,22 +868,35 @@ public:
    * using Monte Carlo simulation and sampling from the current distribution
    * \param g the other mixture
    * \param samples number of samples to use in the computation
+   * \param seed seed for the random generators, the same seed gives
+   *             the same estimate
    */
-  double cross_entropy(Mixture &g, int samples=10000);
+  double cross_entropy(Mixture &g, int samples=10000, uint32_t seed=1);
   
   /** Computes the Kullback-Leibler divergence between this and another mixture
    * using Monte Carlo simulation and sampling from the current distribution
    * \param g the other mixture
    * \param samples number of samples to use in the mc-simulation
+   * \param seed seed for the random generators
    */
-  double kullback_leibler(Mixture &g, int samples=10000);
+  double kullback_leibler(Mixture &g, int samples=10000, uint32_t seed=1);
 
   /** Computes the Kullback-Leibler divergence between this and another mixture
    * using sampling with the (f+g)/2 as sampling distribution
    * \param g the other mixture
    * \param samples number of samples to use in the computation
+   * \param seed seed for the random generators
+   */
+  double bhattacharyya(Mixture &g, int samples=10000, uint32_t seed=1);
+
+  /** Computes the likelihoods of a block of samples.  The components
+   * are evaluated directly instead of through the pool cache, so the
+   * samples may be scored in parallel.
+   * \param samples the samples
+   * \param likelihoods the likelihood of each sample is stored here
    */
-  double bhattacharyya(Mixture &g, int samples=10000);
+  void compute_likelihoods(const std::vector<Vector> &samples,
+                           std::vector<double> &likelihoods);
 
   virtual void accumulate_aux_gamma(double gamma, int accum_pos = 0);
   double get_accumulated_mixture_ll(int accum) { return m_accums[accum]->mixture_ll; }
@@ -869,12 +915,15 @@ public:
   virtual void accumulate_from_dump(std::istream &is, StatisticsMode mode);
   virtual void stop_accumulating();
   virtual bool accumulated(int accum_pos = 0) const;
+  virtual bool has_statistics() const;
   virtual void estimate_parameters(EstimationMode mode);
   virtual double compute_likelihood(const Vector &f) const;
   virtual double compute_log_likelihood(const Vector &f) const;
   virtual void write(std::ostream &os) const;
   virtual void read(std::istream &is);
   virtual void draw_sample(Vector &sample);
+  virtual void draw_sample(Vector &sample, mtw::Rnd &rnd,
+                           ziggurat::Rnd &normal_rnd);
 
 private:
 
@@ -16,14 +16,17 @@ FeatureGenerator::FeatureGenerator(void) :
   m_last_module(NULL),
   m_file(NULL),
   m_dont_fclose(false),
-  m_eof_on_last_frame(false)
+  m_eof_on_last_frame(false),
+  m_primary(NULL)
 {
 }
 
 FeatureGenerator::~FeatureGenerator()
 {
   for (int i = 0; i < (int)m_modules.size(); i++)
-    delete m_modules[i];
+    if (m_shared_modules.find(m_modules[i]) == m_shared_modules.end())
+      delete m_modules[i];
+  detach();
 }
 
 void
@@ -43,10 +46,12 @@ FeatureGenerator::open(const std::string &filename)
 
   if (m_file != NULL)
     close();
-  for (int i = 0; i < (int)m_modules.size(); i++)
-    m_modules[i]->reset();
+  reset_modules();
 
+  // The audio is read by the primary generator
   assert( m_base_module != NULL );
+  if (m_shared_modules.find(m_base_module) != m_shared_modules.end())
+    return;
   m_base_module->set_fname(filename.c_str());
 }
 
@@ -70,13 +75,17 @@ FeatureGenerator::open(FILE *file, bool dont_fclose, bool stream)
 {
   if (m_file != NULL)
     close();
-  m_file = file;
-  m_dont_fclose = dont_fclose;
-
-  for (int i = 0; i < (int)m_modules.size(); i++)
-    m_modules[i]->reset();
+  reset_modules();
 
   assert( m_base_module != NULL );
+  if (m_shared_modules.find(m_base_module) != m_shared_modules.end()) {
+    // The audio is read by the primary generator
+    if (!dont_fclose)
+      fclose(file);
+    return;
+  }
+  m_file = file;
+  m_dont_fclose = dont_fclose;
   m_base_module->set_file(m_file, stream);
 }
 
@@ -211,6 +220,18 @@ FeatureGenerator::load_configuration(FILE *file)
     }
     
     module->set_config(config);
+
+    // Use the identical module of the primary generator instead
+    FeatureModule *shared = find_shared_module(module);
+    if (shared != NULL) {
+      if (m_base_module == module)
+        m_base_module = dynamic_cast<BaseFeaModule*>(shared);
+      delete module;
+      m_last_module = shared;
+      m_modules.back() = shared;
+      m_module_map[name] = shared;
+      m_shared_modules.insert(shared);
+    }
   }
 
   compute_init_buffers();
@@ -218,6 +239,18 @@ FeatureGenerator::load_configuration(FILE *file)
 }
 
 
+void
+FeatureGenerator::load_shared_configuration(FILE *file,
+                                            FeatureGenerator &primary)
+{
+  if (!m_modules.empty())
+    close_configuration();
+  m_primary = &primary;
+  primary.m_attached.push_back(this);
+  load_configuration(file);
+}
+
+
 void
 FeatureGenerator::write_configuration(FILE *file)
 {
@@ -245,11 +278,79 @@ void
 FeatureGenerator::close_configuration()
 {
   for (int i = 0; i < (int)m_modules.size(); i++)
-    delete m_modules[i];
+    if (m_shared_modules.find(m_modules[i]) == m_shared_modules.end())
+      delete m_modules[i];
   m_modules.clear();
   m_module_map.clear();
   m_base_module = NULL;
   m_last_module = NULL;
+  detach();
+}
+
+
+FeatureModule* // private
+FeatureGenerator::find_shared_module(FeatureModule *module)
+{
+  if (m_primary == NULL || m_primary->m_modules.empty())
+    return NULL;
+
+  // All the sources must be shared, and the base modules only match
+  // each other
+  for (int i = 0; i < (int)module->sources().size(); i++)
+    if (m_shared_modules.find(module->sources()[i]) == m_shared_modules.end())
+      return NULL;
+
+  // Modules with on-line parameters may be adjusted separately for
+  // each generator
+  ModuleConfig params;
+  module->get_parameters(params);
+  if (!params.empty())
+    return NULL;
+
+  ModuleConfig config;
+  module->get_config(config);
+  config.set("name", "");
+  for (int i = 0; i < (int)m_primary->m_modules.size(); i++) {
+    FeatureModule *candidate = m_primary->m_modules[i];
+    if (candidate->type_str() != module->type_str() ||
+        candidate->sources() != module->sources() ||
+        (module == m_base_module) != (candidate == m_primary->m_base_module))
+      continue;
+    ModuleConfig candidate_config;
+    candidate->get_config(candidate_config);
+    candidate_config.set("name", "");
+    if (candidate_config == config)
+      return candidate;
+  }
+  return NULL;
+}
+
+
+void // private
+FeatureGenerator::reset_modules()
+{
+  for (int i = 0; i < (int)m_modules.size(); i++)
+    if (m_shared_modules.find(m_modules[i]) == m_shared_modules.end())
+      m_modules[i]->reset();
+  for (int i = 0; i < (int)m_attached.size(); i++)
+    m_attached[i]->reset_modules();
+}
+
+
+void // private
+FeatureGenerator::detach()
+{
+  m_shared_modules.clear();
+  if (m_primary == NULL)
+    return;
+  std::vector<FeatureGenerator*> &attached = m_primary->m_attached;
+  for (int i = 0; i < (int)attached.size(); i++) {
+    if (attached[i] == this) {
+      attached.erase(attached.begin() + i);
+      break;
+    }
+  }
+  m_primary = NULL;
 }
 
 
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <map>
+#include <set>
 #include <string>
 #include "FeatureModules.hh"
 
@@ -42,6 +43,20 @@ public:
   /** Load the configuration of feature modules from a file. */
   void load_configuration(FILE *file);
 
+  /** Load the configuration of feature modules from a file, sharing
+   * the modules that are identical in another generator.  A module
+   * is shared if \a primary has a module of the same type with the
+   * same settings and the same (shared) sources, and the module has
+   * no on-line parameters.  The shared modules are computed only once
+   * per frame for both generators.
+   *
+   * If the base module is shared, the audio is read through \a
+   * primary: files must be opened with \a primary, and open() of
+   * this generator only resets its own modules.  \a primary must
+   * outlive this generator.
+   */
+  void load_shared_configuration(FILE *file, FeatureGenerator &primary);
+
   /** Write the configuration of feature modules. */
   void write_configuration(FILE *file);
 
@@ -93,6 +108,17 @@ private:
   /** Check module structure and warn about anomalities. */
   void check_model_structure();
 
+  /** Find a module of the primary generator that is identical to the
+   * given configured module.  Returns NULL if there is none. */
+  FeatureModule *find_shared_module(FeatureModule *module);
+
+  /** Reset the modules owned by this generator and the generators
+   * sharing its modules. */
+  void reset_modules();
+
+  /** Stop sharing the modules of the primary generator. */
+  void detach();
+
   typedef std::map<std::string, FeatureModule*> ModuleMap;
 
   std::vector<FeatureModule*> m_modules; //!< The feature modules
@@ -114,6 +140,15 @@ private:
 
   /** Was end of file reached on the frame requested from generate(). */
   bool m_eof_on_last_frame;
+
+  /** The generator whose modules are shared, or NULL. */
+  FeatureGenerator *m_primary;
+
+  /** The modules of \ref m_primary used by this generator. */
+  std::set<FeatureModule*> m_shared_modules;
+
+  /** The generators sharing the modules of this generator. */
+  std::vector<FeatureGenerator*> m_attached;
 };
 
 
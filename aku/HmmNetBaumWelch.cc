@@ -40,6 +40,8 @@ HmmNetBaumWelch::HmmNetBaumWelch(FeatureGenerator &fea_gen, HmmSet &model)
   // Default pruning thresholds
   m_forward_beam = 15;
   m_backward_beam = 200;
+  m_max_local_widenings = 4;
+  m_checkpoint_interval = 50;
 }
 
 
@@ -818,6 +820,10 @@ HmmNetBaumWelch::fill_backward_probabilities(void)
   NodeTransitionMap active_transitions; // multimap
   FeatureVec empty_fea_vec;
   int cur_frame;
+  std::vector< BackwardCheckpoint > checkpoints; // In descending frame order
+  int num_widenings = 0;
+  int widen_first_frame = 0, widen_last_frame = -1; // Wide beam frame range
+  double wide_beam = m_backward_beam;
   
   if (!m_features_generated)
   {
@@ -838,11 +844,21 @@ HmmNetBaumWelch::fill_backward_probabilities(void)
 
   // Propagate the epsilon arcs leading to the final node
   backward_propagate_epsilon_arcs(active_tokens, node_token_map, cur_frame);
+  int end_frame = cur_frame;
   
   cur_frame++;
   while (--cur_frame >= m_first_frame)
   {
     double best_score = loglikelihoods.zero();
+    double beam = m_backward_beam;
+    if (cur_frame >= widen_first_frame && cur_frame <= widen_last_frame)
+      beam = wide_beam;
+
+    if (m_max_local_widenings > 0 && m_checkpoint_interval > 0 &&
+        cur_frame < end_frame &&
+        (cur_frame - m_first_frame) % m_checkpoint_interval == 0 &&
+        (checkpoints.empty() || checkpoints.back().frame > cur_frame))
+      checkpoints.push_back(BackwardCheckpoint(cur_frame, active_tokens));
     
     m_model.reset_cache();
     active_transitions.clear();
@@ -888,7 +904,7 @@ HmmNetBaumWelch::fill_backward_probabilities(void)
 
       // Pruning
       if (loglikelihoods.divide((*it).second.score, best_score) <
-          -m_backward_beam)
+          -beam)
       {
         ++it;
         continue;
@@ -921,7 +937,7 @@ HmmNetBaumWelch::fill_backward_probabilities(void)
       {
         // Pruning
         if (loglikelihoods.divide((*it2).second.score, best_score) <
-            -m_backward_beam)
+            -beam)
           continue;
 
         if (m_segmentation_mode == MODE_BAUM_WELCH)
@@ -999,6 +1015,44 @@ HmmNetBaumWelch::fill_backward_probabilities(void)
     // Propagate epsilon transitions
     backward_propagate_epsilon_arcs(active_tokens,
                                     node_token_map, cur_frame);
+
+    // Check whether pruning has disconnected the network
+    bool failed = active_tokens.empty();
+    if (cur_frame == m_first_frame)
+    {
+      NodeTokenMap::iterator it = node_token_map.find(m_initial_node_id);
+      failed = (it == node_token_map.end() ||
+                active_tokens[(*it).second].score <= loglikelihoods.zero());
+    }
+    if (failed && num_widenings < m_max_local_widenings)
+    {
+      // Find the checkpoint to restart from, one further on every retry
+      int num_later = 0;
+      while (num_later < (int)checkpoints.size() &&
+             checkpoints[num_later].frame >= cur_frame)
+        num_later++;
+      if (num_later == 0)
+        break;
+      num_widenings++;
+      int restart = std::max(num_later - num_widenings, 0);
+      checkpoints.erase(checkpoints.begin() + restart + 1, checkpoints.end());
+      
+      // Re-expand the frames from the checkpoint to a bit past the
+      // failure with a wider beam
+      wide_beam = (num_widenings + 1) * m_backward_beam;
+      widen_last_frame = checkpoints.back().frame;
+      widen_first_frame = cur_frame - m_checkpoint_interval;
+      for (int i = 0; i < (int)m_arcs.size(); i++)
+        m_arcs[i].bw_scores.truncate(widen_last_frame + 1);
+      active_tokens = checkpoints.back().tokens;
+      node_token_map.clear();
+      for (int i = 0; i < (int)active_tokens.size(); i++)
+        node_token_map.insert(
+          NodeTokenMap::value_type(active_tokens[i].node_id, i));
+      cur_frame = widen_last_frame + 1;
+    }
+    else if (active_tokens.empty())
+      break; // No paths left
   }
 
   // Set the total lattice scores
@@ -2334,6 +2388,28 @@ HmmNetBaumWelch::FrameScores::get_score(int frame)
   return HmmNetBaumWelch::loglikelihoods.zero();
 }
 
+void
+HmmNetBaumWelch::FrameScores::truncate(int frame)
+{
+  // The frames are stored in descending order, so the scores to be
+  // removed are at the end of the table
+  while (!frame_blocks.empty() && frame_blocks.back().start < frame)
+  {
+    FrameBlock &b = frame_blocks.back();
+    if (b.end < frame)
+    {
+      num_scores = b.buf_start;
+      frame_blocks.pop_back();
+    }
+    else
+    {
+      num_scores = b.buf_start + b.end - frame + 1;
+      b.start = frame;
+      break;
+    }
+  }
+}
+
 void
 HmmNetBaumWelch::FrameScores::clear(void)
 {
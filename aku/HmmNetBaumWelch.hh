@@ -126,6 +126,8 @@ public:
     void set_score(int frame, double score);
     void set_new_score(int frame, double score);
     double get_score(int frame);
+    /// Removes the scores of the frames before the given frame
+    void truncate(int frame);
     void clear(void); //!< Frees the allocated memory
     FrameScores() : score_table(NULL), num_scores(0), score_table_size(0) { }
     
@@ -410,6 +412,14 @@ private:
     BackwardToken(int net_node_, double score_) : node_id(net_node_), score(score_) { }
   };
 
+  /** Active backward tokens saved for re-expanding the frames before
+   * the checkpoint with a wider beam */
+  struct BackwardCheckpoint {
+    int frame; //!< The next frame to be processed from the tokens
+    std::vector< BackwardToken > tokens;
+    BackwardCheckpoint(int frame_, const std::vector< BackwardToken > &tokens_) : frame(frame_), tokens(tokens_) { }
+  };
+
   struct BackwardTransitionInfo {
     int arc_id;
     double score;
@@ -468,6 +478,16 @@ public:
   double get_backward_beam(void) { return m_backward_beam; }
   double get_forward_beam(void) { return m_forward_beam; }
 
+  /** Set the local widening of the backward beam. If all the paths are
+   * pruned in the backward phase, the frames before the nearest
+   * checkpoint are re-expanded with a wider beam, keeping the scores
+   * of the later frames. Every retry starts from one checkpoint
+   * further and widens the beam by the original beam.
+   * \param max_retries          Maximum number of local retries, 0 disables
+   * \param checkpoint_interval  Frames between the saved token sets
+   */
+  void set_local_beam_widening(int max_retries, int checkpoint_interval) { m_max_local_widenings = max_retries; m_checkpoint_interval = checkpoint_interval; }
+
   /// Set the segmentation mode
   void set_mode(int mode) { m_segmentation_mode = mode; }
 
@@ -613,6 +633,12 @@ private:
   /// Beam for pruning the arc occupancies in the forward phase
   double m_forward_beam;
 
+  /// Maximum number of local backward beam widenings per utterance
+  int m_max_local_widenings;
+
+  /// Frames between the backward phase checkpoints
+  int m_checkpoint_interval;
+
   /// Scaling value for acoustic log likelihoods
   double m_acoustic_scale;
 
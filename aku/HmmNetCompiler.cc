@@ -0,0 +1,619 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <utility>
+
+#include "HmmNetCompiler.hh"
+#include "str.hh"
+
+
+namespace aku {
+
+// Word labels of the silences
+static const std::string silence_word("_");
+static const std::string morph_boundary_word("<w>");
+
+
+/** Split an HMM label "l-c+r" into the left context ("l-"), the
+ * center phone and the right context ("+r"), as in hmms2trinet.pl.
+ */
+static void
+split_label(const std::string &label, std::string &left,
+            std::string &center, std::string &right)
+{
+  size_t dash = label.rfind('-');
+  if (dash == std::string::npos || dash == 0 || dash + 1 == label.size())
+    dash = 0;
+  else
+    dash++;
+  left = label.substr(0, dash);
+  size_t plus = label.find('+', dash + 1);
+  if (plus == std::string::npos) {
+    center = label.substr(dash);
+    right = "";
+  }
+  else {
+    center = label.substr(dash, plus - dash);
+    right = label.substr(plus);
+  }
+}
+
+
+/** The context state reached after an HMM. */
+static std::string
+target_context(const std::string &label, const std::string &center,
+               const std::string &right)
+{
+  if (label == "__")
+    return "__-";
+  if (right == "+_")
+    return "-__";
+  std::string context = center + right;
+  for (int i = 0; i < (int)context.size(); i++)
+    if (context[i] == '+')
+      context[i] = '-';
+  return context;
+}
+
+
+HmmNetCompiler::HmmNetCompiler(HmmSet &model)
+  : m_model(model),
+    m_morphs(false),
+    m_initial_context(-1),
+    m_final_context(-1)
+{
+  build_context_network();
+}
+
+
+void
+HmmNetCompiler::read_lexicon(FILE *file)
+{
+  std::string line;
+  std::vector<std::string> fields;
+  std::string left, center, right;
+
+  while (str::read_line(&line, file, true)) {
+    str::clean(&line, " \t");
+    if (line.empty())
+      continue;
+    str::split(&line, " \t", true, &fields);
+
+    // Remove the probability
+    std::string word = fields[0];
+    size_t paren = word.find('(');
+    if (paren != std::string::npos && word[word.size() - 1] == ')')
+      word.erase(paren);
+
+    // Reduce context phones to monophones
+    Pronunciation pronunciation;
+    for (int i = 1; i < (int)fields.size(); i++) {
+      split_label(fields[i], left, center, right);
+      pronunciation.push_back(phone_index(center));
+    }
+
+    if (word[0] == '_')
+      m_word_breaks.push_back(pronunciation);
+    m_lexicon[word].push_back(pronunciation);
+  }
+}
+
+
+void
+HmmNetCompiler::compile(const std::vector<std::string> &words, FILE *file)
+{
+  const std::string *silence = m_morphs ? &morph_boundary_word : &silence_word;
+  std::vector<Arc> phone_arcs;
+  int num_nodes = 1;
+  int node = 0;
+
+  if (!m_morphs && m_word_breaks.empty())
+    throw std::string("HmmNetCompiler::compile(): no word breaks in the lexicon");
+
+  // Words with optional silences at both ends
+  add_word(node, silence, m_silence, true, num_nodes, phone_arcs);
+  add_transcription(node, words, num_nodes, phone_arcs);
+  add_word(node, silence, m_silence, true, num_nodes, phone_arcs);
+  int final_node = num_nodes++;
+  phone_arcs.push_back(Arc(node, final_node, END_MARK, -1, NULL));
+
+  std::vector<Arc> arcs;
+  num_nodes = expand_contexts(num_nodes, phone_arcs, final_node, arcs);
+  write_network(num_nodes, arcs, final_node, file);
+}
+
+
+void
+HmmNetCompiler::read_lattice(FILE *file, Lattice &lattice) const
+{
+  std::string line;
+  std::vector<std::string> fields;
+  std::string error;
+  int num_arcs = -1;
+  int num_arc_lines = 0;
+
+  lattice = Lattice(); // The default base is e
+
+  // Read the header and the arcs, the node lines are not needed.  The
+  // errors are reported after the last arc, so that the stream stays
+  // at the next lattice.
+  while (num_arcs < 0 || num_arc_lines < num_arcs) {
+    if (!str::read_line(&line, file, true))
+      throw std::string("HmmNetCompiler::read_lattice(): unexpected end of lattice");
+    str::clean(&line, " \t");
+    if (line.empty() || line[0] == '#')
+      continue;
+    str::split(&line, " \t", true, &fields);
+
+    Lattice::Arc arc;
+    bool is_arc = false;
+    for (int i = 0; i < (int)fields.size(); i++) {
+      size_t eq = fields[i].find('=');
+      if (eq == std::string::npos)
+        continue;
+      std::string key = fields[i].substr(0, eq);
+      const char *value = fields[i].c_str() + eq + 1;
+      if (key == "N")
+        lattice.num_nodes = atoi(value);
+      else if (key == "L")
+        num_arcs = atoi(value);
+      else if (key == "start")
+        lattice.start = atoi(value);
+      else if (key == "end")
+        lattice.end = atoi(value);
+      else if (key == "base")
+        lattice.log_base = log(atof(value));
+      else if (key == "lmscale")
+        lattice.lm_scale = atof(value);
+      else if (key == "J")
+        is_arc = true;
+      else if (key == "S")
+        arc.source = atoi(value);
+      else if (key == "E")
+        arc.target = atoi(value);
+      else if (key == "W")
+        arc.word = value;
+      else if (key == "a")
+        arc.am = atof(value);
+      else if (key == "l")
+        arc.lm = atof(value);
+    }
+    if (!is_arc)
+      continue;
+    num_arc_lines++;
+    if (lattice.num_nodes < 0 || arc.source < 0 || arc.target < 0 ||
+        arc.source >= lattice.num_nodes || arc.target >= lattice.num_nodes) {
+      if (error.empty())
+        error = "HmmNetCompiler::read_lattice(): invalid arc: " + line;
+      continue;
+    }
+    lattice.arcs.push_back(arc);
+  }
+  if (!error.empty())
+    throw error;
+  if (lattice.start < 0 || lattice.end < 0 ||
+      lattice.start >= lattice.num_nodes || lattice.end >= lattice.num_nodes)
+    throw std::string("HmmNetCompiler::read_lattice(): invalid start or end node");
+}
+
+
+void
+HmmNetCompiler::compile_lattice(const Lattice &lattice,
+                                const std::vector<std::string> &reference,
+                                FILE *file)
+{
+  const std::vector<Lattice::Arc> &lattice_arcs = lattice.arcs;
+  int num_lattice_nodes = lattice.num_nodes;
+  int start = lattice.start;
+  int end = lattice.end;
+  double log_base = lattice.log_base;
+  double lm_scale = lattice.lm_scale;
+
+  // Find the best path in topological order to weight the reference
+  std::vector<std::vector<int> > out_arcs(num_lattice_nodes);
+  std::vector<int> in_degree(num_lattice_nodes, 0);
+  for (int i = 0; i < (int)lattice_arcs.size(); i++) {
+    out_arcs[lattice_arcs[i].source].push_back(i);
+    in_degree[lattice_arcs[i].target]++;
+  }
+  std::vector<double> best_score(num_lattice_nodes, -HUGE_VAL);
+  std::vector<double> best_lm(num_lattice_nodes, 0);
+  std::vector<int> stack;
+  best_score[start] = 0;
+  for (int n = 0; n < num_lattice_nodes; n++)
+    if (in_degree[n] == 0)
+      stack.push_back(n);
+  int num_sorted = 0;
+  while (!stack.empty()) {
+    int n = stack.back();
+    stack.pop_back();
+    num_sorted++;
+    for (int i = 0; i < (int)out_arcs[n].size(); i++) {
+      const Lattice::Arc &arc = lattice_arcs[out_arcs[n][i]];
+      double score = best_score[n] + arc.am + lm_scale * arc.lm;
+      if (best_score[n] > -HUGE_VAL && score > best_score[arc.target]) {
+        best_score[arc.target] = score;
+        best_lm[arc.target] = best_lm[n] + arc.lm;
+      }
+      if (--in_degree[arc.target] == 0)
+        stack.push_back(arc.target);
+    }
+  }
+  if (num_sorted < num_lattice_nodes)
+    throw std::string("HmmNetCompiler::compile_lattice(): the lattice has cycles");
+  if (best_score[end] == -HUGE_VAL)
+    throw std::string("HmmNetCompiler::compile_lattice(): the end node can not be reached");
+
+  const std::string *silence = m_morphs ? &morph_boundary_word : &silence_word;
+  std::vector<Arc> phone_arcs;
+  int num_nodes = 1;
+  int node = 0;
+
+  if (!m_morphs && m_word_breaks.empty())
+    throw std::string("HmmNetCompiler::compile_lattice(): no word breaks in the lexicon");
+
+  // The lattice and the reference in parallel, with optional silences
+  // at both ends
+  add_word(node, silence, m_silence, true, num_nodes, phone_arcs);
+  int join = num_nodes++;
+  int first_lattice_node = num_nodes;
+  num_nodes += num_lattice_nodes;
+  phone_arcs.push_back(Arc(node, first_lattice_node + start, EPSILON, -1,
+                           NULL));
+  for (int i = 0; i < (int)lattice_arcs.size(); i++) {
+    const Lattice::Arc &arc = lattice_arcs[i];
+    int source = first_lattice_node + arc.source;
+    if (arc.word != "!NULL")
+      add_lexicon_word(source, arc.word, num_nodes, phone_arcs);
+    phone_arcs.push_back(Arc(source, first_lattice_node + arc.target,
+                             EPSILON, -1, NULL, arc.lm * log_base));
+  }
+  phone_arcs.push_back(Arc(first_lattice_node + end, join, EPSILON, -1,
+                           NULL));
+
+  int reference_node = num_nodes++;
+  phone_arcs.push_back(Arc(node, reference_node, EPSILON, -1, NULL,
+                           best_lm[end] * log_base));
+  add_transcription(reference_node, reference, num_nodes, phone_arcs);
+  phone_arcs.push_back(Arc(reference_node, join, EPSILON, -1, NULL));
+
+  node = join;
+  add_word(node, silence, m_silence, true, num_nodes, phone_arcs);
+  int final_node = num_nodes++;
+  phone_arcs.push_back(Arc(node, final_node, END_MARK, -1, NULL));
+
+  std::vector<Arc> arcs;
+  num_nodes = expand_contexts(num_nodes, phone_arcs, final_node, arcs);
+  write_network(num_nodes, arcs, final_node, file);
+}
+
+
+void // private
+HmmNetCompiler::build_context_network()
+{
+  std::string left, center, right;
+  std::vector<int> fillers;
+  int short_silence = -1;
+  int long_silence = -1;
+
+  // Create the context states reached after the HMMs
+  for (int h = 0; h < m_model.num_hmms(); h++) {
+    const std::string &label = m_model.hmm(h).label;
+    split_label(label, left, center, right);
+    context_state(target_context(label, center, right), true);
+    if (label == "_")
+      short_silence = h;
+    else if (label == "__")
+      long_silence = h;
+  }
+
+  std::map<std::string, int>::iterator it;
+  it = m_context_map.find("-__");
+  if (it == m_context_map.end() || long_silence < 0)
+    throw std::string("HmmNetCompiler: the model has no long silence contexts");
+  m_initial_context = it->second;
+  m_final_context = context_state("__-", false);
+
+  // Create the arcs for the context dependent phones
+  for (int h = 0; h < m_model.num_hmms(); h++) {
+    const std::string &label = m_model.hmm(h).label;
+    if (h == short_silence || h == long_silence)
+      continue;
+
+    // Filler models are transparent like short silences, and can
+    // also be instantiated between two long silences
+    if (label[0] == '_' && label.find_first_of("-+") == std::string::npos) {
+      fillers.push_back(h);
+      m_transparent_hmm[phone_index(label)] = h;
+      continue;
+    }
+
+    split_label(label, left, center, right);
+    std::string source = left + center;
+    if (left == "_-")
+      source = "__-";
+    int source_state = context_state(source, false);
+    int target_state = context_state(target_context(label, center, right),
+                                     false);
+    if (source_state < 0 || target_state < 0)
+      continue;
+    m_context_arcs[source_state].insert(
+      std::make_pair(phone_index(center), ContextArc(target_state, h)));
+  }
+
+  int long_phone = phone_index("__");
+  m_context_arcs[m_initial_context].insert(
+    std::make_pair(long_phone, ContextArc(m_final_context, long_silence)));
+  if (!fillers.empty()) {
+    int source = context_state("__f", true);
+    int target = context_state("f__", true);
+    m_context_arcs[m_initial_context].insert(
+      std::make_pair(long_phone, ContextArc(source, long_silence)));
+    m_context_arcs[target].insert(
+      std::make_pair(-1, ContextArc(m_initial_context, -1)));
+    for (int i = 0; i < (int)fillers.size(); i++)
+      m_context_arcs[source].insert(
+        std::make_pair(phone_index(m_model.hmm(fillers[i]).label),
+                       ContextArc(target, fillers[i])));
+  }
+  if (short_silence >= 0)
+    m_transparent_hmm[phone_index("_")] = short_silence;
+
+  m_silence.resize(1);
+  m_silence[0].push_back(long_phone);
+}
+
+
+int // private
+HmmNetCompiler::context_state(const std::string &context, bool create)
+{
+  std::map<std::string, int>::iterator it = m_context_map.find(context);
+  if (it != m_context_map.end())
+    return it->second;
+  if (!create)
+    return -1;
+  int state = m_context_arcs.size();
+  m_context_map[context] = state;
+  m_context_arcs.resize(state + 1);
+  return state;
+}
+
+
+int // private
+HmmNetCompiler::phone_index(const std::string &phone)
+{
+  std::map<std::string, int>::iterator it = m_phone_map.find(phone);
+  if (it != m_phone_map.end())
+    return it->second;
+  int index = m_transparent_hmm.size();
+  m_phone_map[phone] = index;
+  m_transparent_hmm.push_back(-1);
+  return index;
+}
+
+
+void // private
+HmmNetCompiler::add_transcription(int &node,
+                                  const std::vector<std::string> &words,
+                                  int &num_nodes,
+                                  std::vector<Arc> &arcs) const
+{
+  for (int i = 0; i < (int)words.size(); i++)
+    add_lexicon_word(node, words[i], num_nodes, arcs);
+}
+
+
+void // private
+HmmNetCompiler::add_lexicon_word(int &node, const std::string &word,
+                                 int &num_nodes,
+                                 std::vector<Arc> &arcs) const
+{
+  std::map<std::string, std::vector<Pronunciation> >::const_iterator it =
+    m_lexicon.find(word);
+  if (it == m_lexicon.end() ||
+      (!m_morphs && word[0] == '_' && word != "__"))
+    throw std::string("HmmNetCompiler: unknown word ") + word;
+  add_word(node, &it->first, it->second, false, num_nodes, arcs);
+
+  // Word breaks after the words if not in morph mode (see lex2fst.pl).
+  // The long silence is also a word of its own, without a word break.
+  if (m_morphs || word == "__")
+    return;
+  bool empty = true;
+  for (int p = 0; p < (int)it->second.size(); p++)
+    if (!it->second[p].empty())
+      empty = false;
+  if (!empty)
+    add_word(node, &silence_word, m_word_breaks, false, num_nodes, arcs);
+}
+
+
+void // private
+HmmNetCompiler::add_word(int &node, const std::string *word,
+                         const std::vector<Pronunciation> &pronunciations,
+                         bool optional, int &num_nodes,
+                         std::vector<Arc> &arcs) const
+{
+  int join = num_nodes++;
+  for (int p = 0; p < (int)pronunciations.size(); p++) {
+    const Pronunciation &pronunciation = pronunciations[p];
+    int source = num_nodes++;
+    arcs.push_back(Arc(node, source, WORD_START, -1, word));
+    for (int i = 0; i < (int)pronunciation.size(); i++) {
+      int target = num_nodes++;
+      arcs.push_back(Arc(source, target, PHONE, pronunciation[i], word));
+      source = target;
+    }
+    arcs.push_back(Arc(source, join, WORD_END, -1, NULL));
+  }
+  if (optional)
+    arcs.push_back(Arc(node, join, EPSILON, -1, NULL));
+  node = join;
+}
+
+
+int // private
+HmmNetCompiler::expand_contexts(int num_nodes,
+                                const std::vector<Arc> &phone_arcs,
+                                int &final_node, std::vector<Arc> &arcs) const
+{
+  typedef std::pair<int, int> State; // (phone node, context state)
+  typedef std::multimap<int, ContextArc>::const_iterator ContextIterator;
+  std::vector<std::vector<int> > out_arcs(num_nodes);
+  std::map<State, int> state_map;
+  std::vector<State> states;
+  std::vector<Arc> expanded_arcs;
+
+  for (int i = 0; i < (int)phone_arcs.size(); i++)
+    out_arcs[phone_arcs[i].source].push_back(i);
+
+  // Compose the phone network with the context network
+  states.push_back(State(0, m_initial_context));
+  state_map[states.back()] = 0;
+  for (int s = 0; s < (int)states.size(); s++) {
+    int node = states[s].first;
+    int context = states[s].second;
+    std::vector<std::pair<State, Arc> > new_arcs;
+
+    std::pair<ContextIterator, ContextIterator> range =
+      m_context_arcs[context].equal_range(-1);
+    for (ContextIterator it = range.first; it != range.second; ++it)
+      new_arcs.push_back(std::make_pair(State(node, it->second.target),
+                                        Arc(s, -1, EPSILON, -1, NULL)));
+
+    for (int i = 0; i < (int)out_arcs[node].size(); i++) {
+      const Arc &arc = phone_arcs[out_arcs[node][i]];
+      if (arc.type != PHONE) {
+        new_arcs.push_back(
+          std::make_pair(State(arc.target, context),
+                         Arc(s, -1, arc.type, -1, arc.word, arc.score)));
+        continue;
+      }
+      int transparent_hmm = m_transparent_hmm[arc.symbol];
+      if (transparent_hmm >= 0)
+        new_arcs.push_back(
+          std::make_pair(State(arc.target, context),
+                         Arc(s, -1, PHONE, transparent_hmm, arc.word)));
+      range = m_context_arcs[context].equal_range(arc.symbol);
+      for (ContextIterator it = range.first; it != range.second; ++it)
+        new_arcs.push_back(
+          std::make_pair(State(arc.target, it->second.target),
+                         Arc(s, -1, PHONE, it->second.hmm, arc.word)));
+    }
+
+    for (int i = 0; i < (int)new_arcs.size(); i++) {
+      std::map<State, int>::iterator it = state_map.find(new_arcs[i].first);
+      if (it == state_map.end()) {
+        it = state_map.insert(
+          std::make_pair(new_arcs[i].first, (int)states.size())).first;
+        states.push_back(new_arcs[i].first);
+      }
+      new_arcs[i].second.target = it->second;
+      expanded_arcs.push_back(new_arcs[i].second);
+    }
+  }
+
+  std::map<State, int>::iterator it =
+    state_map.find(State(final_node, m_final_context));
+  if (it == state_map.end())
+    throw std::string("HmmNetCompiler::compile(): empty network");
+  int final_state = it->second;
+
+  // Keep only the states from which the final state can be reached
+  std::vector<std::vector<int> > in_arcs(states.size());
+  for (int i = 0; i < (int)expanded_arcs.size(); i++)
+    in_arcs[expanded_arcs[i].target].push_back(i);
+  std::vector<int> state_index(states.size(), -1);
+  std::vector<int> stack(1, final_state);
+  state_index[final_state] = 0;
+  while (!stack.empty()) {
+    int state = stack.back();
+    stack.pop_back();
+    for (int i = 0; i < (int)in_arcs[state].size(); i++) {
+      int source = expanded_arcs[in_arcs[state][i]].source;
+      if (state_index[source] < 0) {
+        state_index[source] = 0;
+        stack.push_back(source);
+      }
+    }
+  }
+
+  // Renumber the states in the order of creation, so the initial
+  // state keeps the index 0
+  int num_states = 0;
+  for (int s = 0; s < (int)states.size(); s++)
+    if (state_index[s] >= 0)
+      state_index[s] = num_states++;
+
+  arcs.clear();
+  for (int i = 0; i < (int)expanded_arcs.size(); i++) {
+    Arc arc = expanded_arcs[i];
+    if (state_index[arc.source] < 0 || state_index[arc.target] < 0)
+      continue;
+    arc.source = state_index[arc.source];
+    arc.target = state_index[arc.target];
+    arcs.push_back(arc);
+  }
+  final_node = state_index[final_state];
+  return num_states;
+}
+
+
+void // private
+HmmNetCompiler::write_network(int num_nodes, const std::vector<Arc> &arcs,
+                              int final_node, FILE *file)
+{
+  fprintf(file, "#FSTBasic MaxPlus\n");
+  fprintf(file, "I 0\n");
+  fprintf(file, "F %d\n", final_node);
+
+  for (int i = 0; i < (int)arcs.size(); i++) {
+    const Arc &arc = arcs[i];
+    switch (arc.type) {
+    case EPSILON:
+    case WORD_END:
+      if (arc.score != 0)
+        fprintf(file, "T %d %d , , %g\n", arc.source, arc.target, arc.score);
+      else
+        fprintf(file, "T %d %d , ,\n", arc.source, arc.target);
+      break;
+    case WORD_START:
+      fprintf(file, "T %d %d #%s ,\n", arc.source, arc.target,
+              arc.word->c_str());
+      break;
+    case END_MARK:
+      fprintf(file, "T %d %d ##E ,\n", arc.source, arc.target);
+      break;
+    case PHONE:
+    {
+      // Expand the HMM states as in hmms2fsm.pl.  The state labels
+      // are marked with # on the arcs leaving the state, and the
+      // HMM label on the arcs leaving the HMM.
+      Hmm &hmm = m_model.hmm(arc.symbol);
+      int num_states = hmm.num_states();
+      int first = num_nodes;
+      num_nodes += num_states;
+      fprintf(file, "T %d %d , ,\n", arc.source, first);
+      for (int s = 0; s < num_states; s++) {
+        std::vector<int> &transitions =
+          m_model.state(hmm.state(s)).transitions();
+        for (int t = 0; t < (int)transitions.size(); t++) {
+          int offset = m_model.transition(transitions[t]).target_offset;
+          int target = s + offset;
+          fprintf(file, "T %d %d %d;%d%s;%s%s %s\n", first + s,
+                  target >= num_states ? arc.target : first + target,
+                  transitions[t], s, offset != 0 ? "#" : "",
+                  hmm.label.c_str(),
+                  (offset != 0 && s == num_states - 1) ? "#" : "",
+                  arc.word->c_str());
+        }
+      }
+      break;
+    }
+    default:
+      assert(false);
+    }
+  }
+}
+
+}
@@ -0,0 +1,212 @@
+#ifndef HMMNETCOMPILER_HH
+#define HMMNETCOMPILER_HH
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "HmmSet.hh"
+
+
+namespace aku {
+
+/** A class for compiling word transcriptions into numerator HMM
+ * networks.
+ *
+ * Performs the same expansions as the FST pipeline of \c
+ * create_hmmnets.pl (lexicon L.fst, optional silences, context
+ * expansion C.fst and HMM expansion H.fst), but builds the networks
+ * directly from the lexicon and the \ref HmmSet loaded once.  The
+ * context expansion follows \c hmms2trinet.pl: short silences and
+ * filler models are transparent to the context, and the utterance
+ * must start and end with a long silence.
+ *
+ * The resulting networks are written in the FST format read by \ref
+ * HmmNetBaumWelch.  Each word is started with a "#word" arc, and its
+ * HMM state arcs carry the word as the output label.
+ *
+ * Denominator networks are compiled from word lattices in the HTK
+ * Standard Lattice Format, such as the ones written by the token pass
+ * decoder, in the same way as the lattice branch of \c
+ * create_hmmnets.pl -d: the language model scores of the lattice are
+ * kept as arc weights, and the reference transcription is added in
+ * parallel with the lattice.
+ *
+ * After the lexicon has been read, compile(), read_lattice() and
+ * compile_lattice() do not modify the object, so several utterances can be compiled in
+ * parallel.
+ */
+class HmmNetCompiler {
+public:
+  HmmNetCompiler(HmmSet &model);
+
+  /** Reads the lexicon.  Each line contains a word, optionally
+   * followed by its probability in parentheses, and its
+   * pronunciation.  Context dependent phones in the pronunciations
+   * are reduced to their center phones.
+   */
+  void read_lexicon(FILE *file);
+
+  /** Sets morph mode (\c lex2fst.pl -m).  In morph mode word breaks
+   * are not inserted automatically, but the transcription must
+   * contain word boundary tokens (e.g. <w>).
+   */
+  void set_morphs(bool morphs) { m_morphs = morphs; }
+
+  /** Compiles a transcription into an HMM network.
+   * \param words the words of the transcription
+   * \param file the file where the network is written
+   * \exception std::string if a word is not in the lexicon or the
+   * network is empty
+   */
+  void compile(const std::vector<std::string> &words, FILE *file);
+
+  /** A word lattice read from SLF. */
+  struct Lattice {
+    /** An arc of the lattice. */
+    struct Arc {
+      Arc() : source(-1), target(-1), am(0), lm(0) { }
+      int source;
+      int target;
+      std::string word;
+      double am;
+      double lm;
+    };
+
+    Lattice() : num_nodes(-1), start(-1), end(-1), log_base(1),
+                lm_scale(1) { }
+    int num_nodes;
+    int start;
+    int end;
+    double log_base; //!< Natural logarithm of the base of the scores
+    double lm_scale;
+    std::vector<Arc> arcs;
+  };
+
+  /** Reads a word lattice in SLF.  Only one lattice is read, so
+   * several lattices can be read from the same stream.  The node
+   * lines are skipped.  All the arcs of the lattice are read even if
+   * it is invalid, so that the next lattice can be read after an
+   * error.
+   *
+   * \param file the file where the lattice is read from
+   * \param lattice the lattice is stored here
+   * \exception std::string if the lattice is invalid or the file ends
+   * before the last arc
+   */
+  void read_lattice(FILE *file, Lattice &lattice) const;
+
+  /** Compiles a word lattice into a denominator HMM network.  Null
+   * words (!NULL) are epsilons.
+   * The language model scores of the lattice arcs (converted to
+   * natural logarithm) are the weights of the network.  The reference
+   * path is weighted with the language model score of the best path
+   * of the lattice, as the pipeline normalizes the scores with the
+   * reference score, which is not available without the language
+   * model.
+   *
+   * \param lattice the lattice read by read_lattice()
+   * \param reference the words of the reference transcription
+   * \param file the file where the network is written
+   * \exception std::string if the lattice has cycles, its end node can
+   * not be reached, a word is not in the lexicon or the network is
+   * empty
+   */
+  void compile_lattice(const Lattice &lattice,
+                       const std::vector<std::string> &reference,
+                       FILE *file);
+
+private:
+  typedef std::vector<int> Pronunciation;
+
+  /// Types of the arcs in the phone network.
+  enum ArcType { EPSILON, WORD_START, WORD_END, PHONE, END_MARK };
+
+  /// An arc of the phone network or the context expanded network.
+  struct Arc {
+    Arc(int source, int target, ArcType type, int symbol,
+        const std::string *word, float score = 0)
+      : source(source), target(target), type(type), symbol(symbol),
+        word(word), score(score) { }
+    int source;
+    int target;
+    ArcType type;
+    int symbol; //!< Phone index in the phone network, HMM index after expansion
+    const std::string *word; //!< The word of the arc, or NULL
+    float score; //!< Log probability, only on epsilon arcs
+  };
+
+  /// An arc of the context network.
+  struct ContextArc {
+    ContextArc(int target, int hmm) : target(target), hmm(hmm) { }
+    int target;
+    int hmm; //!< HMM index, or -1 for epsilon arcs
+  };
+
+  /// Creates the context network from the HMM labels.
+  void build_context_network();
+
+  /// Returns the context state of the given context, creating it if needed.
+  int context_state(const std::string &context, bool create);
+
+  /// Returns the index of a phone symbol.
+  int phone_index(const std::string &phone);
+
+  /// Adds alternative pronunciations of a word to the phone network.
+  void add_word(int &node, const std::string *word,
+                const std::vector<Pronunciation> &pronunciations,
+                bool optional, int &num_nodes,
+                std::vector<Arc> &arcs) const;
+
+  /// Adds the words of a transcription and the word breaks between them.
+  void add_transcription(int &node, const std::vector<std::string> &words,
+                         int &num_nodes, std::vector<Arc> &arcs) const;
+
+  /// Adds a lexicon word and the word break after it.
+  void add_lexicon_word(int &node, const std::string &word, int &num_nodes,
+                        std::vector<Arc> &arcs) const;
+
+  /// Composes the phone network with the context network and trims it.
+  int expand_contexts(int num_nodes, const std::vector<Arc> &phone_arcs,
+                      int &final_node, std::vector<Arc> &arcs) const;
+
+  /// Expands the HMMs and writes the network.
+  void write_network(int num_nodes, const std::vector<Arc> &arcs,
+                     int final_node, FILE *file);
+
+  HmmSet &m_model;
+  bool m_morphs;
+
+  /// Pronunciations of the words as phone indices.
+  std::map<std::string, std::vector<Pronunciation> > m_lexicon;
+
+  /// Pronunciations of the word breaks (lexicon entries starting with "_").
+  std::vector<Pronunciation> m_word_breaks;
+
+  /// Phone symbols and their indices.
+  std::map<std::string, int> m_phone_map;
+
+  /// Arcs of the context network for each state, indexed by the
+  /// center phone (-1 for epsilon arcs).
+  std::vector<std::multimap<int, ContextArc> > m_context_arcs;
+
+  /// Context states and their indices.
+  std::map<std::string, int> m_context_map;
+
+  /// HMM indices of the phones transparent to the context, -1 for others.
+  std::vector<int> m_transparent_hmm;
+
+  /// Pronunciation of the optional silences (a long silence).
+  std::vector<Pronunciation> m_silence;
+
+  /// Context state at the beginning of the utterance.
+  int m_initial_context;
+
+  /// Context state at the end of the utterance.
+  int m_final_context;
+};
+
+}
+
+#endif /* HMMNETCOMPILER_HH */
@@ -4,6 +4,9 @@
 #include <math.h>
 #include <values.h>
 #include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "HmmSet.hh"
 #include "util.hh"
@@ -590,7 +593,11 @@ HmmSet::dump_mc_statistics(const std::string filename) const
   mcs << num_emission_pdfs() << std::endl;
   mcs << m_statistics_mode << std::endl;
 
+  // Only the mixtures with statistics are written, the reader
+  // accumulates by the mixture indices
   for (int i = 0; i < num_emission_pdfs(); i++) {
+    if (!m_emission_pdfs[i]->has_statistics())
+      continue;
     mcs << i << std::endl;
     m_emission_pdfs[i]->dump_statistics(mcs);
   }
@@ -617,7 +624,10 @@ HmmSet::dump_gk_statistics(const std::string filename) const
   gks.write((char*)&di, sizeof(int));
   gks.write((char*)&m_statistics_mode, sizeof(PDF::StatisticsMode));
 
+  // Only the Gaussians with statistics are written
   for (int g=0; gks && g<m_pool.size(); g++) {
+    if (!m_pool.get_pdf(g)->has_statistics())
+      continue;
     gks.write((char*)&g, sizeof(int));
     m_pool.get_pdf(g)->dump_statistics(gks);
   }
@@ -725,6 +735,12 @@ HmmSet::accumulate_mc_from_dump(const std::string filename)
     m_emission_pdfs[pdf]->accumulate_from_dump(mcs, m_statistics_mode);
   
   mcs.close();
+
+  // Mixtures without statistics are not in the dump, but their
+  // accumulators are still expected to exist
+  for (int i = 0; i < num_emission_pdfs(); i++)
+    if (!m_emission_pdfs[i]->is_accumulating())
+      m_emission_pdfs[i]->start_accumulating(m_statistics_mode);
 }
 
 
@@ -762,6 +778,12 @@ HmmSet::accumulate_gk_from_dump(const std::string filename)
     m_pool.get_pdf(pdf)->accumulate_from_dump(gks, m_statistics_mode);
   }
   gks.close();
+
+  // Gaussians without statistics are not in the dump, but their
+  // accumulators are still expected to exist
+  for (int i = 0; i < num_pdfs; i++)
+    if (!m_pool.get_pdf(i)->is_accumulating())
+      m_pool.get_pdf(i)->start_accumulating(m_statistics_mode);
 }
 
 
@@ -837,6 +859,20 @@ HmmSet::estimate_parameters(PDF::EstimationMode mode, bool pool, bool mixture)
 }
 
 
+namespace {
+
+// Fills a symmetric matrix from its upper triangle stored row by row.
+void
+unpack_symmetric(const double *packed, Matrix &m)
+{
+  for (int i=0; i<m.rows(); i++)
+    for (int j=i; j<m.cols(); j++)
+      m(i,j) = m(j,i) = *packed++;
+}
+
+}
+
+
 // FIXME: Move to PDFPool?
 void
 HmmSet::estimate_mllt(FeatureGenerator &fea_gen, const std::string &mllt_name)
@@ -873,7 +909,11 @@ HmmSet::estimate_mllt(FeatureGenerator &fea_gen, const std::string &mllt_name)
     G[i] = 0;
   }
 
-  // Get the total gamma for Gaussians which have full stats available
+  // Collect the Gaussians which have full stats available, get their
+  // total gamma and cache their sample covariances.  The covariances are
+  // symmetric, so only the upper triangle is stored.
+  std::vector<Gaussian*> full_gaussians;
+  std::vector<double> gammas;
   for (int g=0; g<m_pool.size(); g++) {
     Gaussian *gaussian = dynamic_cast< Gaussian* >
       (m_pool.get_pdf(g));
@@ -881,25 +921,35 @@ HmmSet::estimate_mllt(FeatureGenerator &fea_gen, const std::string &mllt_name)
       continue;
     if (!gaussian->full_stats_accumulated(PDF::ML_BUF))
       continue;
-    beta += gaussian->m_accums[PDF::ML_BUF]->gamma();
+    full_gaussians.push_back(gaussian);
+    gammas.push_back(gaussian->m_accums[PDF::ML_BUF]->gamma());
+    beta += gammas.back();
+  }
+  const int num_full = full_gaussians.size();
+  const int packed_size = dim()*(dim()+1)/2;
+  std::vector<double> sample_covariances((size_t)num_full*packed_size);
+  for (int g=0; g<num_full; g++) {
+    full_gaussians[g]->m_accums[PDF::ML_BUF]->get_covariance_estimate(
+      curr_sample_covariance);
+    double *packed = &sample_covariances[(size_t)g*packed_size];
+    for (int i=0; i<dim(); i++)
+      for (int j=i; j<dim(); j++)
+        *packed++ = curr_sample_covariance(i,j);
   }
 
+  // Diagonals of the current covariances, updated in every iteration
+  std::vector<double> variances((size_t)num_full*dim());
+  // Weighted sums of the sample covariances, one for each dimension
+  std::vector<double> weighted_sums((size_t)dim()*packed_size);
+
   // Iterate long enough
   for (int mllt_iter=0; mllt_iter<MAX_MLLT_ITER; mllt_iter++) {
     
     // Estimate the diagonal covariances
-    for (int g=0; g < m_pool.size(); g++) {
-      // Ensure that the current Gaussian has full covariance statistics
-      // accumulated or else skip to the next one
-      Gaussian *gaussian = dynamic_cast< Gaussian* >
-        (m_pool.get_pdf(g));
-      if (gaussian == NULL)
-        continue;
-      if (!gaussian->full_stats_accumulated(PDF::ML_BUF))
-        continue;
-
-      gaussian->m_accums[PDF::ML_BUF]->get_covariance_estimate(
-        curr_sample_covariance);
+    for (int g=0; g < num_full; g++) {
+      Gaussian *gaussian = full_gaussians[g];
+      unpack_symmetric(&sample_covariances[(size_t)g*packed_size],
+                       curr_sample_covariance);
       Blas_Mat_Mat_Mult(A, curr_sample_covariance, temp_m, 1.0, 0.0);
       Blas_Mat_Mat_Trans_Mult(temp_m, A, new_covariance, 1.0, 0.0);
       // Check that covariances are valid
@@ -920,34 +970,40 @@ HmmSet::estimate_mllt(FeatureGenerator &fea_gen, const std::string &mllt_name)
               /(gaussian->m_accums[PDF::ML_BUF]->feacount() +
                 m_pool.get_covsmooth());
       gaussian->set_covariance(new_covariance);
+      gaussian->get_covariance(curr_covariance);
+      for (int i=0; i<dim(); i++)
+        variances[(size_t)g*dim() + i] = curr_covariance(i,i);
     }
     
-    // Calculate the auxiliary matrix G
-    for (int i=0; i<dim(); i++)
+    // Calculate the auxiliary matrices G in one pass over the Gaussians.
+    // The dimensions are divided between the threads, and each sum is
+    // accumulated in the order of the Gaussians, so the result does not
+    // depend on the number of threads.
+    int num_blocks = 1;
+#ifdef _OPENMP
+    num_blocks = std::min(omp_get_max_threads(), dim());
+#endif
+    std::fill(weighted_sums.begin(), weighted_sums.end(), 0);
+#pragma omp parallel for schedule(static, 1)
+    for (int b=0; b<num_blocks; b++)
     {
-      temp_m=0;
-      for (int g=0; g<m_pool.size(); g++)
+      int first = b*dim()/num_blocks;
+      int last = (b+1)*dim()/num_blocks;
+      for (int g=0; g<num_full; g++)
       {
-        Gaussian *gaussian = dynamic_cast< Gaussian* >
-          (m_pool.get_pdf(g));
-        if (gaussian == NULL)
-          continue;
-        if (!gaussian->full_stats_accumulated(PDF::ML_BUF))
-          continue;
-
-        gaussian->m_accums[PDF::ML_BUF]->get_covariance_estimate(
-          curr_sample_covariance);
-        gaussian->get_covariance(curr_covariance);
-#ifdef ORIGINAL_LAPACKPP
-        LinearAlgebra::Blas_Add_Mat_Mult(temp_m,
-                                         gaussian->m_accums[PDF::ML_BUF]->gamma()/
-                                         curr_covariance(i,i), curr_sample_covariance);
-#else
-        Blas_Add_Mat_Mult(temp_m,
-                          gaussian->m_accums[PDF::ML_BUF]->gamma()/
-                          curr_covariance(i,i), curr_sample_covariance);
-#endif
+        const double *packed = &sample_covariances[(size_t)g*packed_size];
+        for (int i=first; i<last; i++)
+        {
+          double weight = gammas[g]/variances[(size_t)g*dim() + i];
+          double *sum = &weighted_sums[(size_t)i*packed_size];
+          for (int k=0; k<packed_size; k++)
+            sum[k] += weight*packed[k];
+        }
       }
+    }
+    for (int i=0; i<dim(); i++)
+    {
+      unpack_symmetric(&weighted_sums[(size_t)i*packed_size], temp_m);
       // Invert
       LinearAlgebra::inverse(temp_m, G[i]);
     }
@@ -991,13 +1047,8 @@ HmmSet::estimate_mllt(FeatureGenerator &fea_gen, const std::string &mllt_name)
   }
   
   // Transform means and covariances
-  for (int g=0; g<m_pool.size(); g++) {
-    Gaussian *gaussian = dynamic_cast< Gaussian* >
-      (m_pool.get_pdf(g));
-    if (gaussian == NULL)
-      continue;
-    if (!gaussian->full_stats_accumulated(PDF::ML_BUF))
-      continue;
+  for (int g=0; g<num_full; g++) {
+    Gaussian *gaussian = full_gaussians[g];
     
     // Transform mean
     LaVectorDouble old_mean(dim());
@@ -1007,8 +1058,8 @@ HmmSet::estimate_mllt(FeatureGenerator &fea_gen, const std::string &mllt_name)
     gaussian->set_mean(new_mean);
     
     // Re-estimate the covariances
-    gaussian->m_accums[PDF::ML_BUF]->get_covariance_estimate(
-      curr_sample_covariance);
+    unpack_symmetric(&sample_covariances[(size_t)g*packed_size],
+                     curr_sample_covariance);
     Blas_Mat_Mat_Mult(A, curr_sample_covariance, temp_m, 1.0, 0.0);
     Blas_Mat_Mat_Trans_Mult(temp_m, A, new_covariance, 1.0, 0.0);
     // Check that covariances are valid
@@ -1057,26 +1108,15 @@ HmmSet::estimate_mllt(FeatureGenerator &fea_gen, const std::string &mllt_name)
 int
 HmmSet::delete_gaussians(double minocc)
 {
-  std::vector<int> index_map;
   int orig_pool_size = m_pool.size();
 
-  index_map.resize(orig_pool_size);
-  // Initialize the index map
-  for (int i = 0; i < orig_pool_size; i++)
-    index_map[i] = i;
-
   // Find the Gaussians to be deleted
+  std::vector<bool> remove(orig_pool_size, false);
   for (int i = 0; i < orig_pool_size; i++)
   {
-    if (m_pool.get_gaussian_occupancy(i) < minocc)
-    {
-      if (m_pool.get_gaussian_occupancy(i) >= 0) // Check this was valid value
-      {
-        for (int j = i+1; j < orig_pool_size; j++)
-          index_map[j]--;
-        index_map[i] = -1; // Mark for deletion
-      }
-    }
+    double occ = m_pool.get_gaussian_occupancy(i);
+    if (occ < minocc && occ >= 0) // Check this was valid value
+      remove[i] = true;
   }
 
   // Retain at least one Gaussian for each mixture
@@ -1087,7 +1127,7 @@ HmmSet::delete_gaussians(double minocc)
     Mixture *cur_mixture = m_emission_pdfs[p];
     for (int i = 0; i < cur_mixture->size(); i++)
     {
-      if (index_map[cur_mixture->get_base_pdf_index(i)] >= 0)
+      if (!remove[cur_mixture->get_base_pdf_index(i)])
       {
         all_deleted = false;
         break;
@@ -1107,106 +1147,84 @@ HmmSet::delete_gaussians(double minocc)
         }
       }
       assert( max_index >= 0);
-      // Find the new index
-      int new_index = 0;
-      for (int j = max_index-1; j >= 0; j--)
-        if (index_map[j] >= 0)
-        {
-          new_index = index_map[j]+1;
-          break;
-        }
-      // Update the index map
-      index_map[max_index] = new_index;
-      for (int j = max_index+1; j < orig_pool_size; j++)
-        if (index_map[j] >= 0)
-          index_map[j]++;
+      remove[max_index] = false;
     }
   }
 
-  // Delete the Gaussians
-  int index_offset = 0;
-  for (int i = 0; i < orig_pool_size; i++)
-    if (index_map[i] < 0)
-    {
-      m_pool.delete_pdf(i-index_offset);
-      index_offset++;
-    }
-
-  // Update the mixtures
-  for (int p = 0; p < num_emission_pdfs(); p++)
-  {
-    m_emission_pdfs[p]->update_components(index_map);
-    assert( m_emission_pdfs[p]->size() > 0 );
-  }
-  return index_offset; // Return the number of Gaussians deleted
+  return compact_pool(remove);
 }
 
 
 int HmmSet::remove_mixture_components(double min_weight)
 {
-  std::vector<int> gauss_count;
-  int orig_pool_size = m_pool.size();
-
-  gauss_count.resize(orig_pool_size);
-  fill(gauss_count.begin(), gauss_count.end(), 0);
+  std::vector<bool> remove(m_pool.size(), true);
+  std::vector<bool> remove_component;
+  std::vector<std::pair<double, int> > order;
 
   // Iterate through mixtures
   for (int m = 0; m < num_emission_pdfs(); m++)
   {
-    for (;;)
+    Mixture *cur_mixture = m_emission_pdfs[m];
+
+    // Removing the smallest component and normalizing the rest is
+    // repeated as long as the smallest normalized weight is below the
+    // threshold.  Equivalently, remove the components in the order of
+    // increasing weight while the weight relative to the sum of the
+    // remaining weights is below the threshold.
+    order.clear();
+    double sum = 0;
+    for (int i = 0; i < cur_mixture->size(); i++)
     {
-      // Find the minimum weight
-      double cur_min_weight = m_emission_pdfs[m]->get_mixture_coefficient(0);
-      int min_index = 0;
-      for (int i = 1; i < m_emission_pdfs[m]->size(); i++)
-      {
-        if (m_emission_pdfs[m]->get_mixture_coefficient(i) < cur_min_weight)
-        {
-          cur_min_weight = m_emission_pdfs[m]->get_mixture_coefficient(i);
-          min_index = i;
-        }
-      }
-      if (cur_min_weight > min_weight)
-        break; // Nothing to remove from this mixture
-      m_emission_pdfs[m]->remove_component(min_index);
+      order.push_back(std::make_pair(cur_mixture->get_mixture_coefficient(i),
+                                     i));
+      sum += cur_mixture->get_mixture_coefficient(i);
     }
-    // Finished removing the components, fill the Gaussian counts
-    for (int i = 0; i < m_emission_pdfs[m]->size(); i++)
-      gauss_count[m_emission_pdfs[m]->get_base_pdf_index(i)]++;
+    std::stable_sort(order.begin(), order.end());
+    remove_component.assign(cur_mixture->size(), false);
+    int num_removed = 0;
+    for (int i = 0; i < (int)order.size() - 1; i++)
+    {
+      if (order[i].first / sum > min_weight)
+        break; // Nothing more to remove from this mixture
+      remove_component[order[i].second] = true;
+      sum -= order[i].first;
+      num_removed++;
+    }
+    if (num_removed > 0)
+      cur_mixture->remove_components(remove_component);
+
+    // Finished removing the components, mark the used Gaussians
+    for (int i = 0; i < cur_mixture->size(); i++)
+      remove[cur_mixture->get_base_pdf_index(i)] = false;
   }
 
   // Delete Gaussians which no longer have references
-  std::vector<int> index_map;
-  int cur_index = 0, index_offset = 0;
-  index_map.resize(orig_pool_size);
-  // Fill the index map
-  for (int i = 0; i < orig_pool_size; i++)
-  {
-    if (gauss_count[i] == 0)
-      index_map[i] = -1;
-    else
-      index_map[i] = cur_index++;
-  }
+  return compact_pool(remove);
+}
+
+
+int
+HmmSet::compact_pool(const std::vector<bool> &remove)
+{
+  // Compute the new indices as a prefix sum of the retained Gaussians
+  std::vector<int> index_map(m_pool.size());
+  int cur_index = 0;
+  for (int i = 0; i < (int)index_map.size(); i++)
+    index_map[i] = remove[i] ? -1 : cur_index++;
+
+  int num_deleted = (int)index_map.size() - cur_index;
+  if (num_deleted == 0)
+    return 0;
 
-  if (cur_index < orig_pool_size)
+  m_pool.delete_pdfs(index_map);
+
+  // Update the mixtures (component numbers have changed!)
+  for (int p = 0; p < num_emission_pdfs(); p++)
   {
-    // Delete the Gaussians
-    for (int i = 0; i < orig_pool_size; i++)
-      if (index_map[i] < 0)
-      {
-        m_pool.delete_pdf(i-index_offset);
-        index_offset++;
-      }
-    
-    // Update the mixtures (component numbers have changed!)
-    for (int p = 0; p < num_emission_pdfs(); p++)
-    {
-      assert( m_emission_pdfs[p]->size() > 0 );
-      m_emission_pdfs[p]->update_components(index_map);
-      assert( m_emission_pdfs[p]->size() > 0 );
-    }
+    m_emission_pdfs[p]->update_components(index_map);
+    assert( m_emission_pdfs[p]->size() > 0 );
   }
-  return index_offset; // Return the number of Gaussians deleted
+  return num_deleted; // Return the number of Gaussians deleted
 }
 
 
@@ -358,12 +358,15 @@ public:
    */
   void dump_ph_statistics(const std::string filename) const;
 
-  /** Dumps the mixture coefficient statistics
+  /** Dumps the mixture coefficient statistics.  Mixtures without
+   * accumulated occupancy are left out.
    * \param filename name of the dump file, preferably .mcs
    */
   void dump_mc_statistics(const std::string filename) const;
 
-  /** Dumps the base distribution probabilities to a file
+  /** Dumps the base distribution probabilities to a file.  Only the
+   * Gaussians with accumulated occupancy are written, each preceded by
+   * its pool index.
    * \param filename name of the dump file, preferably .gks
    */
   void dump_gk_statistics(const std::string filename) const;
@@ -378,12 +381,14 @@ public:
    */
   void accumulate_ph_from_dump(const std::string filename);
 
-  /** Accumulates the mixture coefficient statistics from a dump file
+  /** Accumulates the mixture coefficient statistics from a dump file.
+   * Accumulating is started for the mixtures missing from the dump.
    * \param filename name of the dump file, preferably .mcs
    */
   void accumulate_mc_from_dump(const std::string filename);
 
-  /** Accumulates the base distribution statistics from a dump file
+  /** Accumulates the base distribution statistics from a dump file.
+   * Accumulating is started for the Gaussians missing from the dump.
    * \param filename name of the dump file, preferably .gks
    */
   void accumulate_gk_from_dump(const std::string filename);
@@ -455,6 +460,14 @@ public:
    */
   int remove_mixture_components(double min_weight);
 
+  /** Deletes the marked Gaussians from the pool and updates the mixtures
+   * in one pass.
+   * \param remove Flags indexed by pool index, true for the Gaussians
+   *               to be deleted
+   * \return Number of Gaussians deleted
+   */
+  int compact_pool(const std::vector<bool> &remove);
+
   /** Splits every Gaussian in the pool with some constrains
    * OBS!! ASSUMES CURRENTLY CONTINUOUS-DENSITY HMMS!!
    * Split condition: (Occupancy of Mixture)^splitalpha / (Number of Gaussians in Mixture) > minocc
@@ -190,6 +190,7 @@ public:
     virtual void accumulate_from_dump(std::istream &is, StatisticsMode mode) { m_g->accumulate_from_dump(is, mode); }
     virtual void stop_accumulating() { m_g->stop_accumulating(); }
     virtual bool accumulated(int accum_pos) const {return m_g->accumulated(accum_pos);}
+    virtual bool has_statistics() const {return m_g->has_statistics();}
     virtual void ismooth_statistics(int source, int target, double smoothing) { m_g->ismooth_statistics(source, target, smoothing); }
     virtual void estimate_parameters(EstimationMode mode, double minvar, double covsmooth, double c1, double c2, double tau, bool ml_stats_target) { m_g->estimate_parameters(mode, minvar, covsmooth, c1, c2, tau, ml_stats_target); }
     virtual void split(Gaussian &g1, Gaussian &g2, double perturbation) const { throw std::string("Not implemented!"); }
@@ -197,6 +198,9 @@ public:
     virtual void merge(double weight1, const Gaussian &m1, double weight2, const Gaussian &m2, bool finish_statistics) { throw std::string("Not implemented!"); }
     virtual void merge(const std::vector<double> &weights, const std::vector<const Gaussian*> &gaussians, bool finish_statistics) {throw std::string("Not implemented!"); }
     virtual void draw_sample(Vector &sample) {throw std::string("Not implemented!");}
+    virtual void draw_sample(Vector &sample, mtw::Rnd &rnd, ziggurat::Rnd &normal_rnd) {throw std::string("Not implemented!");}
+    virtual bool has_feature_cache() const { return true; }
+    virtual void reset_feature_cache() { m_fv.reset_cache(); }
     virtual bool full_stats_accumulated(int accum_pos) {return m_g->full_stats_accumulated(accum_pos);}
     virtual void set_covariance(const Vector &covariance, bool finish_statistics) {return m_g->set_covariance(covariance, finish_statistics);}
   };
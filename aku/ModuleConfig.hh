@@ -33,6 +33,14 @@ public:
   /** Return the number of lines read on last call of \ref read() */
   int num_lines_read() const { return m_num_lines_read; }
 
+  /** Return true if no values have been set. */
+  bool empty() const { return m_names.empty(); }
+
+  /** Return true if both configurations have the same values in the
+   * same order. */
+  bool operator==(const ModuleConfig &other) const
+  { return m_names == other.m_names && m_values == other.m_values; }
+
 private:
   /** Insert the (name, value) pair in the map and vector structures. */
   void insert(const std::string &name, const std::string &value);
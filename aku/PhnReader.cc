@@ -13,13 +13,15 @@
 
 namespace aku {
 
+const char *PhnReader::binary_magic = "PHNBIN1\n";
+
 PhnReader::Phn::Phn()
-  : start(0), end(0)
+  : start(0), end(0), state(-1), hmm(-1)
 {
 }
 
 PhnReader::PhnReader(HmmSet *model)
-  : m_file(NULL), m_model(model),
+  : m_file(NULL), m_binary(false), m_data_start(0), m_model(model),
     m_state_num_labels(false), m_relative_sample_numbers(false)
 {
   set_frame_rate(125); // Default frame rate
@@ -53,6 +55,26 @@ PhnReader::open(std::string filename)
     perror("error");
     exit(1);
   }
+
+  // Detect binary alignments
+  char magic[8];
+  m_binary = (fread(magic, 1, 8, m_file) == 8 &&
+              memcmp(magic, binary_magic, 8) == 0);
+  if (m_binary) {
+    if (m_model == NULL)
+      throw std::string("PhnReader::open(): the HMM model is required to "
+                        "read the binary alignment ") + filename;
+    int num_hmms;
+    if (fread(&num_hmms, sizeof(int), 1, m_file) != 1)
+      throw std::string("PhnReader::open(): read error in ") + filename;
+    if (num_hmms != m_model->num_hmms())
+      throw str::fmt(1024, "PhnReader::open(): binary alignment %s has %d "
+                     "HMMs, but the model has %d\n", filename.c_str(),
+                     num_hmms, m_model->num_hmms());
+  }
+  else
+    fseek(m_file, 0, SEEK_SET);
+  m_data_start = ftell(m_file);
 }
 
 void
@@ -67,7 +89,7 @@ void
 PhnReader::reset(void)
 {
   assert( m_file != NULL );
-  fseek(m_file, 0, SEEK_SET);
+  fseek(m_file, m_data_start, SEEK_SET);
 
   m_current_line = 0;
   m_current_frame = -1;
@@ -161,7 +183,7 @@ PhnReader::next_frame(void)
   assert( m_current_frame >= m_cur_phn.start );
   assert( m_current_frame <= m_cur_phn.end );
 
-  if (m_state_num_labels)
+  if (m_state_num_labels && m_cur_phn.hmm < 0)
   {
     cur_state_index = m_cur_phn.state;
   }
@@ -169,29 +191,18 @@ PhnReader::next_frame(void)
   {
     if (m_cur_phn.state < 0)
       throw std::string("PhnReader::next_frame(): A state segmented phn file is required");
-    Hmm &hmm = m_model->hmm(m_model->hmm_index(m_cur_phn.label[0]));
-    cur_state_index = hmm.state(m_cur_phn.state);
+    int hmm_index = m_cur_phn.hmm;
+    if (hmm_index < 0)
+      hmm_index = m_model->hmm_index(m_cur_phn.label[0]);
+    cur_state_index = m_model->hmm(hmm_index).state(m_cur_phn.state);
   }
   m_cur_pdf.clear();
   m_cur_pdf.insert(IndexProbMap::value_type(
                      m_model->emission_pdf_index(cur_state_index), 1.0));
 
-  if (m_cur_phn.label.size() > 0)
-  {
-    m_cur_label = m_cur_phn.label[0];
-    if (m_cur_phn.label.size() > 1)
-    {
-      for (int i = 1 ; i < (int)m_cur_phn.label.size(); i++)
-      {
-        m_cur_label += ",";
-        m_cur_label += m_cur_phn.label[i];
-      }
-    }
-  }
-  else
-    m_cur_label = str::fmt(16, "%d", m_cur_phn.state);
-
-  if (m_cur_phn.label.size() > 0)
+  if (m_cur_phn.hmm >= 0)
+    m_cur_label = m_model->hmm(m_cur_phn.hmm).label;
+  else if (m_cur_phn.label.size() > 0)
   {
     m_cur_label = m_cur_phn.label[0];
     if (m_cur_phn.label.size() > 1)
@@ -231,7 +242,7 @@ PhnReader::next_frame(void)
       if (new_phn_loaded)
       {
         // Out transition
-        if (m_state_num_labels)
+        if (m_state_num_labels && prev_phn.hmm < 0)
         {
           // We don't have information which transition it is, select the first
           // out transition
@@ -245,7 +256,10 @@ PhnReader::next_frame(void)
         else
         {
           int cur_state = prev_phn.state;
-          Hmm &cur_hmm = m_model->hmm(m_model->hmm_index(prev_phn.label[0]));
+          int cur_hmm_index = prev_phn.hmm;
+          if (cur_hmm_index < 0)
+            cur_hmm_index = m_model->hmm_index(prev_phn.label[0]);
+          Hmm &cur_hmm = m_model->hmm(cur_hmm_index);
 
           // Find the correct transition
           for (int i = 0; i < (int)tr_index.size(); i++)
@@ -295,6 +309,8 @@ PhnReader::next_phn_line(Phn &phn)
 {
   if (m_last_line > 0 && m_current_line >= m_last_line)
     return false;
+  if (m_binary)
+    return read_binary_line(phn);
 
   do {
     // Read line at time
@@ -317,6 +333,7 @@ PhnReader::next_phn_line(Phn &phn)
   std::vector<std::string> fields;
 
   phn.state = -1; // state default value !
+  phn.hmm = -1;
   
   // If the first char is digit, we have start and end fields.
   if (isdigit(m_line[0])) {
@@ -357,6 +374,74 @@ PhnReader::next_phn_line(Phn &phn)
     phn.end = -1;
   }
 
+  if (!apply_frame_limits(phn))
+    return false;
+
+  // Read label and comments
+  phn.label.clear();
+  if (m_state_num_labels)
+  {
+    phn.state = atoi(fields[0].c_str()); // State number instead of label
+  }
+  else
+  {
+    str::split(&fields[0], ",", false, &phn.label);
+  }
+
+  if ((int)fields.size() > 1)
+    phn.comment = fields[1];
+  else
+    phn.comment = "";
+  
+  m_current_line++;
+  return true;
+}
+
+
+bool
+PhnReader::read_binary_line(Phn &phn)
+{
+  int record[4];
+  size_t num_read = fread(record, 1, sizeof(record), m_file);
+  if (num_read != sizeof(record)) {
+    if (ferror(m_file)) {
+      throw str::fmt(1024,
+                     "PhnReader::read_binary_line(): read error on line %d: %s\n",
+                     m_current_line, strerror(errno));
+    }
+    if (num_read > 0) {
+      throw str::fmt(1024,
+                     "PhnReader::read_binary_line(): truncated record on line %d\n",
+                     m_current_line);
+    }
+    return false;
+  }
+
+  phn.start = (int)(record[0]/m_samples_per_frame);
+  phn.end = (int)(record[1]/m_samples_per_frame);
+  phn.hmm = record[2];
+  phn.state = record[3];
+  if (phn.start > phn.end || phn.hmm < 0 || phn.hmm >= m_model->num_hmms()) {
+    throw str::fmt(
+      1024, "PhnReader::read_binary_line(): invalid segment on line %d\n",
+      m_current_line);
+  }
+
+  if (!apply_frame_limits(phn))
+    return false;
+
+  phn.label.resize(1);
+  phn.label[0] = m_model->hmm(phn.hmm).label;
+  phn.comment.clear();
+
+  m_current_line++;
+  return true;
+}
+
+
+bool
+PhnReader::apply_frame_limits(Phn &phn)
+{
   if (m_relative_sample_numbers && phn.start >= 0)
   {
     phn.start += m_first_frame;
@@ -377,25 +462,26 @@ PhnReader::next_phn_line(Phn &phn)
     phn.start = m_first_frame;
     assert( phn.start > phn.end );
   }
+  return true;
+}
 
-  // Read label and comments
-  phn.label.clear();
-  if (m_state_num_labels)
-  {
-    phn.state = atoi(fields[0].c_str()); // State number instead of label
-  }
-  else
-  {
-    str::split(&fields[0], ",", false, &phn.label);
-  }
 
-  if ((int)fields.size() > 1)
-    phn.comment = fields[1];
-  else
-    phn.comment = "";
-  
-  m_current_line++;
-  return true;
+void
+PhnReader::write_binary_header(FILE *file, const HmmSet &model)
+{
+  int num_hmms = model.num_hmms();
+  fwrite(binary_magic, 1, 8, file);
+  fwrite(&num_hmms, sizeof(int), 1, file);
+}
+
+
+void
+PhnReader::write_binary_line(FILE *file, int start, int end,
+                             int hmm, int state)
+{
+  int record[4] = { start, end, hmm, state };
+  if (fwrite(record, sizeof(int), 4, file) != 4)
+    throw std::string("PhnReader::write_binary_line(): write error");
 }
 
 }
@@ -23,6 +23,16 @@ namespace aku {
  * sample numbers refer to 16kHz files, if files in other sample rates
  * are used, the sample numbers for phn files are still computed as
  * 16000*time(seconds).
+ *
+ * State alignments can also be stored in a binary format, which is
+ * detected automatically from the magic string at the beginning of
+ * the file.  After the magic string follows the number of HMMs in the
+ * model (int), and then one record of four ints per segment: start
+ * sample, end sample, HMM index and HMM state index (-1 for phoneme
+ * segmentation).  The HMM indices refer to the model used in writing
+ * the file, so the reader must be given the model, the labels are
+ * not stored, and comments are not supported.  The ints are in the
+ * native byte order.
 */
 
 class PhnReader : public Segmentator {
@@ -36,6 +46,7 @@ public:
     int start;
     int end;
     int state;
+    int hmm; //!< HMM index in binary alignments, -1 otherwise
     std::vector<std::string> label;
     std::string speaker;
     std::string comment;
@@ -88,7 +99,28 @@ public:
    */
   bool next_phn_line(Phn &phn);
 
+  /** Writes the header of a binary alignment file. */
+  static void write_binary_header(FILE *file, const HmmSet &model);
+
+  /** Writes one segment to a binary alignment file.
+   * \param start start sample of the segment
+   * \param end end sample of the segment
+   * \param hmm HMM index of the segment
+   * \param state HMM state index of the segment, or -1
+   */
+  static void write_binary_line(FILE *file, int start, int end,
+                                int hmm, int state);
+
+  /// The magic string at the beginning of binary alignment files
+  static const char *binary_magic;
+
 private:
+  /// Reads one segment from a binary alignment file.
+  bool read_binary_line(Phn &phn);
+
+  /// Applies the frame limits and relative sample numbers to a segment.
+  bool apply_frame_limits(Phn &phn);
+
   float m_samples_per_frame;
 
   /// first line to be included (1-N); if no limits, m_first_line = 0
@@ -115,6 +147,12 @@ private:
   std::string m_line;
   FILE *m_file;
 
+  /// true if the file is a binary alignment
+  bool m_binary;
+
+  /// file position of the first line
+  long m_data_start;
+
   HmmSet *m_model;
 
   /// true if eof has been detected, or line/frame limits have been reached
@@ -673,30 +673,43 @@ PhonePool::soft_kmeans_clustering(double mixture_threshold, bool diagonal)
       //for (int k = 0; k < 50; k++) // Iterate the weights and Gaussians
       {
         std::vector<double> sum_occupancies;
-        std::vector<double> likelihoods;
+        std::vector<Vector> samples(1000);
+        std::vector< std::vector<double> > likelihoods(1000);
         occupancies.clear();
         occupancies.resize(cur_clusters.size());
         sum_occupancies.resize(kmeans_gauss.size());
-        likelihoods.resize(kmeans_gauss.size());
+        for (int l = 0; l < 1000; l++)
+          likelihoods[l].resize(kmeans_gauss.size());
         for (int c = 0; c < (int)cur_clusters.size(); c++)
         {
           // Find context phone cluster likelihood against kmeans Gaussians
           occupancies[c].resize(kmeans_gauss.size());
 
+          // Draw the samples from a generator seeded by the cluster,
+          // so the result does not depend on the global generator state
+          mtw::Rnd rnd(c+1);
+          ziggurat::Rnd normal_rnd(c+1);
+          for (int l = 0; l < 1000; l++)
+            cur_clusters[c]->statistics()->draw_sample(samples[l], rnd,
+                                                       normal_rnd);
+
+          // Score the samples in parallel, but sum them in order
+#pragma omp parallel for schedule(static)
+          for (int l = 0; l < 1000; l++)
+          {
+            for (int g = 0; g < (int)kmeans_gauss.size(); g++)
+              likelihoods[l][g] = kmeans_gauss[g]->compute_likelihood(
+                samples[l]);
+          }
           for (int l = 0; l < 1000; l++)
           {
-            Vector sample;
-            cur_clusters[c]->statistics()->draw_sample(sample);
             double sum = 0;
             for (int g = 0; g < (int)kmeans_gauss.size(); g++)
-            {
-              likelihoods[g] = kmeans_gauss[g]->compute_likelihood(sample);
-              sum += likelihoods[g];
-            }
+              sum += likelihoods[l][g];
             if (sum > 0)
             {
               for (int g = 0; g < (int)kmeans_gauss.size(); g++)
-                (occupancies[c])[g] += likelihoods[g]/sum;
+                (occupancies[c])[g] += likelihoods[l][g]/sum;
             }
           }
           for (int g = 0; g < (int)kmeans_gauss.size(); g++)
@@ -129,6 +129,7 @@ void PPToolbox::generate_to_fd(const int in_fd, const int out_fd, const bool raw
             throw std::string("Write error");
         }
     }
+  fflush(ofp);
 }
 
 
@@ -205,6 +206,7 @@ void PPToolbox::generate_from_file_to_fd(const std::string &input_name, const in
             throw std::string("Write error");
         }
     }
+  fflush(ofp);
 }
 
 
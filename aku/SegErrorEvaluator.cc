@@ -2,6 +2,7 @@
 #include <string.h>
 #include <algorithm>
 #include <list>
+#include <stdlib.h>
 
 #include "SegErrorEvaluator.hh"
 
@@ -94,6 +95,71 @@ SegErrorEvaluator::extract_word(const std::string &label)
 }
 
 
+int
+SegErrorEvaluator::intern_label(const std::string &label, bool reference)
+{
+  std::map<std::string, int>::iterator it = m_label_map.find(label);
+  int index;
+  if (it != m_label_map.end())
+    index = (*it).second;
+  else
+  {
+    index = (int)m_labels.size();
+    m_label_map[label] = index;
+    m_labels.push_back(LabelIds());
+    LabelIds &ids = m_labels.back();
+
+    if (m_error_mode == MPE || m_error_mode == MPE_SNFE)
+    {
+      std::string center_phone = extract_center_phone(label);
+      std::map<std::string, int>::iterator cp_it =
+        m_center_phone_map.find(center_phone);
+      if (cp_it == m_center_phone_map.end())
+      {
+        ids.center_phone = (int)m_center_phone_map.size();
+        m_center_phone_map[center_phone] = ids.center_phone;
+      }
+      else
+        ids.center_phone = (*cp_it).second;
+    }
+    else if (m_error_mode == MPFE_PDF ||
+             m_error_mode == MPFE_CONTEXT_PHONE_STATE ||
+             m_error_mode == MPFE_HYP_CONTEXT_PHONE_STATE)
+    {
+      ids.transition = atoi(extract_sublabel(label, 0).c_str());
+      if (m_error_mode != MPFE_CONTEXT_PHONE_STATE)
+      {
+        ids.source_state = m_model->transition(ids.transition).source_index;
+        ids.pdf = m_model->emission_pdf_index(ids.source_state);
+      }
+    }
+
+    if (m_ignore_silence)
+      ids.silence = (extract_word(label) == m_silence_word);
+  }
+
+  // The HMM is resolved only on the side that needs it, as the phone
+  // sublabel of the other side is never looked up
+  LabelIds &ids = m_labels[index];
+  if (ids.hmm == -2 &&
+      ((reference && m_error_mode == MPFE_CONTEXT_PHONE_STATE) ||
+       (!reference && m_error_mode == MPFE_HYP_CONTEXT_PHONE_STATE)))
+    ids.hmm = m_model->hmm_index(extract_sublabel(label, 2));
+  return index;
+}
+
+
+void
+SegErrorEvaluator::intern_arc_labels(
+  HmmNetBaumWelch::SegmentedLattice const *sl, bool reference,
+  std::vector<int> &arc_labels)
+{
+  arc_labels.resize(sl->arcs.size());
+  for (int a = 0; a < (int)sl->arcs.size(); a++)
+    arc_labels[a] = intern_label(sl->arcs[a].label, reference);
+}
+
+
 double
 SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
                                 int arc_index)
@@ -102,10 +168,6 @@ SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
   HmmNetBaumWelch::SegmentedArc const &cur_arc = sl->arcs[arc_index];
   int start_frame = sl->nodes[cur_arc.source_node].frame;
   int end_frame = sl->nodes[cur_arc.target_node].frame;
-  std::string center_phone_label;
-  std::string first_sublabel;
-  std::string phone_sublabel;
-  int cur_arc_pdf = -1;
   std::vector< std::pair<int, double> > snfe_ref_arcs;
 
   assert( sl->frame_lattice || (m_error_mode!=MPFE_MONOPHONE_LABEL &&
@@ -114,28 +176,21 @@ SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
                                 m_error_mode!=MPFE_PDF &&
                                 m_error_mode!=MPFE_CONTEXT_PHONE_STATE &&
                                 m_error_mode!=MPFE_HYP_CONTEXT_PHONE_STATE) );
-  
-  // Precompute labels for the current arc
-  if (m_error_mode == MPE || m_error_mode == MPE_SNFE)
-    center_phone_label = extract_center_phone(cur_arc.label);
-  else if (m_error_mode == MPFE_PDF ||
-           m_error_mode == MPFE_CONTEXT_PHONE_STATE)
-    first_sublabel = extract_sublabel(cur_arc.label, 0);
-  else if (m_error_mode == MPFE_HYP_CONTEXT_PHONE_STATE)
-    phone_sublabel = extract_sublabel(cur_arc.label, 2);
-
-  if (m_error_mode == MPFE_CONTEXT_PHONE_STATE)
-    cur_arc_pdf = atoi(first_sublabel.c_str());
+
+  // Parse the labels of the lattice on the first query
+  if (sl != m_hyp_lattice || m_hyp_arc_labels.size() != sl->arcs.size())
+  {
+    intern_arc_labels(sl, false, m_hyp_arc_labels);
+    m_hyp_lattice = sl;
+  }
+  int cur_label = m_hyp_arc_labels[arc_index];
+  const LabelIds &cur_ids = m_labels[cur_label];
 
   if (m_error_mode == MPE_SNFE)
     result = 0; // Computed as a sum over overlapping reference arcs
 
-  if (m_ignore_silence)
-  {
-    std::string word_label = extract_word(cur_arc.label);
-    if (!word_label.compare(m_silence_word)) // Silence label
-      return 0;
-  }
+  if (m_ignore_silence && cur_ids.silence)
+    return 0;
 
   // Go through all the reference arcs that overlap this arc
   RefIterator ref_it = reference_iterator(start_frame);
@@ -145,6 +200,8 @@ SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
   {
     HmmNetBaumWelch::SegmentedArc const &ref_arc =
       m_ref_lattice->arcs[*ref_it];
+    int ref_label = m_ref_arc_labels[*ref_it];
+    const LabelIds &ref_ids = m_labels[ref_label];
     int ref_start_frame = m_ref_lattice->nodes[ref_arc.source_node].frame;
     int ref_end_frame = m_ref_lattice->nodes[ref_arc.target_node].frame;
     double e = std::min(end_frame, ref_end_frame) -
@@ -155,7 +212,7 @@ SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
     {
       e /= (ref_end_frame - ref_start_frame);
       double new_custom = 0;
-      if (cur_arc.label == ref_arc.label)
+      if (cur_label == ref_label)
         new_custom = -1 + 2*e;
       else
         new_custom = -1 + e;
@@ -166,8 +223,7 @@ SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
     {
       e /= (ref_end_frame - ref_start_frame);
       double new_custom = 0;
-      std::string ref_label = extract_center_phone(ref_arc.label);
-      if (center_phone_label == ref_label)
+      if (cur_ids.center_phone == ref_ids.center_phone)
         new_custom = -1 + 2*e;
       else
         new_custom = -1 + e;
@@ -176,38 +232,29 @@ SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
     }
     else if (m_error_mode == MPFE_PDF)
     {
-      std::string ref_first_sublabel = extract_sublabel(ref_arc.label, 0);
-      HmmTransition &ref_tr =
-        m_model->transition(atoi(ref_first_sublabel.c_str()));
-      HmmTransition &tr = m_model->transition(atoi(first_sublabel.c_str()));
-      if (m_model->emission_pdf_index(ref_tr.source_index) ==
-          m_model->emission_pdf_index(tr.source_index))
+      if (ref_ids.pdf == cur_ids.pdf)
         result = 1;
       else
         result = std::max(result, 0.0);
     }
     else if (m_error_mode == MPFE_CONTEXT_PHONE_STATE)
     {
-      std::string ref_phone_label = extract_sublabel(ref_arc.label, 2);
-      Hmm &hmm = m_model->hmm(ref_phone_label);
+      Hmm &hmm = m_model->hmm(ref_ids.hmm);
       double temp_result = 0;
       for (int s = 0; s < hmm.num_states(); s++)
       {
-        if (hmm.state(s) == cur_arc_pdf)
+        if (hmm.state(s) == cur_ids.transition)
           temp_result = 1;
       }
       result = std::max(temp_result, result);
     }
     else if (m_error_mode == MPFE_HYP_CONTEXT_PHONE_STATE)
     {
-      std::string ref_trans_label = extract_sublabel(ref_arc.label, 0);
-      HmmTransition &ref_tr =
-        m_model->transition(atoi(ref_trans_label.c_str()));
-      Hmm &hmm = m_model->hmm(phone_sublabel);      
+      Hmm &hmm = m_model->hmm(cur_ids.hmm);
       double temp_result = 0;
       for (int s = 0; s < hmm.num_states(); s++)
       {
-        if (hmm.state(s) == ref_tr.source_index)
+        if (hmm.state(s) == ref_ids.source_state)
           temp_result = 1;
       }
       result = std::max(temp_result, result);
@@ -218,8 +265,7 @@ SegErrorEvaluator::custom_score(HmmNetBaumWelch::SegmentedLattice const *sl,
       double n = std::min(end_frame - start_frame,
                           ref_end_frame - ref_start_frame);
       e /= -n;
-      std::string ref_label = extract_center_phone(ref_arc.label);
-      if (center_phone_label == ref_label)
+      if (cur_ids.center_phone == ref_ids.center_phone)
         e = 0; // No error
       add_snfe_ref_arc_error(*ref_it, e, snfe_ref_arcs);
     }
@@ -239,6 +285,8 @@ SegErrorEvaluator::reset(void)
   m_first_frame = -1;
   m_arcs_in_frame.clear();
   m_sorted_arcs.clear();
+  m_ref_arc_labels.clear();
+  m_hyp_lattice = NULL;
   m_non_silence_frames = 0;
   m_non_silence_occupancy = 0;
 }
@@ -249,6 +297,8 @@ SegErrorEvaluator::initialize_reference(
   HmmNetBaumWelch::SegmentedLattice const *ref_lattice)
 {
   m_ref_lattice = ref_lattice;
+  intern_arc_labels(m_ref_lattice, true, m_ref_arc_labels);
+  m_hyp_lattice = NULL; // The previous lattices may have been freed
 
   // Fill and sort m_sorted_arcs
   m_sorted_arcs.resize(m_ref_lattice->arcs.size());
@@ -4,6 +4,7 @@
 #include "HmmSet.hh"
 #include "HmmNetBaumWelch.hh"
 #include <functional>
+#include <map>
 
 namespace aku {
 
@@ -107,7 +108,7 @@ public:
 
   
 public:
-  SegErrorEvaluator() { m_first_frame = -1; m_error_mode = MPE; m_model = NULL; m_ignore_silence = false; m_binary_mpfe = true; m_silence_word = "_"; }
+  SegErrorEvaluator() { m_first_frame = -1; m_error_mode = MPE; m_model = NULL; m_ignore_silence = false; m_binary_mpfe = true; m_silence_word = "_"; m_ref_lattice = NULL; m_hyp_lattice = NULL; }
 
   // CustomScoreQuery interface
   virtual ~SegErrorEvaluator() { }
@@ -115,10 +116,10 @@ public:
                               int arc_index);
 
   // Other public methods
-  void set_mode(ErrorMode mode) { m_error_mode = mode; }
-  void set_model(HmmSet *model) { m_model = model; }
-  void set_ignore_silence(bool silence) { m_ignore_silence = silence; }
-  void set_silence_word(const std::string &silence_word) { m_silence_word = silence_word; }
+  void set_mode(ErrorMode mode) { m_error_mode = mode; clear_labels(); }
+  void set_model(HmmSet *model) { m_model = model; clear_labels(); }
+  void set_ignore_silence(bool silence) { m_ignore_silence = silence; clear_labels(); }
+  void set_silence_word(const std::string &silence_word) { m_silence_word = silence_word; clear_labels(); }
   void initialize_reference(HmmNetBaumWelch::SegmentedLattice const *ref_lattice);
   void reset(void);
 
@@ -133,6 +134,33 @@ public:
   //int frames(void) { return (int)m_ref_segmentation.size(); }
 
 private:
+  /** Integer identifiers parsed from an arc label.  Only the fields
+   * needed by the current error mode are filled, the others are -1.
+   */
+  struct LabelIds {
+    int center_phone; //!< Interned center phone (MPE, MPE_SNFE)
+    int transition; //!< Transition index of the first sublabel
+    int pdf; //!< Emission PDF of the transition source (MPFE_PDF)
+    int source_state; //!< Source state of the transition
+    int hmm; //!< HMM of the phone sublabel, -2 if not resolved yet
+    bool silence; //!< True if the word is the silence word
+    LabelIds() : center_phone(-1), transition(-1), pdf(-1), source_state(-1),
+                 hmm(-2), silence(false) { }
+  };
+
+  /** Returns the interned index of the label, parsing it on the first
+   * occurrence.
+   * \param reference  True for the labels of the reference lattice
+   */
+  int intern_label(const std::string &label, bool reference);
+
+  /// Interns the labels of the arcs of a lattice
+  void intern_arc_labels(HmmNetBaumWelch::SegmentedLattice const *sl,
+                         bool reference, std::vector<int> &arc_labels);
+
+  /// Forgets the interned labels, needed if the parsing settings change
+  void clear_labels(void) { m_label_map.clear(); m_labels.clear(); m_center_phone_map.clear(); m_ref_arc_labels.clear(); m_hyp_lattice = NULL; }
+
   std::string extract_center_phone(const std::string &label);
   std::string extract_sublabel(const std::string &label, int count);
   std::string extract_word(const std::string &label);
@@ -188,6 +216,18 @@ private:
   std::vector< std::vector<int> > m_arcs_in_frame;
   /// Reference arc indices, sorted in ascending order by the starting frame
   std::vector<int> m_sorted_arcs;
+
+  /// Interned label indices of the reference arcs
+  std::vector<int> m_ref_arc_labels;
+
+  /// The lattice whose arc labels are in \ref m_hyp_arc_labels
+  HmmNetBaumWelch::SegmentedLattice const *m_hyp_lattice;
+  /// Interned label indices of the arcs of \ref m_hyp_lattice
+  std::vector<int> m_hyp_arc_labels;
+
+  std::map<std::string, int> m_label_map; //!< Label to interned index
+  std::vector<LabelIds> m_labels; //!< Parsed identifiers of the labels
+  std::map<std::string, int> m_center_phone_map; //!< Center phone indices
 };
 
 }
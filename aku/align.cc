@@ -19,6 +19,8 @@ int info;
 float overlap;
 bool no_force_end;
 bool set_speakers;
+bool binary_phn;
+bool print_states;
 
 conf::Config config;
 Recipe recipe;
@@ -31,15 +33,21 @@ void
 print_line(FILE *f, float fr, 
            int start, int end, 
            const std::string &label,
-           const std::string &comment)
+           const std::string &comment,
+           int hmm_index, int hmm_state_index)
 {
   int frame_mult = (int)(16000/fr); // NOTE: phn files assume 16kHz sample rate
     
   if (start < 0)
     return;
 
-  fprintf(f, "%d %d %s %s\n", start * frame_mult, end * frame_mult, 
-          label.c_str(), comment.c_str());
+  if (binary_phn)
+    PhnReader::write_binary_line(f, start * frame_mult, end * frame_mult,
+                                 hmm_index,
+                                 print_states ? hmm_state_index : -1);
+  else
+    fprintf(f, "%d %d %s %s\n", start * frame_mult, end * frame_mult, 
+            label.c_str(), comment.c_str());
 }
 
 
@@ -56,6 +64,8 @@ viterbi_align(Viterbi &viterbi, int start_frame, int end_frame,
   int print_start = -1;
   std::string print_label;
   std::string print_comment;
+  int print_hmm = -1;
+  int print_state = -1;
  
   viterbi.reset();
   viterbi.set_feature_frame(window_start_frame);
@@ -136,12 +146,14 @@ viterbi_align(Viterbi &viterbi, int start_frame, int end_frame,
         // Print pending line
         print_line(phn_out, fea_gen.frame_rate(), print_start,
                    f + window_start_frame, print_label,
-                   print_comment);
+                   print_comment, print_hmm, print_state);
         
         // Prepare the next print
         print_start = f + window_start_frame;
         print_label = state.label;
         print_comment = state.comment;
+        print_hmm = state.hmm_index;
+        print_state = state.hmm_state_index;
 
         // Speaker ID
         state.printed = true;
@@ -162,7 +174,7 @@ viterbi_align(Viterbi &viterbi, int start_frame, int end_frame,
   // FIXME: The end point window_start_frame+1 assumes 50% frame overlap
   print_line(phn_out, fea_gen.frame_rate(), print_start,
              window_start_frame + 1, print_label,
-             print_comment);
+             print_comment, print_hmm, print_state);
   return viterbi.best_path_log_prob();
 }
 
@@ -190,6 +202,7 @@ main(int argc, char *argv[])
       ('\0', "overlap=FLOAT", "arg", "0.4", "Viterbi window overlap (default 0.4)")
       ('\0', "no-force-end", "", "", "do not force to the last state")
       ('\0', "phoseg", "", "", "print phoneme segmentation instead of states")
+      ('\0', "binary-phn", "", "", "write the alignments in binary format")
       ('S', "speakers=FILE", "arg", "", "speaker configuration file")
       ('B', "batch=INT", "arg", "0", "number of batch processes with the same recipe")
       ('I', "bindex=INT", "arg", "0", "batch process index")
@@ -226,7 +239,9 @@ main(int argc, char *argv[])
     viterbi.set_prob_beam(config["beam"].get_float());
     viterbi.set_state_beam(config["sbeam"].get_int());
     viterbi.resize(win_size, win_size, config["sbeam"].get_int() / 4);
-    viterbi.set_print_all_states(!config["phoseg"].specified);
+    print_states = !config["phoseg"].specified;
+    binary_phn = config["binary-phn"].specified;
+    viterbi.set_print_all_states(print_states);
 
     overlap = 1-config["overlap"].get_float();
     no_force_end = config["no-force-end"].specified;
@@ -284,6 +299,8 @@ main(int argc, char *argv[])
                                        &phn_reader);
         
         phn_out_file.open(recipe.infos[f].alignment_path.c_str(), "w");
+        if (binary_phn)
+          PhnReader::write_binary_header(phn_out_file, model);
         
         ll = viterbi_align(viterbi, phn_reader.first_frame(),
                            (int)(recipe.infos[f].end_time*fea_gen.frame_rate()),
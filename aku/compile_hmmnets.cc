@@ -0,0 +1,261 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "io.hh"
+#include "str.hh"
+#include "conf.hh"
+#include "HmmSet.hh"
+#include "HmmNetCompiler.hh"
+#include "Recipe.hh"
+
+using namespace aku;
+
+conf::Config config;
+Recipe recipe;
+HmmSet model;
+int info;
+
+/// Transcriptions read from a TRN file, indexed by the utterance IDs
+std::map<std::string, std::vector<std::string> > trn_transcripts;
+
+
+void
+load_trn(const std::string &filename)
+{
+  io::Stream file(filename, "r");
+  std::string line;
+  std::vector<std::string> fields;
+
+  while (str::read_line(&line, file, true)) {
+    // The utterance ID is appended in parentheses, @ marks are ignored
+    for (int i = 0; i < (int)line.size(); i++)
+      if (line[i] == '@')
+        line[i] = ' ';
+    str::clean(&line, " \t");
+    str::split(&line, " \t", true, &fields);
+    if (fields.empty())
+      continue;
+    std::string key = fields.back();
+    if (key.size() < 2)
+      throw std::string("Invalid utterance code in ") + filename + ": " + line;
+    fields.pop_back();
+    trn_transcripts[key.substr(1, key.size() - 2)] = fields;
+  }
+}
+
+
+/// Converts a (triphone) PHN file to words, as phn2transcript.pl
+void
+phn_to_words(const std::string &filename, std::vector<std::string> &words)
+{
+  io::Stream file(filename, "r");
+  std::string line;
+  std::vector<std::string> fields;
+  std::string cur_word;
+
+  words.clear();
+  while (str::read_line(&line, file, true)) {
+    str::clean(&line, " \t");
+    str::split(&line, " \t", true, &fields);
+    if (fields.empty())
+      continue;
+
+    std::string label;
+    if (fields.size() > 1) {
+      std::string full_label = fields.size() > 2 ? fields[2] : "";
+      size_t dot = full_label.rfind('.');
+      if (dot == std::string::npos || dot == 0 ||
+          atoi(full_label.c_str() + dot + 1) == 0) {
+        if (dot != std::string::npos && dot > 0)
+          full_label.erase(dot);
+        size_t minus = full_label.find('-');
+        size_t plus = full_label.find('+');
+        if (minus != std::string::npos && plus != std::string::npos &&
+            minus < plus)
+          label = full_label.substr(minus + 1, plus - minus - 1);
+        else
+          label = full_label; // Monophone
+      }
+    }
+    else
+      label = fields[0]; // PHN without time information, assumes monophones
+
+    if (!label.empty() && label[label.size() - 1] == '_') {
+      if (!cur_word.empty())
+        words.push_back(cur_word);
+      cur_word.clear();
+    }
+    else
+      cur_word += label;
+  }
+  if (!cur_word.empty())
+    words.push_back(cur_word);
+}
+
+
+/// Reads the reference transcription of a recipe entry
+void
+read_reference(const Recipe::Info &rinfo, bool use_trn,
+               std::vector<std::string> &words)
+{
+  if (use_trn) {
+    std::map<std::string, std::vector<std::string> >::const_iterator it
+      = trn_transcripts.find(rinfo.utterance_id);
+    if (it == trn_transcripts.end())
+      throw std::string("No transcription for utterance ") +
+        rinfo.utterance_id;
+    words = it->second;
+  }
+  else
+    phn_to_words(rinfo.transcript_path, words);
+}
+
+
+/// Compiles the denominator hmmnets from the word graphs in the
+/// stream, one for each recipe entry in order.  Each word graph is
+/// read completely before anything else can fail, so that an error
+/// does not shift the later word graphs to the wrong entries.
+int
+compile_den_hmmnets(HmmNetCompiler &compiler, FILE *lattices, bool use_trn)
+{
+  int num_errors = 0;
+  std::vector<std::string> words;
+  HmmNetCompiler::Lattice lattice;
+  for (int f = 0; f < (int)recipe.infos.size(); f++) {
+    const Recipe::Info &rinfo = recipe.infos[f];
+    try {
+      compiler.read_lattice(lattices, lattice);
+      read_reference(rinfo, use_trn, words);
+      if (info > 0)
+        fprintf(stderr, "%s\n", rinfo.den_hmmnet_path.c_str());
+      io::Stream out(rinfo.den_hmmnet_path, "w");
+      compiler.compile_lattice(lattice, words, out);
+    }
+    catch (std::string &str) {
+      fprintf(stderr, "%s: %s\n", rinfo.den_hmmnet_path.c_str(),
+              str.c_str());
+      remove(rinfo.den_hmmnet_path.c_str());
+      num_errors++;
+      if (feof(lattices))
+        break;
+    }
+  }
+  return num_errors;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  try {
+    config("usage: compile_hmmnets [OPTION...]\n")
+      ('h', "help", "", "", "display help")
+      ('b', "base=BASENAME", "arg", "", "base filename for model files")
+      ('p', "ph=FILE", "arg", "", "HMM definitions")
+      ('l', "lexicon=FILE", "arg must", "", "lexicon")
+      ('r', "recipe=FILE", "arg must", "", "recipe file")
+      ('t', "trn=FILE", "arg", "", "transcriptions in TRN format, requires the utterance fields in the recipe")
+      ('m', "morphs", "", "", "morph lexicon, the transcriptions contain the word boundaries")
+      ('d', "den=FILE", "arg", "", "compile denominator hmmnets from the word graphs (SLF) in FILE (- for stdin), one for each recipe entry in order")
+      ('e', "existing", "", "", "skip hmmnets that exist already")
+      ('B', "batch=INT", "arg", "0", "number of batch processes with the same recipe")
+      ('I', "bindex=INT", "arg", "0", "batch process index")
+      ('i', "info=INT", "arg", "0", "info level")
+      ;
+    config.default_parse(argc, argv);
+
+    info = config["info"].get_int();
+
+    if (config["base"].specified)
+      model.read_ph(config["base"].get_str() + ".ph");
+    else if (config["ph"].specified)
+      model.read_ph(config["ph"].get_str());
+    else
+      throw std::string("Must give either --base or --ph");
+
+    HmmNetCompiler compiler(model);
+    compiler.set_morphs(config["morphs"].specified);
+    compiler.read_lexicon(io::Stream(config["lexicon"].get_str()));
+
+    if (config["trn"].specified)
+      load_trn(config["trn"].get_str());
+
+    recipe.read(io::Stream(config["recipe"].get_str()),
+                config["batch"].get_int(), config["bindex"].get_int(),
+                false);
+
+    bool skip_existing = config["existing"].specified;
+    bool use_trn = config["trn"].specified;
+
+    // The word graphs are read in recipe order, so the denominator
+    // hmmnets are compiled one at a time
+    if (config["den"].specified) {
+      if (skip_existing)
+        throw std::string("--existing is not supported with --den");
+      io::Stream lattices(config["den"].get_str(), "r");
+      int num_errors = compile_den_hmmnets(compiler, lattices, use_trn);
+      if (num_errors > 0) {
+        fprintf(stderr, "%d hmmnets could not be compiled\n", num_errors);
+        exit(1);
+      }
+      exit(0);
+    }
+
+    // The utterances are independent, compile them in parallel
+    int num_files = recipe.infos.size();
+    std::vector<std::string> errors(num_files);
+#pragma omp parallel for schedule(dynamic)
+    for (int f = 0; f < num_files; f++) {
+      const Recipe::Info &rinfo = recipe.infos[f];
+      struct stat st;
+      if (skip_existing &&
+          stat(rinfo.hmmnet_path.c_str(), &st) == 0)
+        continue;
+
+      try {
+        std::vector<std::string> words;
+        read_reference(rinfo, use_trn, words);
+
+        if (info > 0) {
+#pragma omp critical
+          fprintf(stderr, "%s\n", rinfo.hmmnet_path.c_str());
+        }
+        io::Stream out(rinfo.hmmnet_path, "w");
+        compiler.compile(words, out);
+      }
+      // Do not leave incomplete hmmnets behind
+      catch (std::string &str) {
+        errors[f] = rinfo.hmmnet_path + ": " + str;
+        remove(rinfo.hmmnet_path.c_str());
+      }
+      catch (std::exception &e) {
+        errors[f] = rinfo.hmmnet_path + ": " + e.what();
+        remove(rinfo.hmmnet_path.c_str());
+      }
+    }
+
+    int num_errors = 0;
+    for (int f = 0; f < num_files; f++) {
+      if (!errors[f].empty()) {
+        fprintf(stderr, "%s\n", errors[f].c_str());
+        num_errors++;
+      }
+    }
+    if (num_errors > 0) {
+      fprintf(stderr, "%d hmmnets could not be compiled\n", num_errors);
+      exit(1);
+    }
+  }
+  catch (std::exception &e) {
+    fprintf(stderr, "exception: %s\n", e.what());
+    abort();
+  }
+  catch (std::string &str) {
+    fprintf(stderr, "exception: %s\n", str.c_str());
+    abort();
+  }
+}
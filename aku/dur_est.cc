@@ -15,10 +15,9 @@ int max_dur;
 
 std::vector<std::vector<int> > dur_table;
 
-void add_duration(std::string &label, int state, int num_frames,
+void add_duration(aku::Hmm &hmm, int state, int num_frames,
 		  int skip_states)
 {
-  aku::Hmm &hmm = model.hmm(label);
   int state_index = hmm.state(state);
   if (state_index >= skip_states) {
     if (num_frames > max_dur)
@@ -37,7 +36,8 @@ void collect_dur_stats(aku::PhnReader *phn_reader, int skip_states)
       throw std::string(
 			"Collecting duration statistics requires phn files with state numbers!");
 
-    add_duration(phn.label[0], phn.state, phn.end - phn.start, skip_states);
+    aku::Hmm &hmm = phn.hmm >= 0 ? model.hmm(phn.hmm) : model.hmm(phn.label[0]);
+    add_duration(hmm, phn.state, phn.end - phn.start, skip_states);
   }
 }
 
@@ -139,7 +139,7 @@ write_gamma_models(const std::string &filename, int skip_states, int min_count)
 
 int main(int argc, char *argv[])
 {
-  aku::PhnReader phn_reader(NULL);
+  aku::PhnReader phn_reader(&model);
   int skip_states;
   try {
     config("usage: dur_est [OPTION...]\n")
@@ -8,6 +8,8 @@
 # Naturally the recipe file needs to have both hmmnet and den-hmmnet fields
 # set and those paths must exist (see scripts/make_recipe_paths.pl for
 # creating the paths).
+# Alternatively, decoder/rec_den_hmmnets.py generates the denominator hmmnets
+# in one pass with compile_hmmnets -d, without LNA or word graph files.
 
 
 # This is a TEMPLATE SCRIPT, you need to modify the paths, scripts, and
@@ -9,7 +9,9 @@ for script in $scripts; do
     test=${script%.script}
     echo -n "- $test... "
     sh $script > $test.output
-    if cmp $test.output $test.ref >/dev/null; then
+    if [ $? -eq 77 ]; then
+	echo "SKIPPED"
+    elif cmp $test.output $test.ref >/dev/null; then
 	echo "OK"
     else
 	echo "FAILED"
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include "io.hh"
+#include "FeatureGenerator.hh"
+
+using namespace aku;
+
+void
+print_feature(const FeatureVec &vec)
+{
+  for (int i = 0; i < vec.dim(); i++)
+    printf("%.2f\t", vec[i]);
+  printf("\n");
+}
+
+void
+compare_features(const FeatureVec &vec, const FeatureVec &ref_vec,
+                 const char *name, int frame)
+{
+  for (int i = 0; i < vec.dim(); i++) {
+    if (vec[i] != ref_vec[i]) {
+      printf("%s features differ in frame %d\n", name, frame);
+      print_feature(vec);
+      print_feature(ref_vec);
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  try {
+    if (argc < 6) {
+      fprintf(stderr, "usage: shared_feature_test "
+	      "WAV PRIMARY_CONFIG CONFIG START END [SHARED_MODULE...]\n");
+      exit(1);
+    }
+
+    // The generators sharing modules, and the same configurations alone
+    FeatureGenerator primary;
+    FeatureGenerator shared;
+    FeatureGenerator primary_ref;
+    FeatureGenerator shared_ref;
+    primary.load_configuration(io::Stream(argv[2]));
+    shared.load_shared_configuration(io::Stream(argv[3]), primary);
+    primary_ref.load_configuration(io::Stream(argv[2]));
+    shared_ref.load_configuration(io::Stream(argv[3]));
+    int start = atoi(argv[4]);
+    int end = atoi(argv[5]);
+    if (start >= end) {
+      fprintf(stderr, "invalid range: start %d, end %d\n", start, end);
+      exit(1);
+    }
+
+    for (int i = 6; i < argc; i++) {
+      if (shared.module(argv[i]) != primary.module(argv[i])) {
+	printf("module %s is not shared\n", argv[i]);
+	exit(1);
+      }
+    }
+
+    primary.open(argv[1]);
+    shared.open(argv[1]);
+    primary_ref.open(argv[1]);
+    shared_ref.open(argv[1]);
+    for (int f = start; f < end; f++) {
+      compare_features(primary.generate(f), primary_ref.generate(f),
+		       "primary", f);
+      compare_features(shared.generate(f), shared_ref.generate(f),
+		       "shared", f);
+    }
+
+    printf("test successful\n");
+  }
+  catch (std::string &str) {
+    fprintf(stderr, "caught exception: %s\n", str.c_str());
+    abort();
+  }
+}
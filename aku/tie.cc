@@ -118,7 +118,7 @@ main(int argc, char *argv[])
       ('r', "recipe=FILE", "arg must", "", "recipe file")
       ('O', "ophn", "", "", "use output phns for training")
       ('H', "hmmnet", "", "", "use HMM networks for training")
-      ('b', "base=BASENAME", "arg", "", "model files (required with --hmmnet)")
+      ('b', "base=BASENAME", "arg", "", "model files (required with --hmmnet and binary alignments)")
       ('C', "mconfig=FILE", "arg", "", "model configuration (optional)")
       ('u', "rule=FILE", "arg must", "", "rule set for triphone state tying")
       ('o', "out=FILE", "arg", "", "write output to HMM model with base name FILE")
@@ -172,8 +172,9 @@ main(int argc, char *argv[])
         model.read_all(config["base"].get_str());
         if (config["mconfig"].specified)
         {
-          model_fea_gen.load_configuration(
-            io::Stream(config["mconfig"].get_str()));
+          // Compute the common front-end modules only once
+          model_fea_gen.load_shared_configuration(
+            io::Stream(config["mconfig"].get_str()), fea_gen);
           if (model_fea_gen.frame_rate() != fea_gen.frame_rate())
             throw str::fmt(256, "Frame rate of the model and the feature generator must match!\nModel frame rate is %.3f, feature generator frame rate is %3.f\n", model_fea_gen.frame_rate(), fea_gen.frame_rate());
           mfea_gen = &model_fea_gen;
@@ -191,6 +192,11 @@ main(int argc, char *argv[])
                        model.dim(), mfea_gen->dim());
       }
     }
+    else if (config["base"].specified)
+    {
+      // Binary state alignments refer to the HMMs by index
+      model.read_ph(config["base"].get_str() + ".ph");
+    }
     
     for (int f = 0; f < (int)recipe.infos.size(); f++)
     {
@@ -213,6 +219,13 @@ main(int argc, char *argv[])
 
       if (config["hmmnet"].specified)
       {
+        if (mfea_gen != &fea_gen)
+        {
+          // Open the file for the actual feature generator first, it
+          // reads the audio for the shared modules
+          fea_gen.open(recipe.infos[f].audio_path);
+        }
+
         // Open files and configure
         HmmNetBaumWelch* lattice = recipe.infos[f].init_hmmnet_files(
           &model, false, mfea_gen, NULL);
@@ -223,12 +236,6 @@ main(int argc, char *argv[])
         if (config["vit"].specified)
           lattice->set_mode(HmmNetBaumWelch::MODE_VITERBI);
 
-        if (mfea_gen != &fea_gen)
-        {
-          // Open the file for the actual feature generator
-          fea_gen.open(recipe.infos[f].audio_path);
-        }
-        
         double orig_beam = lattice->get_backward_beam();
         int counter = 1;
         bool skip = false;
@@ -256,7 +263,7 @@ main(int argc, char *argv[])
       }
       else
       {
-        PhnReader phn_reader(NULL);
+        PhnReader phn_reader(config["base"].specified ? &model : NULL);
         recipe.infos[f].init_phn_files(NULL, false, false,
                                        config["ophn"].specified, &fea_gen,
                                        &phn_reader);
@@ -0,0 +1,162 @@
+#!/usr/bin/python
+
+# Generates the denominator hmmnets for discriminative training in one
+# pass: the phoneme probabilities are computed in a child process and
+# piped to the decoder, and the posterior pruned word graphs are piped
+# to compile_hmmnets, which writes them to the den-hmmnet paths of the
+# recipe. No LNA or word graph files are written.
+#
+# Usage: rec_den_hmmnets.py model recipe
+#
+# The recipe should contain only the utterances of one batch, and the
+# audio, den-hmmnet and transcript (or utterance for --trn) fields.
+# compile_hmmnets reads one word graph for each recipe line in order, so
+# an empty word graph is written for the lines that can not be decoded,
+# and compile_hmmnets reports their hmmnets as failed.
+
+import sys
+import os
+import re
+import subprocess
+
+# Set your decoder and aku swig paths in here!
+sys.path.append("/home/user/decoder/src/swig");
+sys.path.append("/home/user/aku/swig");
+
+import Decoder
+import PPToolbox
+
+
+def runto(frame):
+    while (frame <= 0 or t.frame() < frame):
+        if (not t.run()):
+            break
+
+##################################################
+# Initialize
+#
+
+model = sys.argv[1]
+recipefile = sys.argv[2]
+hmms = model+".ph"
+dur = model+".dur"
+config = model+".cfg"
+lexicon = "/share/work/jpylkkon/bin_lm/morph19k.lex"
+# A minimal language model (e.g. unigram) is usually beneficial for
+# discriminative training.
+ngram = "/share/work/jpylkkon/bin_lm/morph19k_1gram.bin"
+compile_hmmnets = "/home/user/aku/compile_hmmnets"
+morphs = 1
+trn = "" # Reads the PHN files if empty
+raw_audio = 0
+lm_scale = 30
+global_beam = 250
+posterior_threshold = 0.00000001
+##################################################
+
+
+##################################################
+# Load the recipe
+#
+f=open(recipefile,'r')
+recipelines = f.readlines()
+f.close()
+
+# The recipe entries as compile_hmmnets reads them: every non-empty line
+# that is not a comment. None for the lines without an audio file.
+audiofiles=[]
+for line in recipelines:
+    line = line.strip()
+    if len(line) == 0 or line[0] == '#':
+        continue
+    result = re.search(r"audio=(\S+)", line)
+    if result:
+        audiofiles = audiofiles + [result.expand(r"\1")]
+    else:
+        audiofiles = audiofiles + [None]
+
+##################################################
+# Load the models
+#
+
+sys.stderr.write("loading acoustic models\n")
+pp = PPToolbox.PPToolbox()
+pp.read_configuration(config)
+pp.read_models(model)
+
+sys.stderr.write("loading models\n")
+t = Decoder.Toolbox(0, hmms, dur)
+
+t.set_optional_short_silence(1)
+t.set_cross_word_triphones(1)
+t.set_require_sentence_end(1)
+t.set_word_boundary("<w>")
+
+sys.stderr.write("loading lexicon\n")
+try:
+    t.lex_read(lexicon)
+except:
+    print "phone:", t.lex_phone()
+    sys.exit(-1)
+t.set_sentence_boundary("<s>", "</s>")
+
+sys.stderr.write("loading ngram\n")
+t.ngram_read(ngram, 1)
+
+t.set_global_beam(global_beam)
+t.set_word_end_beam(int(2*global_beam/3))
+t.set_token_limit(30000)
+t.set_lm_scale(lm_scale)
+t.set_duration_scale(3)
+t.set_transition_scale(1)
+t.set_generate_word_graph(1)
+
+##################################################
+# Recognize
+#
+
+args = [compile_hmmnets, "-b", model, "-l", lexicon, "-r", recipefile,
+        "-d", "-"]
+if morphs:
+    args = args + ["-m"]
+if len(trn) > 0:
+    args = args + ["-t", trn]
+den = subprocess.Popen(args, stdin=subprocess.PIPE)
+den_path = "/dev/fd/%d" % den.stdin.fileno()
+
+# A lattice without nodes, which compile_hmmnets rejects after reading it.
+def write_empty_word_graph():
+    den.stdin.write("VERSION=1.1\nN=0\tL=0\n")
+    den.stdin.flush()
+
+for audiofile in audiofiles:
+    if audiofile is None:
+        sys.stderr.write("Recipe line without audio, skipped\n")
+        write_empty_word_graph()
+        continue
+    sys.stderr.write("AUDIO: %s\n" % audiofile)
+    (r, w) = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(r)
+        audio = os.open(audiofile, os.O_RDONLY)
+        pp.generate_to_fd(audio, w, raw_audio)
+        os._exit(0)
+    os.close(w)
+
+    t.lna_open_fd(r, 1024)
+    t.reset(0)
+    t.set_end(-1)
+    runto(0)
+    t.lna_close()
+    os.waitpid(pid, 0)
+
+    try:
+        t.write_word_graph(den_path, posterior_threshold, 1.0 / lm_scale)
+    except RuntimeError:
+        # E.g. the final node was pruned.
+        sys.stderr.write("No word graph for %s, skipped\n" % audiofile)
+        write_empty_word_graph()
+
+den.stdin.close()
+sys.exit(den.wait())
@@ -0,0 +1,132 @@
+#!/usr/bin/python
+
+# Decodes the LNA files of a recipe with a grid of search parameters.
+# The acoustic scores of each file are read once and shared by the
+# searches of all configurations.  The results of each configuration
+# are written in TRN format to <output>.<index>.trn, and the parameters
+# of the configurations to <output>.configs.
+#
+# Usage: rec_sweep.py model recipe lna_path output
+
+import sys
+import os
+import re
+
+# Set your decoder swig path in here!
+sys.path.append("/home/user/decoder/src/swig");
+
+import Decoder
+
+##################################################
+# Initialize
+#
+
+model = sys.argv[1]
+hmms = model+".ph"
+dur = model+".dur"
+lexicon = "/share/work/jpylkkon/bin_lm/morph19k.lex"
+ngram = "/share/work/jpylkkon/bin_lm/morph19k_D20E10_varigram.bin"
+lookahead_ngram = "/share/work/jpylkkon/bin_lm/morph19k_2gram.bin"
+recipefile = sys.argv[2]
+lna_path = sys.argv[3]
+output = sys.argv[4]
+
+# The grid of the sweep
+lm_scales = [24, 28, 32]
+insertion_penalties = [0]
+global_beams = [200, 250]
+dur_scale = 3
+trans_scale = 1
+##################################################
+
+
+##################################################
+# Load the recipe
+#
+f=open(recipefile,'r')
+recipelines = f.readlines()
+f.close()
+
+lnafiles=[]
+for line in recipelines:
+    result = re.search(r"lna=(\S+)", line)
+    if result:
+        lnafiles = lnafiles + [result.expand(r"\1")]
+
+if lna_path[-1] != '/':
+    lna_path = lna_path + '/'
+
+##################################################
+# Load the models
+#
+
+sys.stderr.write("loading models\n")
+t = Decoder.Toolbox(0, hmms, dur)
+
+t.set_optional_short_silence(1)
+t.set_cross_word_triphones(1)
+t.set_require_sentence_end(1)
+t.set_lm_lookahead(1)
+t.set_word_boundary("<w>")
+
+sys.stderr.write("loading lexicon\n")
+try:
+    t.lex_read(lexicon)
+except:
+    print "phone:", t.lex_phone()
+    sys.exit(-1)
+t.set_sentence_boundary("<s>", "</s>")
+
+sys.stderr.write("loading ngram\n")
+t.ngram_read(ngram, 1)
+t.read_lookahead_ngram(lookahead_ngram)
+
+t.prune_lm_lookahead_buffers(0, 4) # min_delta, max_depth
+
+t.set_token_limit(30000)
+t.set_prune_similar(3)
+t.set_duration_scale(dur_scale)
+t.set_transition_scale(trans_scale)
+# Pronunciation probabilities are scaled with this when the lexicon is
+# read, the sweep changes only the LM scale of the search.
+t.set_lm_scale(lm_scales[0])
+
+##################################################
+# Configure the sweep
+#
+
+configs = open(output + ".configs", 'w')
+for lm_scale in lm_scales:
+    for ip in insertion_penalties:
+        for beam in global_beams:
+            c = t.sweep_config()
+            c.lm_scale = lm_scale
+            c.insertion_penalty = ip
+            c.global_beam = beam
+            c.word_end_beam = int(2*beam/3)
+            configs.write("%d: LMSCALE %g IP %g BEAM %g WORD_END_BEAM %g\n" %
+                          (t.num_sweep_configs(), lm_scale, ip, beam,
+                           c.word_end_beam))
+            t.add_sweep_config(c)
+configs.close()
+
+outputs = []
+for i in range(t.num_sweep_configs()):
+    outputs = outputs + [open("%s.%d.trn" % (output, i), 'w')]
+
+##################################################
+# Recognize
+#
+
+for lnafile in lnafiles:
+    sys.stderr.write("LNA: %s\n" % lnafile)
+    t.lna_open(lna_path + lnafile, 1024)
+    t.sweep(0, -1)
+    t.lna_close()
+
+    utterance = os.path.splitext(os.path.basename(lnafile))[0]
+    for i in range(t.num_sweep_configs()):
+        outputs[i].write("%s (%s)\n" % (t.sweep_result(i), utterance))
+
+for out in outputs:
+    out.close()
@@ -17,6 +17,10 @@ public:
    **/
   virtual bool go_to(int frame) = 0;
 
+  /** Returns true if go_to() can visit frames ahead of the current
+   * frame and then return to it. */
+  virtual bool can_read_ahead() const { return false; }
+
   inline float log_prob(int model) const { return m_log_prob[model]; }
   inline int num_models() const { return m_num_models; }
 protected:
@@ -0,0 +1,43 @@
+#include <cstddef>
+#include <assert.h>
+#include "BufferedAcoustics.hh"
+
+BufferedAcoustics::BufferedAcoustics()
+  : m_first_frame(0),
+    m_end_frame(0)
+{
+}
+
+BufferedAcoustics::~BufferedAcoustics()
+{
+}
+
+bool
+BufferedAcoustics::go_to(int frame)
+{
+  assert(frame >= m_first_frame);
+  if (frame >= m_end_frame)
+    return false;
+  m_log_prob = &m_log_probs[(frame - m_first_frame) * m_num_models];
+  return true;
+}
+
+int
+BufferedAcoustics::read(Acoustics &source, int start_frame, int end_frame)
+{
+  m_first_frame = start_frame;
+  m_end_frame = start_frame;
+  m_log_probs.clear();
+  m_log_prob = NULL;
+
+  while (end_frame < 0 || m_end_frame < end_frame) {
+    if (!source.go_to(m_end_frame))
+      break;
+    m_num_models = source.num_models();
+    for (int i = 0; i < m_num_models; i++)
+      m_log_probs.push_back(source.log_prob(i));
+    m_end_frame++;
+  }
+
+  return m_end_frame - m_first_frame;
+}
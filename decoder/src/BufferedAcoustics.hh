@@ -0,0 +1,41 @@
+#ifndef BUFFEREDACOUSTICS_HH
+#define BUFFEREDACOUSTICS_HH
+
+#include "Acoustics.hh"
+
+/** Acoustic scores of a whole segment kept in memory.
+ *
+ * The scores are copied once from another source (e.g. a pipe read by
+ * \ref LnaReaderCircular), after which the frames can be visited any
+ * number of times and in any order.  This allows running several
+ * searches over the same acoustic scores.
+ **/
+class BufferedAcoustics : public Acoustics {
+public:
+  BufferedAcoustics();
+  virtual ~BufferedAcoustics();
+
+  /** Go to specified frame.  Returns false if the frame is past the
+   * buffered frames.  The frames before the first buffered frame are
+   * not available. */
+  virtual bool go_to(int frame);
+  virtual bool can_read_ahead() const { return true; }
+
+  /** Copies the frames from \a start_frame to \a end_frame (exclusive)
+   * from \a source.  If \a end_frame is negative, reads until the end
+   * of the source.
+   *
+   * \return the number of frames read
+   */
+  int read(Acoustics &source, int start_frame, int end_frame = -1);
+
+  int first_frame() const { return m_first_frame; }
+  int end_frame() const { return m_end_frame; }
+
+protected:
+  int m_first_frame;
+  int m_end_frame;
+  std::vector<float> m_log_probs;
+};
+
+#endif /* BUFFEREDACOUSTICS_HH */
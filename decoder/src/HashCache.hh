@@ -3,6 +3,7 @@
 
 #include <cstddef>  // NULL
 #include <stdexcept>
+#include <vector>
 
 template <typename T>
 class HashCache {
@@ -17,6 +18,9 @@ public:
   bool remove_item(int key, T *removed);
   void clear_cache();
 
+  /// Appends the items to \a items, the most recently inserted first.
+  void get_items(std::vector<T> &items) const;
+
 private:
   void rehash(int new_max);
   int get_hash_index(int key);
@@ -214,6 +218,14 @@ HashCache<T>::find(int key, T *result)
 }
 
 
+template<typename T>
+void
+HashCache<T>::get_items(std::vector<T> &items) const
+{
+  for (StoreType *temp = first; temp != NULL; temp = temp->priority_list_next)
+    items.push_back(temp->value);
+}
+
 template<typename T>
 void
 HashCache<T>::set_max_items(int max)
@@ -56,6 +56,8 @@ InterTreeGram::InterTreeGram(const std::vector< std::string > lm_names, const st
     //TreeGramArpaReader tga2;
     //tga2.write(lm_out.file, lm);
     
+    m_state_offsets.push_back(m_models.empty() ? 1 :
+                              m_state_offsets.back() + m_models.back()->num_nodes());
     m_models.push_back(lm);
     assert(lm->num_words() == real_num_words);
 
@@ -109,3 +111,45 @@ void InterTreeGram::fetch_bigram_list(int prev_word_id,
     *it = safelogprob(*it);
   }
 }
+
+int InterTreeGram::context_state(const Gram &context) {
+  // The state of every model is a suffix of the longest one, so the
+  // longest context identifies the interpolated state. Ties go to the
+  // first model to keep the identifiers unique.
+  int best_model = -1;
+  int best_node = -1;
+  int best_length = 0;
+  for (int i=0; i<m_models.size(); i++) {
+    int length;
+    int node = m_models[i]->find_context_node(context, &length);
+    if (length > best_length) {
+      best_model = i;
+      best_node = node;
+      best_length = length;
+    }
+  }
+
+  if (best_model < 0)
+    return 0;
+  return m_state_offsets[best_model] + best_node;
+}
+
+void InterTreeGram::fetch_context_list(const Gram &context,
+                                       std::vector<float> &result_buffer) {
+  result_buffer.resize(m_words.size());
+  for (std::vector<float>::iterator it=result_buffer.begin(); it!=result_buffer.end(); ++it) {
+    *it = 0.0f;
+  }
+
+  std::vector<float> cresbuf(result_buffer.size());
+  for (int i=0; i<m_models.size(); i++) {
+    m_models[i]->fetch_context_list(context, cresbuf);
+    for (int j=0; j<result_buffer.size(); j++) {
+      result_buffer[j] += m_coeffs[i] * pow(10, cresbuf[j]);
+    }
+  }
+
+  for (std::vector<float>::iterator it=result_buffer.begin(); it!=result_buffer.end(); ++it) {
+    *it = safelogprob(*it);
+  }
+}
@@ -19,6 +19,11 @@ public:
   void fetch_bigram_list(int, std::vector<float>&);
   void fetch_trigram_list(int, int, std::vector<float>&) { assert(false);}
 
+  // Context states are the longest context state among the models
+  bool supports_context_states() { return true; }
+  int context_state(const Gram &context);
+  void fetch_context_list(const Gram &context, std::vector<float> &result_buffer);
+
 
   // NGram.hh wants us to implement these, but these are actually not needed
   void read(FILE *, bool) { assert(false); }
@@ -37,5 +42,8 @@ public:
 private:
   std::vector<TreeGram *> m_models;
   std::vector<float> m_coeffs;
+
+  /// The first context state of each model.
+  std::vector<int> m_state_offsets;
 };
 #endif
@@ -192,13 +192,22 @@ public:
   int word_start_frame;
   int word_first_silence_frame;  // "end frame", initialized to -1.
 
+  /// Context state of the lookahead LM after this history, or -1 if not
+  /// computed yet.
+  int lookahead_state;
+
+  /// Context state of the language model after this history, or -1 if not
+  /// computed yet.
+  int lm_state;
+
   // A reference to TokenPassSearch::m_word_lookup table.
   const Word * last_word;
 };
 
 inline LMHistory::LMHistory(const Word * last_word, LMHistory * previous) :
   previous(previous), reference_count(0), printed(false), word_start_frame(
-									   0), word_first_silence_frame(-1), last_word(last_word)
+									   0), word_first_silence_frame(-1), lookahead_state(-1),
+  lm_state(-1), last_word(last_word)
 {
   if (previous)
     hist::link(previous);
@@ -206,7 +215,8 @@ inline LMHistory::LMHistory(const Word * last_word, LMHistory * previous) :
 
 inline LMHistory::LMHistory() :
   previous(NULL), reference_count(0), printed(false), word_start_frame(0), 
-  word_first_silence_frame(-1), last_word(NULL)
+  word_first_silence_frame(-1), lookahead_state(-1), lm_state(-1),
+  last_word(NULL)
 {}
 
 inline LMHistory::ConstReverseIterator &
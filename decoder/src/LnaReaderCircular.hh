@@ -46,6 +46,7 @@ public:
   void seek(int frame);
   
   virtual bool go_to(int frame);
+  virtual bool can_read_ahead() const { return true; }
 
 private:
   int read_int();
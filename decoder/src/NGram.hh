@@ -28,6 +28,31 @@ public:
                                  std::vector<float> &result_buffer)=0;
   virtual void fetch_trigram_list(int w1, int w2,
                                   std::vector<float> &result_buffer)=0;
+
+  /// \brief Returns true if the model implements context_state() and
+  /// fetch_context_list().
+  virtual bool supports_context_states() { return false; }
+
+  /// \brief Returns an identifier of the model state that the
+  /// probability of the next word depends on, given the history
+  /// \a context.
+  ///
+  /// The state is the longest suffix of \a context that the model
+  /// actually conditions on. Histories that back off to the same
+  /// suffix get the same identifier, and the empty context is 0.
+  ///
+  virtual int context_state(const Gram & /* context */)
+  { assert(false); return -1; }
+
+  /// \brief Computes the probabilities of every word following
+  /// \a context, regardless of the context length.
+  ///
+  /// Used for LM lookahead in the recognizer.
+  ///
+  virtual void fetch_context_list(const Gram & /* context */,
+                                  std::vector<float> & /* result_buffer */)
+  { assert(false); }
+
   inline float log_prob(const std::vector<int> &gram) {
     assert(gram.size() > 0);
     switch (m_type) {
@@ -14,51 +14,218 @@ int HypoPath::g_count = 0;
 // FIXME: check that every log_prob has the same base!  Now they
 // should be log10 everywhere.
 
-// Returns the first (and should be the only) hypothesis with a
-// similar word history of 'words' words.
-//
+void
+HypoStack::clear()
+{
+  m_hypos.clear();
+  m_free_handles.clear();
+  m_heap.clear();
+  m_heap_pos.clear();
+  m_order.clear();
+  m_sorted = true;
+  m_similar.clear();
+}
+
+void
+HypoStack::reserve(int size)
+{
+  m_hypos.reserve(size);
+  m_heap.reserve(size);
+  m_heap_pos.reserve(size);
+  m_order.reserve(size);
+}
+
 // FIXME: currently path->word_id is an index in lexicon, not in LM!
 // Search class has lex2lm mapping, which maps lexicon words to LM
 // words.  Currently, this is relevant only for UNK words.  So now the
 // implementation below does not prune different UNK words. 
 // Tue Nov 26 11:50:16 EET 2002
+bool
+HypoStack::similar_key(const HypoPath *path, int words, size_t &key)
+{
+  key = 0;
+  for (int i = 0; i < words; i++) {
+    if (!path)
+      return false;
+    key = key * 1000003 + (size_t)path->word_id;
+    path = path->prev;
+  }
+  return true;
+}
+
+bool
+HypoStack::similar_paths(const HypoPath *path1, const HypoPath *path2,
+                         int words)
+{
+  for (int i = 0; i < words; i++) {
+    // Only the one of the hypotheses is short, no match
+    if (!path1 || !path2)
+      return false;
+
+    // Words differ, no match
+    if (path1->word_id != path2->word_id)
+      return false;
+
+    path1 = path1->prev;
+    path2 = path2->prev;
+  }
+  return true;
+}
+
+void
+HypoStack::add_similar(int handle)
+{
+  size_t key;
+  if (similar_key(m_hypos[handle].path, m_similar_words, key))
+    m_similar.insert(SimilarMap::value_type(key, handle));
+}
+
+void
+HypoStack::remove_similar(int handle)
+{
+  size_t key;
+  if (!similar_key(m_hypos[handle].path, m_similar_words, key))
+    return;
+  std::pair<SimilarMap::iterator, SimilarMap::iterator> range =
+    m_similar.equal_range(key);
+  for (SimilarMap::iterator it = range.first; it != range.second; ++it) {
+    if (it->second == handle) {
+      m_similar.erase(it);
+      return;
+    }
+  }
+  assert(false);
+}
+
+// Returns the first (and should be the only) hypothesis with a
+// similar word history of 'words' words.
 int
 HypoStack::find_similar(const Hypo &hypo, int words)
 {
-  for (int h = 0; h < size(); h++) {
-    HypoPath *path1 = hypo.path;
-    HypoPath *path2 = at(h).path;
+  // Index the hypotheses by the requested number of words
+  if (words != m_similar_words) {
+    m_similar.clear();
+    m_similar_words = words;
+    for (int i = 0; i < (int)m_heap.size(); i++)
+      add_similar(m_heap[i]);
+  }
 
-    for (int i = 0;; i++) {
-      // Enough words checked, it is a match
-      if (i == words)
-        return h;
+  size_t key;
+  if (!similar_key(hypo.path, words, key))
+    return -1;
+  std::pair<SimilarMap::iterator, SimilarMap::iterator> range =
+    m_similar.equal_range(key);
+  for (SimilarMap::iterator it = range.first; it != range.second; ++it) {
+    if (similar_paths(hypo.path, m_hypos[it->second].path, words))
+      return it->second;
+  }
 
-      // Both hypotheses are short, no match
-      if (!path1 && !path2)
-        break;
+  return -1;
+}
 
-      // Only the one of the hypotheses is short, no match
-      if (!path1 || !path2)
-        break;
+int
+HypoStack::sorted_insert(const Hypo &hypo)
+{
+  int handle;
+  if (m_free_handles.empty()) {
+    handle = m_hypos.size();
+    m_hypos.push_back(hypo);
+    m_heap_pos.push_back(-1);
+  }
+  else {
+    handle = m_free_handles.back();
+    m_free_handles.pop_back();
+    m_hypos[handle] = hypo;
+  }
 
-      // Words differ, no match
-      // FIXME: use perhaps m_lex2lm mapping
-      if (path1->word_id != path2->word_id)
-        break;
+  m_heap_pos[handle] = m_heap.size();
+  m_heap.push_back(handle);
+  heap_up(m_heap.size() - 1);
+  if (m_similar_words >= 0)
+    add_similar(handle);
+  m_sorted = false;
+  return handle;
+}
 
-      path1 = path1->prev;
-      path2 = path2->prev;
+void
+HypoStack::remove(int handle)
+{
+  assert(m_heap_pos[handle] >= 0);
+  if (m_similar_words >= 0)
+    remove_similar(handle);
+
+  int pos = m_heap_pos[handle];
+  int last = m_heap.size() - 1;
+  if (pos != last) {
+    heap_swap(pos, last);
+    m_heap.pop_back();
+    heap_up(pos);
+    heap_down(pos);
+  }
+  else
+    m_heap.pop_back();
+
+  // Release the path of the removed hypothesis
+  m_heap_pos[handle] = -1;
+  m_hypos[handle] = Hypo();
+  m_free_handles.push_back(handle);
+  m_sorted = false;
+}
+
+void
+HypoStack::heap_swap(int pos1, int pos2)
+{
+  std::swap(m_heap[pos1], m_heap[pos2]);
+  m_heap_pos[m_heap[pos1]] = pos1;
+  m_heap_pos[m_heap[pos2]] = pos2;
+}
+
+void
+HypoStack::heap_up(int pos)
+{
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (m_hypos[m_heap[pos]].log_prob >= m_hypos[m_heap[parent]].log_prob)
+      break;
+    heap_swap(pos, parent);
+    pos = parent;
+  }
+}
+
+void
+HypoStack::heap_down(int pos)
+{
+  int size = m_heap.size();
+  while (1) {
+    int worst = pos;
+    int child = 2 * pos + 1;
+    for (int c = child; c < child + 2 && c < size; c++) {
+      if (m_hypos[m_heap[c]].log_prob < m_hypos[m_heap[worst]].log_prob)
+        worst = c;
     }
+    if (worst == pos)
+      break;
+    heap_swap(pos, worst);
+    pos = worst;
   }
+}
 
-  return -1;
+namespace {
+  struct BetterHandle {
+    BetterHandle(const std::vector<Hypo> &hypos) : hypos(hypos) { }
+    bool operator()(int a, int b) const { return hypos[a] < hypos[b]; }
+    const std::vector<Hypo> &hypos;
+  };
 }
 
-void HypoStack::sorted_insert(const Hypo &hypo)
+void
+HypoStack::sort()
 {
-  HypoStack::iterator it = lower_bound(begin(), end(), hypo);
-  insert(it, hypo);
+  if (m_sorted)
+    return;
+  m_order = m_heap;
+  std::stable_sort(m_order.begin(), m_order.end(), BetterHandle(m_hypos));
+  m_sorted = true;
 }
 
 Search::Search(Expander &expander, const Vocabulary &vocabulary) :
@@ -379,7 +546,7 @@ void Search::insert_hypo(int target_frame, const Hypo &hypo)
   int index = target_stack.find_similar(hypo, m_prune_similar);
   if (index >= 0) {
     m_similar_prunings++;
-    if (target_stack.at(index).log_prob > hypo.log_prob)
+    if (target_stack.hypo(index).log_prob > hypo.log_prob)
       return;
     target_stack.remove(index);
   }
@@ -4,6 +4,7 @@
 #include <cstddef>  // NULL
 #include <vector>
 #include <deque>
+#include <unordered_map>
 
 #include <float.h>
 
@@ -132,34 +133,103 @@ Hypo::add_path(int word_id, int frame)
     HypoPath::unlink(old_path);
 }
 
-class HypoStack : private std::vector<Hypo> {
+/// \brief A stack of hypotheses ending in the same frame.
+///
+/// The hypotheses are kept in a heap with the worst hypothesis on top, so
+/// that inserting a hypothesis and pruning the worst one take logarithmic
+/// time.  The hypotheses are sorted (best first) only when they are accessed
+/// by index, which normally happens once when the stack is expanded.
+///
+/// The similar hypotheses are found through a hash of the last words of the
+/// paths.  The index is built for the number of words given to
+/// find_similar(), and rebuilt if the number changes.
+///
+/// The hypotheses are identified by handles that stay valid until the
+/// hypothesis is removed.  Note that the handles are not indices to the
+/// sorted order.
+class HypoStack {
 public:
-  inline HypoStack() : m_best_log_prob(-1e10) { }
-
-  // Inherited from vector
-  Hypo &operator[](int index) { return std::vector<Hypo>::operator[](index); }
-  Hypo &at(int index) { return std::vector<Hypo>::operator[](index); }
-  Hypo &front() { return std::vector<Hypo>::front(); }
-  Hypo &back() { return std::vector<Hypo>::back(); }
-  void clear() { std::vector<Hypo>::clear(); }
-  void reserve(int size) { std::vector<Hypo>::reserve(size); }
-  size_type size() const { return std::vector<Hypo>::size(); }
-  bool empty() const { return std::vector<Hypo>::empty(); }
-  void pop_back() { std::vector<Hypo>::pop_back(); }
-  void remove(int index) { std::vector<Hypo>::erase(begin() + index); }
-
-  // New functions
-
-  /// \brief Returns the first (and should be the only) hypothesis that has at
-  /// least the first \a words words in common with \a hypo.
+  inline HypoStack() : m_sorted(true), m_similar_words(-1) { }
+
+  /// \brief Returns the hypothesis at \a index in the sorted order (best
+  /// first).  Sorts the stack if it has been modified.
+  Hypo &operator[](int index) { return at(index); }
+  Hypo &at(int index) { sort(); return m_hypos[m_order[index]]; }
+
+  /// \brief Returns the best hypothesis.
+  Hypo &front() { return at(0); }
+
+  /// \brief Returns the worst hypothesis without sorting the stack.
+  Hypo &back() { return m_hypos[m_heap.front()]; }
+
+  void clear();
+  void reserve(int size);
+  int size() const { return m_heap.size(); }
+  bool empty() const { return m_heap.empty(); }
+
+  /// \brief Removes the worst hypothesis.
+  void pop_back() { remove(m_heap.front()); }
+
+  /// \brief Removes the hypothesis with the given handle.
+  void remove(int handle);
+
+  /// \brief Returns the hypothesis with the given handle.
+  Hypo &hypo(int handle) { return m_hypos[handle]; }
+
+  /// \brief Returns the handle of the first (and should be the only)
+  /// hypothesis that has at least the first \a words words in common with
+  /// \a hypo, or -1 if there is none.
   ///
   int find_similar(const Hypo &hypo, int words);
 
-  void sorted_insert(const Hypo &hypo);
+  /// \brief Inserts a hypothesis and returns its handle.
+  int sorted_insert(const Hypo &hypo);
 
 private:
-  float m_best_log_prob;
-  int m_best_index;
+  typedef std::unordered_multimap<size_t, int> SimilarMap;
+
+  /// \brief Computes the hash of the first \a words words of the path.
+  /// Returns false if the path is shorter, in which case the hypothesis
+  /// is not similar to any other.
+  static bool similar_key(const HypoPath *path, int words, size_t &key);
+
+  /// \brief Checks whether the first \a words words of the paths are the
+  /// same.
+  static bool similar_paths(const HypoPath *path1, const HypoPath *path2,
+                            int words);
+
+  void add_similar(int handle);
+  void remove_similar(int handle);
+
+  /// \brief Moves the hypothesis at the heap position towards the top
+  /// (worse) or the bottom (better) until the heap is valid again.
+  void heap_up(int pos);
+  void heap_down(int pos);
+  void heap_swap(int pos1, int pos2);
+
+  /// \brief Updates the sorted order of the hypotheses if needed.
+  void sort();
+
+  /// The hypotheses indexed by handles.  Removed hypotheses are cleared
+  /// and their handles reused.
+  std::vector<Hypo> m_hypos;
+  std::vector<int> m_free_handles;
+
+  /// Handles of the hypotheses in a heap, the worst hypothesis first.
+  std::vector<int> m_heap;
+
+  /// Position of each handle in the heap, -1 for free handles.
+  std::vector<int> m_heap_pos;
+
+  /// Handles in the sorted order (best first), valid if m_sorted is set.
+  std::vector<int> m_order;
+  bool m_sorted;
+
+  /// Handles of the hypotheses by the hash of their last words.
+  SimilarMap m_similar;
+
+  /// The number of words in the keys of m_similar, -1 if not indexed.
+  int m_similar_words;
 };
 
 class Search {
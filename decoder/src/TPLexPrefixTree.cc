@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
+#include <map>
 
 #include "TPLexPrefixTree.hh"
 
@@ -55,6 +56,7 @@ TPLexPrefixTree::TPLexPrefixTree(std::map<std::string,int> &hmm_map,
   m_short_silence_state = NULL;
   m_word_boundary_id = -1;
   m_ignore_case = false;
+  m_suffix_sharing = false;
 }
 
 struct delete_node
@@ -192,11 +194,9 @@ void TPLexPrefixTree::add_word(std::vector<Hmm*> &hmm_list, int word_id, double
         // context are grouped together and are allowed to share their common
         // states. The dummy node is linked to every entry node of the
         // corresponding group.
-        std::string temp1(hmm_list[i]->label, 0, 1);
-        std::string temp2(hmm_list[i]->label, 2, 1);
-        std::string key = temp1 + temp2;
         std::vector<Arc> new_arcs;
-        link_node_to_fan_network(key, new_arcs, true, false, 0);
+        link_node_to_fan_network(context_key(hmm_list[i]->label, 0, 2),
+                                 new_arcs, true, false, 0);
         for (int j = 0; j < new_arcs.size(); j++)
           wid_node->arcs.push_back(new_arcs[j]);
 
@@ -401,14 +401,11 @@ void TPLexPrefixTree::finish_tree(void)
   if (m_cross_word_triphones)
   {
     // Link the fan points to create a cross word network
-    string_to_nodes_map::const_iterator fan_out_it =
-      m_fan_out_last_nodes.begin();
-    while (fan_out_it != m_fan_out_last_nodes.end()) {
-      const node_vector & nlist = fan_out_it->second;
+    for (int key = 0; key < m_fan_out_last_nodes.size(); key++) {
+      const node_vector & nlist = m_fan_out_last_nodes[key];
       for (int i = 0; i < nlist.size(); i++) {
-        link_fan_out_node_to_fan_in(nlist[i], fan_out_it->first);
+        link_fan_out_node_to_fan_in(nlist[i], key);
       }
-      ++fan_out_it;
     }
 
     link_fan_in_nodes();
@@ -440,6 +437,9 @@ void TPLexPrefixTree::finish_tree(void)
   arc.log_prob = 0;
   m_start_node->arcs.push_back(arc);
 
+  if (m_cross_word_triphones)
+    merge_equivalent_nodes(NODE_FAN_IN | NODE_FAN_OUT);
+
   // Propagate word ID:s towards the root node and add LM lookahead
   // list to every branch (if this option is used)
   for (int i = 0; i < m_root_node->arcs.size(); i++)
@@ -447,19 +447,17 @@ void TPLexPrefixTree::finish_tree(void)
 
   if (m_cross_word_triphones)
   {
-    string_to_nodes_map::const_iterator it;
     int i;
-    it = m_fan_in_entry_nodes.begin();
-    while (it != m_fan_in_entry_nodes.end()) {
-      const node_vector & nlist = it->second;
+    for (int key = 0; key < m_fan_in_entry_nodes.size(); key++) {
+      const node_vector & nlist = m_fan_in_entry_nodes[key];
       for (i = 0; i < nlist.size(); i++) {
         if (!post_process_fan_triphone(nlist[i], NULL, true)) {
           if (m_verbose > 1)
-            fprintf(stderr, "Removed a fan-in node from key %s\n",
-                    (*it).first.c_str());
+            fprintf(stderr, "Removed a fan-in node from key %c%c\n",
+                    m_context_phones[key].first,
+                    m_context_phones[key].second);
         }
       }
-      ++it;
     }
     /*it = m_fan_out_last_nodes.begin(); // NOTE: Only last nodes!
       while (it != m_fan_out_last_nodes.end())
@@ -475,6 +473,11 @@ void TPLexPrefixTree::finish_tree(void)
       }*/
   }
 
+  // Word ids have now been moved to the last branching nodes, so the word
+  // tails can be shared.
+  if (m_suffix_sharing)
+    merge_equivalent_nodes(NODE_AFTER_WORD_ID);
+
   // FIXME! Should the word id lists for LM lookahead be sorted to increase
   // processor cache utility?
 
@@ -731,16 +734,23 @@ void TPLexPrefixTree::create_cross_word_network()
 {
   std::map<std::string, int>::const_iterator it;
 
-  // Create fan in HMMs
+  // Create fan in HMMs, and index the fan out HMMs by their left context
+  // and center phoneme for creating them on demand.
   it = m_hmm_map.begin();
   while (it != m_hmm_map.end())
   {
     if ((*it).first.size() == 5) // b-m+e
     {
-      std::string b((*it).first, 0, 1);
-      std::string e((*it).first, 4, 1);
-      if (b != "_" && b != "=" && e != "=")
+      char b = (*it).first[0];
+      char e = (*it).first[4];
+      if (b != '_' && b != '=' && e != '=')
         add_hmm_to_fan_network((*it).second, false);
+      if (e != '=') {
+        int key = context_key((*it).first, 0, 2);
+        if (m_fan_out_triphones.size() <= key)
+          m_fan_out_triphones.resize(key + 1);
+        m_fan_out_triphones[key].push_back((*it).second);
+      }
     }
     ++it;
   }
@@ -790,12 +800,9 @@ void TPLexPrefixTree::add_hmm_to_fan_network(int hmm_id, bool fan_out)
     last_node->flags |= NODE_INSERT_WORD_BOUNDARY;
 }
 
-void TPLexPrefixTree::link_fan_out_node_to_fan_in(Node *node,
-                                                  const std::string &key)
+void TPLexPrefixTree::link_fan_out_node_to_fan_in(Node *node, int key)
 {
-  std::string out_right(key, 1, 1);
-
-  if (out_right == "_")
+  if (m_context_phones[key].second == '_')
   {
     // Link to the silence node.
     node->flags &= ~NODE_INSERT_WORD_BOUNDARY; // Clear this flag
@@ -834,47 +841,36 @@ void TPLexPrefixTree::link_fan_out_node_to_fan_in(Node *node,
 
 
 void
-TPLexPrefixTree::link_node_to_fan_network(const std::string &key,
+TPLexPrefixTree::link_node_to_fan_network(int key,
                                           std::vector<Arc> &source_arcs,
                                           bool fan_out,
                                           bool ignore_length,
                                           float out_transition_log_prob)
 {
   node_vector *target_nodes;
-  std::string new_key;
   Arc temp_arc;
   int i, j;
   if (fan_out)
   {
-    target_nodes = &get_fan_node_list(key, m_fan_out_entry_nodes);
-    if (target_nodes->size() == 0)
+    if (get_fan_node_list(key, m_fan_out_entry_nodes).size() == 0 &&
+        key < m_fan_out_triphones.size())
     {
       // Fan out nodes are created on demand
-      std::string left(key, 0, 1);
-      std::string mid(key, 1, 1);
-      std::map<std::string,int>::const_iterator it = m_hmm_map.begin();
-      while (it != m_hmm_map.end())
-      {
-        if ((*it).first.size() == 5)
-        {
-          std::string b((*it).first, 0, 1);
-          std::string m((*it).first, 2, 1);
-          std::string e((*it).first, 4, 1);
-          if (b == left && m == mid && e != "=")
-            add_hmm_to_fan_network((*it).second, true);
-        }
-        ++it;
-      }
+      const std::vector<int> & hmm_ids = m_fan_out_triphones[key];
+      for (i = 0; i < hmm_ids.size(); i++)
+        add_hmm_to_fan_network(hmm_ids[i], true);
     }
+    // Creating the nodes may intern new contexts, so fetch the list only
+    // now.
+    target_nodes = &get_fan_node_list(key, m_fan_out_entry_nodes);
   }
   else
   {
-    new_key = key;
     if (ignore_length && m_ignore_case) {
-      std::transform(new_key.begin(), new_key.end(), new_key.begin(),
-                     safe_tolower);
+      key = context_key(safe_tolower(m_context_phones[key].first),
+                        safe_tolower(m_context_phones[key].second));
     }
-    target_nodes = &get_fan_node_list(new_key, m_fan_in_entry_nodes);
+    target_nodes = &get_fan_node_list(key, m_fan_in_entry_nodes);
   }
 
   for (i = 0; i < target_nodes->size(); i++) {
@@ -894,9 +890,9 @@ TPLexPrefixTree::link_node_to_fan_network(const std::string &key,
     // Try with long length
     // NOTE: if (m_ignore_case) used to be here for the transform only,
     // moved to apply to the whole block as it should be obsolete
-    std::transform(++new_key.begin(), new_key.end(), ++new_key.begin(),
-                   safe_toupper);
-    node_vector & target_nodes = get_fan_node_list(new_key,
+    key = context_key(m_context_phones[key].first,
+                      safe_toupper(m_context_phones[key].second));
+    node_vector & target_nodes = get_fan_node_list(key,
                                                    m_fan_in_entry_nodes);
     for (i = 0; i < target_nodes.size(); i++) {
       for (j = 0; j < source_arcs.size(); j++) {
@@ -923,31 +919,29 @@ TPLexPrefixTree::add_single_hmm_word_for_cross_word_modeling(
     return;
   word_log_prob *= m_lm_scale;
 
-  string_to_nodes_map::const_iterator it;
-  std::string middle(hmm->label, 2, 1);
+  char middle = hmm->label[2];
   Node *wid_node;
   Arc temp_arc;
   NodeArcId node_arc_id;
   int i;
 
-  it = m_fan_in_last_nodes.begin();
-  while (it != m_fan_in_last_nodes.end())
+  // Interning new keys below may grow the tables, so iterate by index.
+  for (int key = 0; key < m_fan_in_last_nodes.size(); key++)
   {
-    std::string left((*it).first, 0, 1);
-    if (left == middle)
+    char left = m_context_phones[key].first;
+    if (left == middle && !m_fan_in_last_nodes[key].empty())
     {
-      std::string right((*it).first, 1, 1);
-      std::string in_key = left + right;
+      char right = m_context_phones[key].second;
+      int in_key = key;
       if (m_ignore_case)
-        std::transform(in_key.begin(), in_key.end(), in_key.begin(),
-                       safe_tolower);
+        in_key = context_key(safe_tolower(left), safe_tolower(right));
       // Create a null node
       wid_node = new Node(word_id);
       wid_node->node_id = m_nodes.size();
       wid_node->flags = NODE_USE_WORD_END_BEAM;
       m_nodes.push_back(wid_node);
       temp_arc.next = wid_node;
-      const node_vector & nlist = it->second;
+      const node_vector & nlist = m_fan_in_last_nodes[key];
 
       // Pronunciation log prob added to all out transition log probs.
       //   2013-02-28 / SE
@@ -956,7 +950,7 @@ TPLexPrefixTree::add_single_hmm_word_for_cross_word_modeling(
         nlist[i]->arcs.push_back(temp_arc);
       }
 
-      if (right == "_")
+      if (right == '_')
       {
         temp_arc.next = NULL;
         wid_node->arcs.push_back(temp_arc);
@@ -983,30 +977,25 @@ TPLexPrefixTree::add_single_hmm_word_for_cross_word_modeling(
         }
       }
     }
-    ++it;
   }
 }
 
 void TPLexPrefixTree::link_fan_in_nodes(void)
 {
-  string_to_nodes_map::const_iterator it;
   int i;
-  it = m_fan_in_last_nodes.begin();
-  while (it != m_fan_in_last_nodes.end()) {
-    const node_vector & nlist = it->second;
+  for (int key = 0; key < m_fan_in_last_nodes.size(); key++) {
+    const node_vector & nlist = m_fan_in_last_nodes[key];
     for (i = 0; i < nlist.size(); i++)
-      create_lex_tree_links_from_fan_in(nlist[i], it->first);
-    ++it;
+      create_lex_tree_links_from_fan_in(nlist[i], key);
   }
 }
 
 void TPLexPrefixTree::create_lex_tree_links_from_fan_in(Node *fan_in_node,
-                                                        const std::string &key)
+                                                        int key)
 {
   Arc temp_arc;
   int j, k;
 
-  std::string out_right(key, 1, 1);
   // Skip silences, as this node has either already been linked to silence when
   // adding a one-HMM word, or it is unused.
   // - Removed this check in order to be able to have long silence as the second
@@ -1017,19 +1006,18 @@ void TPLexPrefixTree::create_lex_tree_links_from_fan_in(Node *fan_in_node,
 //  if (out_right != "_")
   if (true)
   {
-    string_to_nodes_map::const_iterator it =
-      m_fan_in_connection_nodes.find(key);
-    if (it != m_fan_in_connection_nodes.end())
+    if (key < m_fan_in_connection_nodes.size())
     {
-      for (j = 0; j < it->second.size(); j++)
+      const node_vector & nlist = m_fan_in_connection_nodes[key];
+      for (j = 0; j < nlist.size(); j++)
       {
         // Check the link does not exist already
         for (k = 0; k < fan_in_node->arcs.size(); k++)
-          if (fan_in_node->arcs[k].next == it->second[j])
+          if (fan_in_node->arcs[k].next == nlist[j])
             break;
         if (k == fan_in_node->arcs.size()) {
           // Link
-          temp_arc.next = it->second[j];
+          temp_arc.next = nlist[j];
           temp_arc.log_prob = get_out_transition_log_prob(fan_in_node);
           fan_in_node->arcs.push_back(temp_arc);
         }
@@ -1038,32 +1026,175 @@ void TPLexPrefixTree::create_lex_tree_links_from_fan_in(Node *fan_in_node,
   }
 }
 
+namespace {
+
+// Everything that determines the future of a node.
+struct NodeSignature {
+  int model;
+  int word_id;
+  unsigned short flags;
+  // Sorted (target node id, log prob) pairs, self transitions as -1.
+  std::vector<std::pair<int, float> > arcs;
+  std::vector<int> possible_word_id_list;
+
+  bool operator<(const NodeSignature &other) const
+  {
+    if (model != other.model)
+      return model < other.model;
+    if (word_id != other.word_id)
+      return word_id < other.word_id;
+    if (flags != other.flags)
+      return flags < other.flags;
+    if (arcs != other.arcs)
+      return arcs < other.arcs;
+    return possible_word_id_list < other.possible_word_id_list;
+  }
+};
+
+}
+
+void TPLexPrefixTree::merge_equivalent_nodes(unsigned short flags)
+{
+  node_vector merged_into(m_nodes.size(), (Node*)NULL);
+  int num_merged = 0;
+  bool merged = true;
+  int i, j;
+
+  while (merged) {
+    merged = false;
+
+    // Nodes whose signatures equal that of an earlier node are merged into
+    // it. The signatures are computed from the arcs as they were before
+    // this round, so merging the successors makes their predecessors
+    // mergeable in the next round.
+    std::map<NodeSignature, Node*> classes;
+    for (i = 0; i < m_nodes.size(); i++) {
+      Node *node = m_nodes[i];
+      // The silence nodes are referred to directly, keep them.
+      if (merged_into[i] != NULL || !(node->flags & flags) ||
+          node == m_silence_node || node == m_last_silence_node)
+        continue;
+      NodeSignature signature;
+      signature.model = (node->state == NULL ? -1 : node->state->model);
+      signature.word_id = node->word_id;
+      signature.flags = node->flags;
+      signature.possible_word_id_list = node->possible_word_id_list;
+      for (j = 0; j < node->arcs.size(); j++) {
+        const Arc &arc = node->arcs[j];
+        assert( arc.next != NULL );
+        signature.arcs.push_back(std::make_pair(
+          arc.next == node ? -1 : arc.next->node_id, arc.log_prob));
+      }
+      std::sort(signature.arcs.begin(), signature.arcs.end());
+      std::pair<std::map<NodeSignature, Node*>::iterator, bool> result =
+        classes.insert(std::make_pair(signature, node));
+      if (!result.second) {
+        merged_into[i] = result.first->second;
+        num_merged++;
+        merged = true;
+      }
+    }
+    if (!merged)
+      break;
+
+    // Redirect the arcs to the remaining nodes. Merging may leave a node
+    // with several arcs to the same target, keep the best of them.
+    for (i = 0; i < m_nodes.size(); i++) {
+      Node *node = m_nodes[i];
+      if (merged_into[i] != NULL)
+        continue;
+      bool redirected = false;
+      for (j = 0; j < node->arcs.size(); j++) {
+        Node *next = node->arcs[j].next;
+        if (merged_into[next->node_id] != NULL) {
+          node->arcs[j].next = merged_into[next->node_id];
+          redirected = true;
+        }
+      }
+      if (!redirected)
+        continue;
+      std::map<Node*, int> arc_index;
+      std::vector<Arc> arcs;
+      for (j = 0; j < node->arcs.size(); j++) {
+        const Arc &arc = node->arcs[j];
+        std::map<Node*, int>::iterator it = arc_index.find(arc.next);
+        if (it == arc_index.end()) {
+          arc_index[arc.next] = arcs.size();
+          arcs.push_back(arc);
+        }
+        else if (arc.log_prob > arcs[it->second].log_prob)
+          arcs[it->second].log_prob = arc.log_prob;
+      }
+      node->arcs.swap(arcs);
+    }
+  }
+
+  if (num_merged == 0)
+    return;
+
+  update_fan_node_lists(m_fan_out_entry_nodes, merged_into);
+  update_fan_node_lists(m_fan_out_last_nodes, merged_into);
+  update_fan_node_lists(m_fan_in_entry_nodes, merged_into);
+  update_fan_node_lists(m_fan_in_last_nodes, merged_into);
+  update_fan_node_lists(m_fan_in_connection_nodes, merged_into);
+
+  // Delete the merged nodes and renumber the rest.
+  int num_nodes = 0;
+  for (i = 0; i < m_nodes.size(); i++) {
+    if (merged_into[i] != NULL) {
+      delete m_nodes[i];
+      continue;
+    }
+    m_nodes[num_nodes] = m_nodes[i];
+    m_nodes[num_nodes]->node_id = num_nodes;
+    num_nodes++;
+  }
+  m_nodes.resize(num_nodes);
+
+  if (m_verbose > 1)
+    fprintf(stderr, "Merged %d equivalent nodes\n", num_merged);
+}
+
+void TPLexPrefixTree::update_fan_node_lists(context_to_nodes_map &nmap,
+                                            const node_vector &merged_into)
+{
+  for (int key = 0; key < nmap.size(); key++) {
+    node_vector &nlist = nmap[key];
+    node_vector new_list;
+    for (int i = 0; i < nlist.size(); i++) {
+      Node *node = nlist[i];
+      while (merged_into[node->node_id] != NULL)
+        node = merged_into[node->node_id];
+      if (find(new_list.begin(), new_list.end(), node) == new_list.end())
+        new_list.push_back(node);
+    }
+    nlist.swap(new_list);
+  }
+}
+
 void TPLexPrefixTree::analyze_cross_word_network(void)
 {
   int num_out_nodes, num_in_nodes;
   int num_out_arcs, num_in_arcs;
   int temp_nodes, temp_arcs;
-  int i;
-  string_to_nodes_map::const_iterator it;
+  int i, key;
 
   num_out_nodes = num_in_nodes = 0;
   num_out_arcs = num_in_arcs = 0;
 
-  it = m_fan_out_entry_nodes.begin();
-  while (it != m_fan_out_entry_nodes.end()) {
-    for (i = 0; i < it->second.size(); i++)
-      count_fan_size(it->second[i], NODE_FAN_OUT, &temp_nodes, &temp_arcs);
+  for (key = 0; key < m_fan_out_entry_nodes.size(); key++) {
+    const node_vector & nlist = m_fan_out_entry_nodes[key];
+    for (i = 0; i < nlist.size(); i++)
+      count_fan_size(nlist[i], NODE_FAN_OUT, &temp_nodes, &temp_arcs);
     num_out_nodes += temp_nodes;
     num_out_arcs += temp_arcs;
-    ++it;
   }
-  it = m_fan_in_entry_nodes.begin();
-  while (it != m_fan_in_entry_nodes.end()) {
-    for (i = 0; i < it->second.size(); i++)
-      count_fan_size(it->second[i], NODE_FAN_IN, &temp_nodes, &temp_arcs);
+  for (key = 0; key < m_fan_in_entry_nodes.size(); key++) {
+    const node_vector & nlist = m_fan_in_entry_nodes[key];
+    for (i = 0; i < nlist.size(); i++)
+      count_fan_size(nlist[i], NODE_FAN_IN, &temp_nodes, &temp_arcs);
     num_in_nodes += temp_nodes;
     num_in_arcs += temp_arcs;
-    ++it;
   }
   if (m_verbose > 1) {
     fprintf(stderr, "FAN OUT: %d nodes, %d arcs\n", num_out_nodes,
@@ -1116,6 +1247,22 @@ void TPLexPrefixTree::free_cross_word_network_connection_points(void)
   m_fan_in_entry_nodes.clear();
   m_fan_in_last_nodes.clear();
   m_fan_in_connection_nodes.clear();
+  m_fan_out_triphones.clear();
+  m_context_keys.clear();
+  m_context_phones.clear();
+}
+
+int TPLexPrefixTree::context_key(char first, char second)
+{
+  if (m_context_keys.empty())
+    m_context_keys.resize(256 * 256, -1);
+  int &key = m_context_keys[(unsigned char)first * 256 +
+                            (unsigned char)second];
+  if (key < 0) {
+    key = m_context_phones.size();
+    m_context_phones.push_back(std::make_pair(first, second));
+  }
+  return key;
 }
 
 TPLexPrefixTree::Node*
@@ -1141,10 +1288,8 @@ TPLexPrefixTree::Node*
 TPLexPrefixTree::get_fan_out_entry_node(HmmState *state,
                                         const std::string &label)
 {
-  std::string temp1(label, 0, 1);
-  std::string temp2(label, 2, 1);
-  std::string key = temp1 + temp2;
-  node_vector & nlist = get_fan_node_list(key, m_fan_out_entry_nodes);
+  node_vector & nlist = get_fan_node_list(context_key(label, 0, 2),
+                                          m_fan_out_entry_nodes);
   Node *node;
 
   node = get_fan_state_node(state, nlist);
@@ -1156,12 +1301,11 @@ TPLexPrefixTree::Node*
 TPLexPrefixTree::get_fan_out_last_node(HmmState *state,
                                        const std::string &label)
 {
-  std::string temp1(label, 2, 1);
-  std::string temp2(label, 4, 1);
+  char center = label[2];
   if (m_ignore_case)
-    std::transform(temp1.begin(), temp1.end(), temp1.begin(), safe_tolower);
-  std::string key = temp1 + temp2;
-  node_vector & nlist = get_fan_node_list(key, m_fan_out_last_nodes);
+    center = safe_tolower(center);
+  node_vector & nlist = get_fan_node_list(context_key(center, label[4]),
+                                          m_fan_out_last_nodes);
   Node *node;
 
   node = get_fan_state_node(state, nlist);
@@ -1173,10 +1317,8 @@ TPLexPrefixTree::Node*
 TPLexPrefixTree::get_fan_in_entry_node(HmmState *state,
                                        const std::string &label)
 {
-  std::string temp1(label, 0, 1);
-  std::string temp2(label, 2, 1);
-  std::string key = temp1 + temp2;
-  node_vector & nlist = get_fan_node_list(key, m_fan_in_entry_nodes);
+  node_vector & nlist = get_fan_node_list(context_key(label, 0, 2),
+                                          m_fan_in_entry_nodes);
   Node *node;
 
   node = get_fan_state_node(state, nlist);
@@ -1187,10 +1329,8 @@ TPLexPrefixTree::get_fan_in_entry_node(HmmState *state,
 TPLexPrefixTree::Node*
 TPLexPrefixTree::get_fan_in_last_node(HmmState *state, const std::string &label)
 {
-  std::string temp1(label, 2, 1);
-  std::string temp2(label, 4, 1);
-  std::string key = temp1 + temp2;
-  node_vector & nlist = get_fan_node_list(key, m_fan_in_last_nodes);
+  node_vector & nlist = get_fan_node_list(context_key(label, 2, 4),
+                                          m_fan_in_last_nodes);
   Node *node;
 
   node = get_fan_state_node(state, nlist);
@@ -1218,9 +1358,10 @@ TPLexPrefixTree::get_fan_state_node(HmmState *state, node_vector & nodes)
 }
 
 TPLexPrefixTree::node_vector &
-TPLexPrefixTree::get_fan_node_list(const std::string &key,
-                                   string_to_nodes_map &nmap)
+TPLexPrefixTree::get_fan_node_list(int key, context_to_nodes_map &nmap)
 {
+  if (nmap.size() <= key)
+    nmap.resize(m_context_phones.size());
   return nmap[key];
 }
 
@@ -1229,13 +1370,9 @@ void
 TPLexPrefixTree::add_fan_in_connection_node(Node *node,
                                             const std::string &prev_label)
 {
-  std::string temp1(prev_label, 2, 1);
-  std::string temp2(prev_label, 4, 1);
-  std::string map_index = temp1 + temp2;
-  string_to_nodes_map::const_iterator it;
-
   node->flags |= NODE_FAN_IN_CONNECTION;
-  m_fan_in_connection_nodes[map_index].push_back(node);
+  get_fan_node_list(context_key(prev_label, 2, 4),
+                    m_fan_in_connection_nodes).push_back(node);
 }
 
 float TPLexPrefixTree::get_out_transition_log_prob(Node *node)
@@ -80,7 +80,10 @@ public:
   class Node;
 
   typedef std::vector<Node *> node_vector;
-  typedef std::map<std::string, node_vector> string_to_nodes_map;
+
+  /// Node lists of the cross word network indexed by an interned phone
+  /// context (see context_key()).
+  typedef std::vector<node_vector> context_to_nodes_map;
 
   struct WordHistory {
     inline WordHistory(int word_id, int frame, WordHistory *previous);
@@ -88,7 +91,10 @@ public:
     int word_id;
     int end_frame;
     int lex_node_id; // FIXME: debug info (node where the history was created)
-    int graph_node_id; // FIXME: debug info (word graph node)
+    // FIXME: debug info (word graph node). Renumbered by word graph
+    // compaction only while reachable from an active token, so the ids in
+    // other (e.g. frozen) histories refer to the graph before compaction.
+    int graph_node_id;
     float lm_log_prob;
     float am_log_prob;
     float cum_lm_log_prob;
@@ -237,6 +243,17 @@ public:
   void set_silence_is_word(bool b) { m_silence_is_word = b; }
   void set_ignore_case(bool b) { m_ignore_case = b; }
 
+  /// \brief Enables or disables sharing of common word suffixes.
+  ///
+  /// The prefix tree places the word identity on the first node after the
+  /// last branch of a word, so the rest of the word does not depend on the
+  /// word anymore and is carried in the token history. With suffix sharing
+  /// these tails are merged in finish_tree() when they have the same
+  /// states and the same successors, which reduces the nodes and tokens
+  /// with large subword lexicons.
+  ///
+  void set_suffix_sharing(bool b) { m_suffix_sharing = b; }
+
   void initialize_lex_tree(void);
 
   /// \brief Adds a word to the lexical prefix tree.
@@ -322,7 +339,7 @@ private:
   void add_hmm_to_fan_network(int hmm_id,
                               bool fan_out);
 
-  void link_fan_out_node_to_fan_in(Node *node, const std::string &key);
+  void link_fan_out_node_to_fan_in(Node *node, int key);
 
   /// \brief If \a fan_out is true, creates an arc to every fan-out entry
   /// node in the group specified by \a key, creating the entry nodes if
@@ -332,7 +349,7 @@ private:
   /// the same phoneme and having the same left context are grouped
   /// together and are allowed to share their common states.
   ///
-  void link_node_to_fan_network(const std::string &key,
+  void link_node_to_fan_network(int key,
                                 std::vector<Arc> &source_arcs,
                                 bool fan_out,
                                 bool ignore_length,
@@ -364,8 +381,28 @@ private:
   /// \brief Creates arcs from a final fan-in node in the cross word network, to
   /// the second triphones of each word.
   ///
-  void create_lex_tree_links_from_fan_in(Node *fan_in_node,
-                                         const std::string &key);
+  void create_lex_tree_links_from_fan_in(Node *fan_in_node, int key);
+
+  /// \brief Merges the nodes that have identical futures.
+  ///
+  /// Two nodes are equivalent if they share the state model, flags, word
+  /// identity and LM lookahead list, and have the same arcs. Equivalent
+  /// nodes having any of \a flags set are merged until no more merges are
+  /// possible, the arcs are redirected to the remaining nodes, and the
+  /// node ids are renumbered.
+  ///
+  /// With NODE_FAN_IN|NODE_FAN_OUT this minimizes the cross word network:
+  /// triphones that differ only by a context tied to the same states get
+  /// shared nodes. With NODE_AFTER_WORD_ID it shares the word tails after
+  /// the word identity has been placed, see set_suffix_sharing().
+  ///
+  void merge_equivalent_nodes(unsigned short flags);
+
+  /// \brief Replaces the merged nodes in \a nmap with the nodes they were
+  /// merged into.
+  ///
+  void update_fan_node_lists(context_to_nodes_map &nmap,
+                             const node_vector &merged_into);
 
   void analyze_cross_word_network(void);
   void count_fan_size(Node *node, unsigned short flag,
@@ -375,6 +412,23 @@ private:
   
   void free_cross_word_network_connection_points(void);
   Node* get_short_silence_node(void);
+
+  /// \brief Returns an integer identifier for the phone context formed by
+  /// the two phones, interning the pair if it has not been seen before.
+  ///
+  /// The phones are single characters, so the lookup is a table index
+  /// instead of a string comparison. The same pair is used both as a
+  /// (center, right) key of the last nodes and as a (left, center) key of
+  /// the entry nodes, which is how the two are matched when linking.
+  ///
+  int context_key(char first, char second);
+
+  /// \brief Returns the context key of the phones at positions \a first and
+  /// \a second of a triphone label.
+  ///
+  int context_key(const std::string &label, int first, int second)
+  { return context_key(label[first], label[second]); }
+
   Node* get_fan_out_entry_node(HmmState *state, const std::string &label);
   Node* get_fan_out_last_node(HmmState *state, const std::string &label);
   Node* get_fan_in_entry_node(HmmState *state, const std::string &label);
@@ -393,9 +447,7 @@ private:
   /// \brief Returns a reference to the entry of \ref nmap with given key,
   /// creating a new node_vector if necessary.
   ///
-  node_vector & get_fan_node_list(
-    const std::string &key,
-    string_to_nodes_map &nmap);
+  node_vector & get_fan_node_list(int key, context_to_nodes_map &nmap);
 
   /// \brief Marks a node as a connection point for linking back to the
   /// beginning (second triphone) of a word from the cross word network.
@@ -424,6 +476,7 @@ private:
 
   bool m_silence_is_word;
   bool m_ignore_case;
+  bool m_suffix_sharing;
   bool m_optional_short_silence;
   HmmState *m_short_silence_state;
   int m_word_boundary_id;
@@ -431,11 +484,20 @@ private:
   std::map<std::string,int> &m_hmm_map;
   std::vector<Hmm> &m_hmms;
 
-  string_to_nodes_map m_fan_out_entry_nodes;
-  string_to_nodes_map m_fan_out_last_nodes;
-  string_to_nodes_map m_fan_in_entry_nodes;
-  string_to_nodes_map m_fan_in_last_nodes;
-  string_to_nodes_map m_fan_in_connection_nodes;
+  // Interned phone contexts: the key of each pair of phone characters
+  // (-1 if not seen), and the phones of each key.
+  std::vector<int> m_context_keys;
+  std::vector<std::pair<char, char> > m_context_phones;
+
+  // For each (left, center) context key, the fan-out triphones that are
+  // created on demand when a word ending in that context is added.
+  std::vector<std::vector<int> > m_fan_out_triphones;
+
+  context_to_nodes_map m_fan_out_entry_nodes;
+  context_to_nodes_map m_fan_out_last_nodes;
+  context_to_nodes_map m_fan_in_entry_nodes;
+  context_to_nodes_map m_fan_in_last_nodes;
+  context_to_nodes_map m_fan_in_connection_nodes;
   std::vector<NodeArcId> m_silence_arcs;
 };
 
@@ -7,8 +7,14 @@
 #include <iostream>
 #include <string>
 #include <cctype>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <map>
+#include <set>
 
 #include "TokenPassSearch.hh"
+#include "TreeGram.hh"
 
 #define NUM_HISTOGRAM_BINS 100
 #define TOKEN_RESERVE_BLOCK 1024
@@ -51,10 +57,15 @@ TokenPassSearch::TokenPassSearch(TPLexPrefixTree &lex, Vocabulary &vocab,
   m_ngram(NULL),
   m_fsa_lm(NULL),
   m_lookahead_ngram(NULL),
+  m_rescoring_ngram(NULL),
+  m_rescoring_lm_scale(-1),
   m_print_probs(0),
   m_print_text_result(0),
   m_print_state_segmentation(false),
   m_keep_state_segmentation(false),
+  m_history_freeze_interval(0),
+  m_frozen_word_history_file(NULL),
+  m_frozen_state_history_file(NULL),
   m_global_beam(1e10),
   m_word_end_beam(1e10),
   m_similar_lm_hist_span(0),
@@ -65,17 +76,19 @@ TokenPassSearch::TokenPassSearch(TPLexPrefixTree &lex, Vocabulary &vocab,
   m_verbose(0),
   m_word_boundary_id(0),
   m_lm_lookahead(0),
-  m_max_lookahead_score_list_size(DEFAULT_MAX_LOOKAHEAD_SCORE_LIST_SIZE),
+  m_lookahead_score_list_memory(0),
   m_max_node_lookahead_buffer_size(DEFAULT_MAX_NODE_LOOKAHEAD_BUFFER_SIZE),
   m_insertion_penalty(0),
   m_sentence_start_id(-1),
   m_sentence_end_id(-1),
   m_use_sentence_boundary(false),
   m_generate_word_graph(false),
+  m_word_graph_compaction_interval(100),
   m_require_sentence_end(false),
   m_remove_pronunciation_id(false),
   m_use_word_pair_approximation(false),
   m_use_lm_cache(true),
+  m_use_lm_state_recombination(false),
   m_current_glob_beam(0),
   m_current_we_beam(0),
   m_eq_depth_beam(1e10),
@@ -83,12 +96,17 @@ TokenPassSearch::TokenPassSearch(TPLexPrefixTree &lex, Vocabulary &vocab,
   m_fan_in_beam(1e10),
   m_fan_out_beam(1e10),
   m_state_beam(1e10),
+  m_acoustic_lookahead_frames(0),
+  m_acoustic_lookahead_scale(1),
+  m_acoustic_lookahead_last_frame(-1),
+  m_acoustic_lookahead_eof_frame(-1),
   filecount(0),
   m_min_word_count(0),
   m_fan_in_log_prob(0),
   m_fan_out_log_prob(0),
   m_fan_out_last_log_prob(0),
-  m_lm_lookahead_initialized(false)
+  m_lm_lookahead_initialized(false),
+  m_use_lookahead_context_states(false)
 {
   m_active_token_list = new std::vector<TPLexPrefixTree::Token*>;
   m_new_token_list = new std::vector<TPLexPrefixTree::Token*>;
@@ -110,6 +128,7 @@ TokenPassSearch::~TokenPassSearch() {
        it!=m_token_dealloc_table.end();++it) {
     delete[] *it;
   }
+  clear_preloaded_lookahead_scores();
 }
 
 void TokenPassSearch::set_word_boundary(const std::string &word)
@@ -179,6 +198,12 @@ void TokenPassSearch::reset_search(int start_frame)
       release_token((*m_active_token_list)[i]);
   }
   m_active_token_list->clear();
+  m_frozen_word_history.clear();
+  m_frozen_state_history.clear();
+  m_acoustic_lookahead_last_frame = start_frame;
+  m_acoustic_lookahead_eof_frame = -1;
+  m_acoustic_lookahead_score_frame.assign(
+    m_acoustic_lookahead_score_frame.size(), -1);
 
   m_lexicon.clear_node_token_lists();
 
@@ -257,21 +282,51 @@ void TokenPassSearch::reset_search(int start_frame)
 
   m_active_token_list->push_back(t);
 
-  if (lm_lookahead_score_list.get_num_items() > 0) {
+  // The lookahead scores depend only on the models, so they are kept
+  // across utterances until the models change.
+  if (!m_lm_lookahead_initialized && (m_lm_lookahead > 0)) {
     // Delete the LM lookahead cache
     LMLookaheadScoreList *score_list;
     while (lm_lookahead_score_list.remove_last_item(&score_list))
       delete score_list;
-  }
 
-  if (!m_lm_lookahead_initialized && (m_lm_lookahead > 0)) {
-    lm_lookahead_score_list.set_max_items(m_max_lookahead_score_list_size);
+    // Derive the number of cached score lists from the memory budget.
+    size_t list_memory = sizeof(LMLookaheadScoreList)
+      + m_word_repository.size() * sizeof(unsigned short);
+    size_t memory = m_lookahead_score_list_memory;
+    if (memory == 0)
+      memory = DEFAULT_MAX_LOOKAHEAD_SCORE_LIST_SIZE
+        * m_word_repository.size() * sizeof(float);
+    lm_lookahead_score_list.set_max_items(
+      std::max((size_t)1, memory / list_memory));
     m_lexicon.set_lm_lookahead_cache_sizes(m_max_node_lookahead_buffer_size);
     m_lm_lookahead_initialized = true;
   }
 
   if (m_lm_lookahead > 0) {
-    assert( m_lookahead_ngram != NULL);
+    if (m_lookahead_ngram == NULL) {
+      if (m_lm_lookahead < 3 || m_fsa_lm == NULL)
+        throw InvalidSetup("Lookahead n-gram has not been set.");
+      m_use_lookahead_context_states = true;
+    }
+    else {
+      m_use_lookahead_context_states = (m_lm_lookahead >= 2)
+        && m_lookahead_ngram->supports_context_states();
+      if (m_lm_lookahead >= 3 && !m_use_lookahead_context_states)
+        throw InvalidSetup("Full order lookahead is not supported by the "
+                           "lookahead n-gram.");
+    }
+  }
+
+  if (m_use_lm_state_recombination && m_ngram != NULL
+      && !m_ngram->supports_context_states()) {
+    throw InvalidSetup("LM state recombination is not supported by the "
+                       "n-gram model.");
+  }
+
+  if (m_acoustic_lookahead_frames > 0 && !m_acoustics->can_read_ahead()) {
+    throw InvalidSetup("Acoustic lookahead requires acoustics that can read "
+                       "ahead.");
   }
 
   if (m_lm_score_cache.get_num_items() > 0) {
@@ -303,6 +358,8 @@ TokenPassSearch::run(void)
 
   if (m_verbose > 1)
     printf("run() in frame %d\n", m_frame);
+  if (m_acoustic_lookahead_frames > 0)
+    read_acoustic_lookahead();
   if ((m_end_frame != -1 && m_frame >= m_end_frame) ||
       !m_acoustics->go_to(m_frame))
   {
@@ -320,6 +377,17 @@ TokenPassSearch::run(void)
 
   propagate_tokens();
   prune_tokens();
+  if (m_generate_word_graph && m_word_graph_compaction_interval > 0
+      && (m_frame + 1) % m_word_graph_compaction_interval == 0
+      && 2 * word_graph.num_free_nodes() > word_graph.nodes.size())
+  {
+    compact_word_graph();
+  }
+  if (m_history_freeze_interval > 0
+      && (m_frame + 1) % m_history_freeze_interval == 0)
+  {
+    freeze_histories();
+  }
 #ifdef PRUNING_MEASUREMENT
   analyze_tokens();
 #endif
@@ -506,28 +574,33 @@ void TokenPassSearch::write_word_history(FILE *file, bool get_best_path)
   }
 
   // Print path
-  for (int i = stack.size() - 1; i >= 0; i--) {
-    stack[i]->printed = true;
-    string word(m_vocabulary.word(stack[i]->word_id));
-    fprintf(file, "%s ", word.c_str());
-
-    int spaces = 16 - word.length();
-    if (spaces < 1)
-      spaces = 1;
-    for (int j = 0; j < spaces; j++)
-      fputc(' ', file);
-    fprintf(file, "%d\t%d\t%d\t%.3f\t%.3f\t%.3f\n", stack[i]->end_frame,
-            stack[i]->lex_node_id, stack[i]->graph_node_id,
-            stack[i]->am_log_prob, stack[i]->lm_log_prob,
-            get_token_log_prob(stack[i]->cum_am_log_prob,
-                               stack[i]->cum_lm_log_prob));
-  }
+  for (int i = stack.size() - 1; i >= 0; i--)
+    write_word_history_entry(file, stack[i]);
   if (get_best_path)
     fprintf(file, "\n");
 
   fflush(file);
 }
 
+void TokenPassSearch::write_word_history_entry(
+  FILE *file, TPLexPrefixTree::WordHistory *history)
+{
+  history->printed = true;
+  string word(m_vocabulary.word(history->word_id));
+  fprintf(file, "%s ", word.c_str());
+
+  int spaces = 16 - word.length();
+  if (spaces < 1)
+    spaces = 1;
+  for (int j = 0; j < spaces; j++)
+    fputc(' ', file);
+  fprintf(file, "%d\t%d\t%d\t%.3f\t%.3f\t%.3f\n", history->end_frame,
+          history->lex_node_id, history->graph_node_id,
+          history->am_log_prob, history->lm_log_prob,
+          get_token_log_prob(history->cum_am_log_prob,
+                             history->cum_lm_log_prob));
+}
+
 void TokenPassSearch::print_lm_history(FILE *file, bool get_best_path)
 {
   const TPLexPrefixTree::Token & token =
@@ -1004,7 +1077,7 @@ TokenPassSearch::move_token_to_node(TPLexPrefixTree::Token *token,
         if ((updated_token.node->possible_word_id_list.size() > 0)
             && (m_lm_lookahead > 0)) {
           updated_token.cur_lm_log_prob = updated_token.lm_log_prob
-            + get_lm_lookahead_score(token->lm_history,
+            + get_lm_lookahead_score(token->lm_history, token->fsa_lm_node,
                                      updated_token.node, updated_token.depth);
         }
         else {
@@ -1187,6 +1260,17 @@ TokenPassSearch::move_token_to_node(TPLexPrefixTree::Token *token,
       return;
     }
 
+    // Prune poor word starts using the acoustic scores of the next frames.
+    if (m_acoustic_lookahead_frames > 0
+        && (updated_token.node->flags & NODE_FIRST_STATE_OF_WORD)
+        && updated_token.node != token->node
+        && updated_token.total_log_prob + m_acoustic_lookahead_scale
+        * get_acoustic_lookahead_score(updated_token.node)
+        < m_best_log_prob - m_current_glob_beam)
+    {
+      return;
+    }
+
 #ifdef STATE_PRUNING
     if (updated_token.node->flags&(NODE_FAN_OUT|NODE_FAN_IN))
     {
@@ -1390,6 +1474,18 @@ TokenPassSearch::find_similar_lm_history(LMHistory *wh, int lm_hist_code,
   assert(!m_fsa_lm);
 
   TPLexPrefixTree::Token *cur_token = token_list;
+  if (m_use_lm_state_recombination) {
+    int lm_state = get_lm_context_state(wh);
+    for (; cur_token != NULL; cur_token = cur_token->next_node_token) {
+      if ((lm_state == get_lm_context_state(cur_token->lm_history))
+          && (!m_generate_word_graph
+              || wh->last().lm_id() == cur_token->lm_history->last().lm_id())) {
+        return cur_token;
+      }
+    }
+    return cur_token;  // NULL
+  }
+
   for (; cur_token != NULL; cur_token = cur_token->next_node_token) {
     if ((lm_hist_code == cur_token->lm_hist_code)
         && (is_similar_lm_history(wh, cur_token->lm_history))) {
@@ -1399,6 +1495,37 @@ TokenPassSearch::find_similar_lm_history(LMHistory *wh, int lm_hist_code,
   return cur_token;  // NULL
 }
 
+int TokenPassSearch::get_lm_context_state(LMHistory *wh)
+{
+  if (wh->lm_state >= 0)
+    return wh->lm_state;
+
+#ifdef ENABLE_MULTIWORD_SUPPORT
+  if (m_split_multiwords) {
+    // The context consists of the components of the last words.
+    m_history_ngram.clear();
+    LMHistory::ConstReverseIterator iter = wh->rbegin();
+    for (int words_needed = m_ngram->order() - 1; words_needed > 0;
+         --words_needed) {
+      if (iter->word_id == -1)
+        break;  // Reached the beginning of the history.
+      m_history_ngram.push_front(iter->lm_id);
+      if (iter->word_id == m_sentence_start_id)
+        break;  // Reached the beginning of the sentence.
+      ++iter;
+    }
+  }
+  else {
+    create_history_ngram(wh, m_ngram->order() - 1);
+  }
+#else
+  create_history_ngram(wh, m_ngram->order() - 1);
+#endif
+
+  wh->lm_state = m_ngram->context_state(m_history_ngram);
+  return wh->lm_state;
+}
+
 inline bool TokenPassSearch::is_similar_lm_history(LMHistory *wh1,
                                                    LMHistory *wh2)
 {
@@ -1702,6 +1829,7 @@ int TokenPassSearch::set_ngram(NGram *ngram)
   m_ngram = ngram;
   // Initialize LM lookahead caches again.
   m_lm_lookahead_initialized = false;
+  clear_preloaded_lookahead_scores();
   return create_word_repository();
 }
 
@@ -1709,6 +1837,8 @@ int TokenPassSearch::set_fsa_lm(fsalm::LM *lm)
 {
   assert(!m_ngram);
   m_fsa_lm = lm;
+  m_lm_lookahead_initialized = false;
+  clear_preloaded_lookahead_scores();
   return create_word_repository();
 }
 
@@ -1716,6 +1846,14 @@ int TokenPassSearch::set_lookahead_ngram(NGram *ngram)
 {
   assert( m_ngram != NULL || m_fsa_lm != NULL);
   m_lookahead_ngram = ngram;
+  m_lm_lookahead_initialized = false;
+  clear_preloaded_lookahead_scores();
+  return create_word_repository();
+}
+
+int TokenPassSearch::set_rescoring_ngram(NGram *ngram)
+{
+  m_rescoring_ngram = ngram;
   return create_word_repository();
 }
 
@@ -1723,6 +1861,7 @@ int TokenPassSearch::create_word_repository()
 {
   m_word_repository.clear();
   m_word_repository.resize(m_vocabulary.num_words());
+  m_rescoring_lm_ids.clear();
 
   int num_not_found = 0;
 
@@ -1756,12 +1895,20 @@ int TokenPassSearch::create_word_repository()
     float cm_log_prob;
     find_word_from_lm(i, word, lm_id, cm_log_prob);
     int lookahead_lm_id = find_word_from_lookahead_lm(i, word);
+    int rescoring_lm_id = find_word_from_rescoring_lm(i, word);
+    if (m_rescoring_lm_ids.size() <= i)
+      m_rescoring_lm_ids.resize(i + 1, 0);
+    m_rescoring_lm_ids[i] = rescoring_lm_id;
 
     bool not_found = (lm_id < 0) && (i != 0);
     if ((m_lookahead_ngram != NULL)
         && ((lookahead_lm_id == 0) && (i != 0))) {
       not_found = true;
     }
+    if ((m_rescoring_ngram != NULL)
+        && ((rescoring_lm_id == 0) && (i != 0))) {
+      not_found = true;
+    }
 
     m_word_repository.at(i).set_ids(i, lm_id, lookahead_lm_id);
 
@@ -1827,6 +1974,7 @@ int TokenPassSearch::create_word_repository()
   // We may have added words to the vocabulary along the way but I think the
   // new words should have been added to the word repository in the end.
   assert(m_vocabulary.num_words() == m_word_repository.size());
+  m_rescoring_lm_ids.resize(m_vocabulary.num_words(), 0);
 
   return num_not_found;
 }
@@ -1895,6 +2043,27 @@ int TokenPassSearch::find_word_from_lookahead_lm(int word_id,
   return m_lookahead_ngram->word_index(word);
 }
 
+int TokenPassSearch::find_word_from_rescoring_lm(int word_id,
+                                                 std::string word) const
+{
+  if (m_rescoring_ngram == NULL)
+    return 0;
+
+#ifdef ENABLE_WORDCLASS_SUPPORT
+  if (m_word_classes != NULL) {
+    try {
+      const WordClasses::Membership & class_membership =
+        m_word_classes->get_membership(word_id);
+      word = m_word_classes->get_class_name(class_membership.class_id);
+    }
+    catch (out_of_range &) {
+    }
+  }
+#endif
+
+  return m_rescoring_ngram->word_index(word);
+}
+
 #ifdef ENABLE_MULTIWORD_SUPPORT
 float TokenPassSearch::split_and_compute_ngram_score(LMHistory * history)
 {
@@ -2072,6 +2241,7 @@ void TokenPassSearch::update_lm_log_prob(TPLexPrefixTree::Token & token)
 }
 
 float TokenPassSearch::get_lm_lookahead_score(LMHistory *lm_hist,
+                                              int fsa_lm_node,
                                               TPLexPrefixTree::Node *node, int depth)
 {
   // The last word or its last component.
@@ -2086,6 +2256,13 @@ float TokenPassSearch::get_lm_lookahead_score(LMHistory *lm_hist,
     return get_lm_bigram_lookahead(w2, node, depth);
   }
 
+  if (m_use_lookahead_context_states) {
+    if (m_lookahead_ngram == NULL)
+      return get_lm_context_lookahead(fsa_lm_node, lm_hist, node, depth);
+    return get_lm_context_lookahead(get_lookahead_context_state(lm_hist),
+                                    lm_hist, node, depth);
+  }
+
   // The component before the last component of the last word, or the word
   // before the last word.
   ++iter;
@@ -2119,8 +2296,8 @@ float TokenPassSearch::get_lm_bigram_lookahead(int prev_word_id,
   // Not found from cache. Compute the LM bigram lookahead score for every
   // word pair starting with prev_word_id (unless the LM scores have been
   // computed already.
-  LMLookaheadScoreList * score_list = NULL;
-  if (!lm_lookahead_score_list.find(prev_word_id, &score_list)) {
+  LMLookaheadScoreList * score_list = find_lookahead_scores(prev_word_id);
+  if (score_list == NULL) {
 #ifdef COUNT_LM_LA_CACHE_MISS
     lm_la_word_cache_miss++;
 #endif
@@ -2128,33 +2305,23 @@ float TokenPassSearch::get_lm_bigram_lookahead(int prev_word_id,
     if (m_verbose > 2)
       printf("Compute lm lookahead scores for \'%s'\n",
              m_vocabulary.word(prev_word_id).c_str());
-    score_list = new LMLookaheadScoreList;
-    LMLookaheadScoreList * old_score_list = NULL;
-    if (lm_lookahead_score_list.insert(prev_word_id, score_list,
-                                       &old_score_list))
-      delete old_score_list; // Old list was removed
-    score_list->index = prev_word_id;
-    score_list->lm_scores.insert(score_list->lm_scores.end(),
-                                 m_word_repository.size(), 0);
-
     vector<float> extensions;
     m_lookahead_ngram->fetch_bigram_list(
       m_word_repository[prev_word_id].lookahead_lm_id(), extensions);
 
     // Map lookahead LM IDs to word IDs.
+    m_lookahead_scores.resize(m_word_repository.size());
     for (int i = 0; i < m_word_repository.size(); ++i) {
-      score_list->lm_scores.at(i) =
+      m_lookahead_scores[i] =
         extensions.at(m_word_repository[i].lookahead_lm_id());
     }
+    score_list = cache_lookahead_scores(prev_word_id);
   }
 
   // Compute the lookahead score by selecting the maximum LM score of possible
   // word ends.
-  score = -1e10;
-  for (int i = 0; i < node->possible_word_id_list.size(); i++) {
-    if (score_list->lm_scores[node->possible_word_id_list[i]] > score)
-      score = score_list->lm_scores[node->possible_word_id_list[i]];
-  }
+  score_list->uses++;
+  score = max_lookahead_score(*score_list, node);
 
   // Add the score to the node's buffer
   node->lm_lookahead_buffer.insert(prev_word_id, score, NULL);
@@ -2182,8 +2349,8 @@ float TokenPassSearch::get_lm_trigram_lookahead(int w1, int w2,
   // Not found from cache. Compute the LM trigram lookahead score for every
   // word triplet starting with w1 w2 (unless the LM scores have been computed
   // already).
-  LMLookaheadScoreList * score_list = NULL;
-  if (!lm_lookahead_score_list.find(index, &score_list)) {
+  LMLookaheadScoreList * score_list = find_lookahead_scores(index);
+  if (score_list == NULL) {
 #ifdef COUNT_LM_LA_CACHE_MISS
     lm_la_word_cache_miss++;
 #endif
@@ -2192,32 +2359,23 @@ float TokenPassSearch::get_lm_trigram_lookahead(int w1, int w2,
       printf("Compute lm lookahead scores for (%s,%s)\n",
              m_vocabulary.word(w1).c_str(),
              m_vocabulary.word(w2).c_str());
-    score_list = new LMLookaheadScoreList;
-    LMLookaheadScoreList * old_score_list = NULL;
-    if (lm_lookahead_score_list.insert(index, score_list, &old_score_list))
-      delete old_score_list; // Old list was removed
-    score_list->index = index;
-    score_list->lm_scores.insert(score_list->lm_scores.end(),
-                                 m_word_repository.size(), 0);
-
     vector<float> extensions;
     m_lookahead_ngram->fetch_trigram_list(
       m_word_repository[w1].lookahead_lm_id(),
       m_word_repository[w2].lookahead_lm_id(), extensions);
 
     // Map lookahead LM IDs to word IDs.
+    m_lookahead_scores.resize(m_word_repository.size());
     for (int i = 0; i < m_word_repository.size(); ++i)
-      score_list->lm_scores.at(i) =
+      m_lookahead_scores[i] =
         extensions.at(m_word_repository[i].lookahead_lm_id());
+    score_list = cache_lookahead_scores(index);
   }
 
   // Compute the lookahead score by selecting the maximum LM score of
   // possible word ends.
-  score = -1e10;
-  for (int i = 0; i < node->possible_word_id_list.size(); i++) {
-    if (score_list->lm_scores[node->possible_word_id_list[i]] > score)
-      score = score_list->lm_scores[node->possible_word_id_list[i]];
-  }
+  score_list->uses++;
+  score = max_lookahead_score(*score_list, node);
 
   // Add the score to the node's buffer
   node->lm_lookahead_buffer.insert(index, score, NULL);
@@ -2225,6 +2383,437 @@ float TokenPassSearch::get_lm_trigram_lookahead(int w1, int w2,
   return score;
 }
 
+void TokenPassSearch::read_acoustic_lookahead()
+{
+  int frames = m_acoustic_lookahead_frames;
+  if (m_acoustic_lookahead_buffer.size() != frames) {
+    m_acoustic_lookahead_buffer.resize(frames);
+    m_acoustic_lookahead_max.resize(frames);
+    m_acoustic_lookahead_last_frame = m_frame;
+  }
+
+  int first = std::max(m_acoustic_lookahead_last_frame + 1, m_frame + 1);
+  for (int f = first; f <= m_frame + frames; f++) {
+    if (m_acoustic_lookahead_eof_frame >= 0
+        || !m_acoustics->go_to(f))
+    {
+      if (m_acoustic_lookahead_eof_frame < 0)
+        m_acoustic_lookahead_eof_frame = f;
+      break;
+    }
+    std::vector<float> &log_probs = m_acoustic_lookahead_buffer[f % frames];
+    log_probs.resize(m_acoustics->num_models());
+    float max_log_prob = -1e10;
+    for (int i = 0; i < log_probs.size(); i++) {
+      log_probs[i] = m_acoustics->log_prob(i);
+      max_log_prob = std::max(max_log_prob, log_probs[i]);
+    }
+    m_acoustic_lookahead_max[f % frames] = max_log_prob;
+    m_acoustic_lookahead_last_frame = f;
+  }
+}
+
+float TokenPassSearch::get_acoustic_lookahead_score(
+  TPLexPrefixTree::Node *node)
+{
+  if (node->state == NULL)
+    return 0;
+  if (m_acoustic_lookahead_score.size() <= node->node_id) {
+    m_acoustic_lookahead_score.resize(node->node_id + 1, 0);
+    m_acoustic_lookahead_score_frame.resize(node->node_id + 1, -1);
+  }
+  if (m_acoustic_lookahead_score_frame[node->node_id] == m_frame)
+    return m_acoustic_lookahead_score[node->node_id];
+
+  // Collect the states of the phone: the node and the two following
+  // states, which are all reached without branching in the prefix tree.
+  int models[3];
+  int num_models = 0;
+  TPLexPrefixTree::Node *cur = node;
+  while (cur != NULL && cur->state != NULL && num_models < 3) {
+    models[num_models++] = cur->state->model;
+    TPLexPrefixTree::Node *next = NULL;
+    for (int i = 0; i < cur->arcs.size(); i++) {
+      if (cur->arcs[i].next != cur) {
+        if (next != NULL) {
+          next = NULL;
+          break;
+        }
+        next = cur->arcs[i].next;
+      }
+    }
+    cur = next;
+  }
+
+  float score = 0;
+  int last = std::min(m_frame + m_acoustic_lookahead_frames,
+                      m_acoustic_lookahead_last_frame);
+  for (int f = m_frame + 1; f <= last; f++) {
+    const std::vector<float> &log_probs =
+      m_acoustic_lookahead_buffer[f % m_acoustic_lookahead_frames];
+    float best = -1e10;
+    for (int i = 0; i < num_models; i++)
+      best = std::max(best, log_probs[models[i]]);
+    score += best - m_acoustic_lookahead_max[f % m_acoustic_lookahead_frames];
+  }
+
+  m_acoustic_lookahead_score[node->node_id] = score;
+  m_acoustic_lookahead_score_frame[node->node_id] = m_frame;
+  return score;
+}
+
+void TokenPassSearch::LMLookaheadScoreList::set_scores(
+  const std::vector<float> &scores)
+{
+  // Impossible words get code 0 and do not affect the range.
+  min_score = FLT_MAX;
+  float max_score = -FLT_MAX;
+  for (int i = 0; i < scores.size(); i++) {
+    if (scores[i] <= -1e10)
+      continue;
+    min_score = std::min(min_score, scores[i]);
+    max_score = std::max(max_score, scores[i]);
+  }
+  step = 0;
+  if (max_score > min_score)
+    step = (max_score - min_score) / 65534;
+
+  lm_scores.resize(scores.size());
+  for (int i = 0; i < scores.size(); i++) {
+    if (scores[i] <= -1e10)
+      lm_scores[i] = 0;
+    else if (step == 0)
+      lm_scores[i] = 1;
+    else
+      lm_scores[i] = 1 + (unsigned short)((scores[i] - min_score) / step + 0.5f);
+  }
+}
+
+TokenPassSearch::LMLookaheadScoreList *
+TokenPassSearch::cache_lookahead_scores(int index)
+{
+  LMLookaheadScoreList * score_list = new LMLookaheadScoreList;
+  LMLookaheadScoreList * old_score_list = NULL;
+  if (lm_lookahead_score_list.insert(index, score_list, &old_score_list))
+    delete old_score_list; // Old list was removed
+  score_list->index = index;
+  score_list->uses = 0;
+  score_list->set_scores(m_lookahead_scores);
+  return score_list;
+}
+
+TokenPassSearch::LMLookaheadScoreList *
+TokenPassSearch::find_lookahead_scores(int index)
+{
+  LMLookaheadScoreList * score_list = NULL;
+  if (lm_lookahead_score_list.find(index, &score_list))
+    return score_list;
+  if (m_preloaded_lookahead_scores.empty())
+    return NULL;
+  std::map<int, LMLookaheadScoreList*>::const_iterator it =
+    m_preloaded_lookahead_scores.find(index);
+  if (it == m_preloaded_lookahead_scores.end())
+    return NULL;
+  return it->second;
+}
+
+unsigned int TokenPassSearch::lookahead_checksum() const
+{
+  unsigned int checksum = m_word_repository.size();
+  for (int i = 0; i < m_word_repository.size(); ++i) {
+    checksum = checksum * 31 + m_word_repository[i].lookahead_lm_id();
+    checksum = checksum * 31 + m_word_repository[i].lm_id();
+  }
+  return checksum;
+}
+
+unsigned int TokenPassSearch::lookahead_lm_fingerprint()
+{
+  // Hash the bit patterns of the probabilities of a few contexts.
+  const int num_contexts = 8;
+  std::vector<float> probs;
+  std::vector<unsigned int> values;
+  if (m_lookahead_ngram != NULL) {
+    values.push_back(m_lookahead_ngram->order());
+    TreeGram *tree_gram = dynamic_cast<TreeGram*>(m_lookahead_ngram);
+    if (tree_gram != NULL) {
+      for (int o = 1; o <= tree_gram->order(); o++)
+        values.push_back(tree_gram->gram_count(o));
+    }
+    for (int c = 0; c < num_contexts && !m_word_repository.empty(); c++) {
+      int word_id = (long)c * m_word_repository.size() / num_contexts;
+      m_lookahead_ngram->fetch_bigram_list(
+        m_word_repository[word_id].lookahead_lm_id(), probs);
+      for (int i = 0; i < probs.size(); i++) {
+        unsigned int bits;
+        memcpy(&bits, &probs[i], sizeof(bits));
+        values.push_back(bits);
+      }
+    }
+  }
+  else if (m_fsa_lm != NULL) {
+    values.push_back(m_fsa_lm->order());
+    values.push_back(m_fsa_lm->num_nodes());
+    values.push_back(m_fsa_lm->num_arcs());
+    // Not every node is a valid context, so only the initial one is used.
+    m_fsa_lm->fetch_probs(m_fsa_lm->initial_node_id(), probs);
+    for (int i = 0; i < probs.size(); i++) {
+      unsigned int bits;
+      memcpy(&bits, &probs[i], sizeof(bits));
+      values.push_back(bits);
+    }
+  }
+
+  unsigned int fingerprint = values.size();
+  for (int i = 0; i < values.size(); i++)
+    fingerprint = fingerprint * 31 + values[i];
+  return fingerprint;
+}
+
+void TokenPassSearch::clear_preloaded_lookahead_scores()
+{
+  std::map<int, LMLookaheadScoreList*>::iterator it;
+  for (it = m_preloaded_lookahead_scores.begin();
+       it != m_preloaded_lookahead_scores.end(); ++it)
+  {
+    delete it->second;
+  }
+  m_preloaded_lookahead_scores.clear();
+}
+
+namespace {
+  struct MoreUsedScoreList {
+    template <typename T>
+    bool operator()(const T *a, const T *b) const { return a->uses > b->uses; }
+  };
+
+  // Score list files start with the magic, the version, the lookahead
+  // order, whether the FSA LM is used for lookahead, the number of words,
+  // the checksum of the vocabulary, the fingerprint of the lookahead LM and
+  // the number of lists.  Each list is
+  // stored as its key, use count, minimum score, step and the quantized
+  // scores of every word.  The numbers are in the byte order of the host.
+  const char lookahead_file_magic[] = "LMLA";
+  const int lookahead_file_version = 2;
+}
+
+void TokenPassSearch::write_lm_lookahead_scores(const std::string &file_name,
+                                                int max_lists)
+{
+  std::vector<LMLookaheadScoreList*> lists;
+  lm_lookahead_score_list.get_items(lists);
+  std::map<int, LMLookaheadScoreList*>::const_iterator it;
+  for (it = m_preloaded_lookahead_scores.begin();
+       it != m_preloaded_lookahead_scores.end(); ++it)
+  {
+    // A list computed again after the preloaded one is not written twice.
+    LMLookaheadScoreList *cached = NULL;
+    if (!lm_lookahead_score_list.find(it->first, &cached))
+      lists.push_back(it->second);
+  }
+  std::stable_sort(lists.begin(), lists.end(), MoreUsedScoreList());
+  if (max_lists > 0 && lists.size() > max_lists)
+    lists.resize(max_lists);
+
+  FILE *file = fopen(file_name.c_str(), "wb");
+  if (!file) {
+    throw IOError("Could not open LM lookahead file for writing.");
+  }
+
+  int header[5];
+  header[0] = lookahead_file_version;
+  header[1] = m_lm_lookahead;
+  header[2] = (m_lookahead_ngram == NULL);
+  header[3] = m_word_repository.size();
+  header[4] = lists.size();
+  unsigned int checksum = lookahead_checksum();
+  unsigned int fingerprint = lookahead_lm_fingerprint();
+  bool ok = fwrite(lookahead_file_magic, 4, 1, file) == 1
+    && fwrite(header, sizeof(int), 4, file) == 4
+    && fwrite(&checksum, sizeof(checksum), 1, file) == 1
+    && fwrite(&fingerprint, sizeof(fingerprint), 1, file) == 1
+    && fwrite(&header[4], sizeof(int), 1, file) == 1;
+
+  for (int i = 0; ok && i < lists.size(); i++) {
+    const LMLookaheadScoreList &list = *lists[i];
+    assert(list.lm_scores.size() == m_word_repository.size());
+    ok = fwrite(&list.index, sizeof(int), 1, file) == 1
+      && fwrite(&list.uses, sizeof(int), 1, file) == 1
+      && fwrite(&list.min_score, sizeof(float), 1, file) == 1
+      && fwrite(&list.step, sizeof(float), 1, file) == 1
+      && fwrite(&list.lm_scores[0], sizeof(unsigned short),
+                list.lm_scores.size(), file) == list.lm_scores.size();
+  }
+
+  if (fclose(file) != 0 || !ok) {
+    throw IOError("Could not write LM lookahead file.");
+  }
+}
+
+int TokenPassSearch::read_lm_lookahead_scores(const std::string &file_name)
+{
+  FILE *file = fopen(file_name.c_str(), "rb");
+  if (!file) {
+    throw IOError("Could not open LM lookahead file for reading.");
+  }
+
+  char magic[4];
+  int header[5];
+  unsigned int checksum;
+  unsigned int fingerprint;
+  bool ok = fread(magic, 4, 1, file) == 1
+    && fread(header, sizeof(int), 4, file) == 4
+    && fread(&checksum, sizeof(checksum), 1, file) == 1
+    && fread(&fingerprint, sizeof(fingerprint), 1, file) == 1
+    && fread(&header[4], sizeof(int), 1, file) == 1;
+  if (!ok || memcmp(magic, lookahead_file_magic, 4) != 0
+      || header[0] != lookahead_file_version)
+  {
+    fclose(file);
+    throw IOError("Invalid LM lookahead file.");
+  }
+  if (header[1] != m_lm_lookahead || header[2] != (m_lookahead_ngram == NULL)
+      || header[3] != m_word_repository.size()
+      || checksum != lookahead_checksum()
+      || fingerprint != lookahead_lm_fingerprint())
+  {
+    fclose(file);
+    throw IOError("The LM lookahead file does not match the models or the "
+                  "lookahead order.");
+  }
+
+  clear_preloaded_lookahead_scores();
+  int num_lists = header[4];
+  for (int i = 0; i < num_lists; i++) {
+    LMLookaheadScoreList *list = new LMLookaheadScoreList;
+    list->lm_scores.resize(m_word_repository.size());
+    ok = fread(&list->index, sizeof(int), 1, file) == 1
+      && fread(&list->uses, sizeof(int), 1, file) == 1
+      && fread(&list->min_score, sizeof(float), 1, file) == 1
+      && fread(&list->step, sizeof(float), 1, file) == 1
+      && fread(&list->lm_scores[0], sizeof(unsigned short),
+               list->lm_scores.size(), file) == list->lm_scores.size();
+    if (!ok) {
+      delete list;
+      fclose(file);
+      clear_preloaded_lookahead_scores();
+      throw IOError("Could not read LM lookahead file.");
+    }
+    LMLookaheadScoreList *&old = m_preloaded_lookahead_scores[list->index];
+    delete old;
+    old = list;
+  }
+
+  fclose(file);
+  return num_lists;
+}
+
+float TokenPassSearch::max_lookahead_score(
+  const LMLookaheadScoreList &score_list,
+  const TPLexPrefixTree::Node *node) const
+{
+  unsigned short code = 0;
+  for (int i = 0; i < node->possible_word_id_list.size(); i++)
+    code = std::max(code, score_list.lm_scores[node->possible_word_id_list[i]]);
+  return score_list.score(code);
+}
+
+int TokenPassSearch::get_lookahead_context_state(LMHistory *lm_hist)
+{
+  if (lm_hist->lookahead_state < 0) {
+    create_lookahead_context(lm_hist);
+    lm_hist->lookahead_state =
+      m_lookahead_ngram->context_state(m_lookahead_context);
+  }
+  return lm_hist->lookahead_state;
+}
+
+void TokenPassSearch::create_lookahead_context(LMHistory *lm_hist)
+{
+  m_lookahead_context.clear();
+
+  int words_needed = m_lookahead_ngram->order() - 1;
+  if (m_lm_lookahead == 2 && words_needed > 2)
+    words_needed = 2;
+
+  LMHistory::ConstReverseIterator iter = lm_hist->rbegin();
+  while (words_needed > 0) {
+    if (iter->word_id == -1)
+      return;  // Reached the beginning of the history.
+
+    m_lookahead_context.push_front(iter->lookahead_lm_id);
+    --words_needed;
+
+    if (iter->word_id == m_sentence_start_id)
+      return;
+
+    ++iter;
+  }
+}
+
+float TokenPassSearch::get_lm_context_lookahead(int state, LMHistory *lm_hist,
+                                                TPLexPrefixTree::Node *node, int depth)
+{
+#ifdef COUNT_LM_LA_CACHE_MISS
+  lm_la_cache_count[depth]++;
+#endif
+
+  float score;
+  if (node->lm_lookahead_buffer.find(state, &score))
+    return score;
+
+#ifdef COUNT_LM_LA_CACHE_MISS
+  lm_la_cache_miss[depth]++;
+  lm_la_word_cache_count++;
+#endif
+
+  // Not found from cache. Compute the LM scores for every word following the
+  // context state (unless the LM scores have been computed already).
+  LMLookaheadScoreList * score_list = find_lookahead_scores(state);
+  if (score_list == NULL) {
+#ifdef COUNT_LM_LA_CACHE_MISS
+    lm_la_word_cache_miss++;
+#endif
+    if (m_verbose > 2)
+      printf("Compute lm lookahead scores for state %d\n", state);
+    vector<float> extensions;
+    m_lookahead_scores.resize(m_word_repository.size());
+    if (m_lookahead_ngram != NULL) {
+      create_lookahead_context(lm_hist);
+      m_lookahead_ngram->fetch_context_list(m_lookahead_context, extensions);
+
+      // Map lookahead LM IDs to word IDs.
+      for (int i = 0; i < m_word_repository.size(); ++i)
+        m_lookahead_scores[i] =
+          extensions.at(m_word_repository[i].lookahead_lm_id());
+    }
+    else {
+      m_fsa_lm->fetch_probs(state, extensions);
+
+      // Map FSA LM IDs to word IDs. Words that are not in the LM will be
+      // pruned when they are reached anyway.
+      for (int i = 0; i < m_word_repository.size(); ++i) {
+        int lm_id = m_word_repository[i].lm_id();
+        if (lm_id < 0 || extensions.at(lm_id) == FLT_MAX)
+          m_lookahead_scores[i] = -1e10;
+        else
+          m_lookahead_scores[i] = extensions.at(lm_id);
+      }
+    }
+    score_list = cache_lookahead_scores(state);
+  }
+
+  // Compute the lookahead score by selecting the maximum LM score of
+  // possible word ends.
+  score_list->uses++;
+  score = max_lookahead_score(*score_list, node);
+
+  // Add the score to the node's buffer
+  node->lm_lookahead_buffer.insert(state, score, NULL);
+
+  return score;
+}
+
 TPLexPrefixTree::Token*
 TokenPassSearch::acquire_token(void)
 {
@@ -2258,6 +2847,8 @@ TokenPassSearch::acquire_lmhist(const LMHistory::Word * last_word, LMHistory * p
   lmh->printed = false;
   lmh->word_start_frame = 0;
   lmh->word_first_silence_frame=-1;
+  lmh->lookahead_state = -1;
+  lmh->lm_state = -1;
   if (previous) hist::link(lmh->previous);
   return lmh;
 }
@@ -2523,7 +3114,9 @@ void TokenPassSearch::build_word_graph(TPLexPrefixTree::Token *new_token)
   build_word_graph_aux(new_token, new_token->word_history);
 }
 
-void TokenPassSearch::write_word_graph(const std::string &file_name)
+void TokenPassSearch::write_word_graph(const std::string &file_name,
+                                       float posterior_threshold,
+                                       float posterior_scale)
 {
   if (!m_generate_word_graph) {
     throw WordGraphNotGenerated();
@@ -2533,38 +3126,53 @@ void TokenPassSearch::write_word_graph(const std::string &file_name)
   if (!file) {
     throw IOError("Could not open word graph file for writing.");
   }
-  write_word_graph(file);
+  try {
+    write_word_graph(file, posterior_threshold, posterior_scale);
+  }
+  catch (...) {
+    fclose(file);
+    remove(file_name.c_str());
+    throw;
+  }
   fclose(file);
 }
 
-void TokenPassSearch::write_word_graph(FILE *file)
+void TokenPassSearch::write_word_graph(FILE *file, float posterior_threshold,
+                                       float posterior_scale)
 {
+  compact_word_graph();
   const TPLexPrefixTree::Token & best_token = get_best_final_token();
 
-  if (1) {
+  if (posterior_threshold > 0) {
+    mark_probable_word_graph_nodes(best_token.recent_word_graph_node,
+                                   posterior_threshold, posterior_scale);
+    if (!word_graph.nodes[best_token.recent_word_graph_node].reachable) {
+      throw CannotGenerateWordGraph(
+        "The final node of the word graph was pruned by the posterior "
+        "threshold.");
+    }
+  }
+  else {
     word_graph.reset_reachability();
     word_graph.mark_reachable_nodes(best_token.recent_word_graph_node);
   }
-  else
-    word_graph.reset_reachability(true);
 
-  // Count reachable nodes and arcs
+  // Number the reachable nodes consecutively, and count the arcs between
+  // them.
+  std::vector<int> output_id(word_graph.nodes.size(), -1);
   int nodes = 0;
   int arcs = 0;
   for (int n = 0; n < word_graph.nodes.size(); n++) {
-
-    // Print reachable nodes
+    if (word_graph.nodes[n].reachable)
+      output_id[n] = nodes++;
+  }
+  for (int n = 0; n < word_graph.nodes.size(); n++) {
     WordGraph::Node &node = word_graph.nodes[n];
     if (!node.reachable)
       continue;
-
-    nodes++;
-    int a = node.first_arc;
-    while (a >= 0) {
-      arcs++;
-      WordGraph::Arc &arc = word_graph.arcs[a];
-      a = arc.sibling_arc;
-    }
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc)
+      if (output_id[word_graph.arcs[a].source_node_id] >= 0)
+        arcs++;
   }
 
   fprintf(file, "VERSION=1.1\n"
@@ -2572,8 +3180,8 @@ void TokenPassSearch::write_word_graph(FILE *file)
           "dir=f\n"
           "lmscale=%f wdpenalty=%f\n"
           "N=%d\tL=%d\n"
-          "start=0 end=%d\n", m_lm_scale, m_insertion_penalty, nodes, arcs,
-          best_token.recent_word_graph_node);
+          "start=%d end=%d\n", m_lm_scale, m_insertion_penalty, nodes, arcs,
+          output_id[0], output_id[best_token.recent_word_graph_node]);
 
   for (int n = 0; n < word_graph.nodes.size(); n++) {
 
@@ -2582,9 +3190,7 @@ void TokenPassSearch::write_word_graph(FILE *file)
     if (!node.reachable)
       continue;
 
-    //    fprintf(file, "I=%d\tt=%.2f,%d,%d\n", n, node.path_weight, node.frame,
-    //      node.lex_node_id);
-    fprintf(file, "I=%d\tt=%d\n", n, node.frame);
+    fprintf(file, "I=%d\tt=%d\n", output_id[n], node.frame);
   }
 
   int arc_count = 0;
@@ -2598,8 +3204,10 @@ void TokenPassSearch::write_word_graph(FILE *file)
     // Print arcs
     int a = node.first_arc;
     std::string word;
-    while (a >= 0) {
+    for (; a >= 0; a = word_graph.arcs[a].sibling_arc) {
       WordGraph::Arc &arc = word_graph.arcs[a];
+      if (output_id[arc.source_node_id] < 0)
+        continue;
       float am_log_prob = arc.am_weight;
       float lm_log_prob = arc.lm_weight / m_lm_scale
         - m_insertion_penalty;
@@ -2609,11 +3217,643 @@ void TokenPassSearch::write_word_graph(FILE *file)
         word = "!NULL";
 
       fprintf(file, "J=%d\tS=%d\tE=%d\tW=%s\tv=0\ta=%e\tl=%e\n",
-              arc_count++, arc.source_node_id, n, word.c_str(),
-              am_log_prob, lm_log_prob);
-      a = arc.sibling_arc;
+              arc_count++, output_id[arc.source_node_id], output_id[n],
+              word.c_str(), am_log_prob, lm_log_prob);
+    }
+  }
+}
+
+void TokenPassSearch::compact_word_graph()
+{
+  std::vector<int> node_map;
+  word_graph.compact(node_map);
+
+  // Every live node is referenced by a token or by an arc, so the
+  // active tokens are the only outside references that need updating.
+  for (int i = 0; i < m_active_token_list->size(); i++) {
+    TPLexPrefixTree::Token *token = (*m_active_token_list)[i];
+    if (token == NULL || token->recent_word_graph_node < 0)
+      continue;
+    token->recent_word_graph_node = node_map[token->recent_word_graph_node];
+    assert(token->recent_word_graph_node >= 0);
+  }
+
+  // Renumber the nodes stored in the word histories that are still
+  // reachable from the active tokens. The histories are shared, so each one
+  // is visited only once.
+  std::set<TPLexPrefixTree::WordHistory*> visited;
+  for (int i = 0; i < m_active_token_list->size(); i++) {
+    TPLexPrefixTree::Token *token = (*m_active_token_list)[i];
+    if (token == NULL)
+      continue;
+    for (TPLexPrefixTree::WordHistory *history = token->word_history;
+         history != NULL && visited.insert(history).second;
+         history = history->previous)
+    {
+      if (history->graph_node_id >= 0)
+        history->graph_node_id = node_map[history->graph_node_id];
+    }
+  }
+
+  // Forget the nodes that have been freed since they were created.
+  for (int w = 0; w < m_recent_word_graph_info.size(); w++) {
+    std::vector<WordGraphInfo::Item> &items = m_recent_word_graph_info[w].items;
+    int j = 0;
+    for (int i = 0; i < items.size(); i++) {
+      if (node_map[items[i].graph_node_id] < 0)
+        continue;
+      items[j] = items[i];
+      items[j].graph_node_id = node_map[items[i].graph_node_id];
+      j++;
+    }
+    items.resize(j);
+  }
+}
+
+namespace {
+
+// Adds two log10 probabilities.
+inline float add_log10(float a, float b)
+{
+  if (a < b)
+    std::swap(a, b);
+  if (b == -FLT_MAX)
+    return a;
+  return a + log10(1 + pow(10, b - a));
+}
+
+}
+
+void TokenPassSearch::freeze_histories()
+{
+  std::vector<TPLexPrefixTree::WordHistory*> word_heads;
+  std::vector<TPLexPrefixTree::StateHistory*> state_heads;
+  for (int i = 0; i < m_active_token_list->size(); i++) {
+    TPLexPrefixTree::Token *token = (*m_active_token_list)[i];
+    if (token == NULL)
+      continue;
+    word_heads.push_back(token->word_history);
+    state_heads.push_back(token->state_history);
+  }
+
+  // The structures before the first new one have been written already.
+  size_t first = m_frozen_word_history.size();
+  if (hist::freeze(word_heads, m_frozen_word_history) != NULL) {
+    for (size_t i = first; i < m_frozen_word_history.size(); i++) {
+      TPLexPrefixTree::WordHistory &history = m_frozen_word_history[i];
+      if (m_frozen_word_history_file != NULL && history.word_id >= 0
+          && !history.printed)
+        write_word_history_entry(m_frozen_word_history_file, &history);
+    }
+    if (m_frozen_word_history_file != NULL)
+      fflush(m_frozen_word_history_file);
+    hist::release_frozen(m_frozen_word_history);
+  }
+
+  // A state ends where the next one starts.  The first state of the
+  // chains is not a segment.
+  FILE *state_file = m_frozen_state_history_file;
+  if (state_file == NULL && m_print_state_segmentation)
+    state_file = stdout;
+  first = m_frozen_state_history.size();
+  TPLexPrefixTree::StateHistory *next =
+    hist::freeze(state_heads, m_frozen_state_history);
+  if (next != NULL) {
+    for (size_t i = first; state_file != NULL
+           && i < m_frozen_state_history.size(); i++)
+    {
+      TPLexPrefixTree::StateHistory &state = m_frozen_state_history[i];
+      if (state.previous == NULL)
+        continue;
+      int end_time = i + 1 < m_frozen_state_history.size() ?
+        m_frozen_state_history[i + 1].start_time : next->start_time;
+      fprintf(state_file, "%i %i %i\n", state.start_time, end_time,
+              state.hmm_model);
     }
+    if (state_file != NULL)
+      fflush(state_file);
+    hist::release_frozen(m_frozen_state_history);
+  }
+}
+
+void TokenPassSearch::compute_word_graph_posteriors(
+  int final_node, float scale, std::vector<int> &order,
+  std::vector<float> &arc_posteriors)
+{
+  word_graph.topological_order(final_node, order);
+
+  // Forward and backward log probabilities of the nodes.
+  std::vector<float> alpha(word_graph.nodes.size(), -FLT_MAX);
+  std::vector<float> beta(word_graph.nodes.size(), -FLT_MAX);
+  for (int i = 0; i < order.size(); i++) {
+    WordGraph::Node &node = word_graph.nodes[order[i]];
+    if (order[i] == 0)
+      alpha[order[i]] = 0;
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      const WordGraph::Arc &arc = word_graph.arcs[a];
+      alpha[order[i]] = add_log10(alpha[order[i]],
+        alpha[arc.source_node_id]
+        + scale * (arc.am_weight + arc.lm_weight));
+    }
+  }
+  beta[final_node] = 0;
+  for (int i = order.size() - 1; i >= 0; i--) {
+    WordGraph::Node &node = word_graph.nodes[order[i]];
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      const WordGraph::Arc &arc = word_graph.arcs[a];
+      beta[arc.source_node_id] = add_log10(beta[arc.source_node_id],
+        beta[order[i]] + scale * (arc.am_weight + arc.lm_weight));
+    }
+  }
+
+  float total = alpha[final_node];
+  arc_posteriors.assign(word_graph.arcs.size(), 0);
+  for (int i = 0; i < order.size(); i++) {
+    WordGraph::Node &node = word_graph.nodes[order[i]];
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      const WordGraph::Arc &arc = word_graph.arcs[a];
+      arc_posteriors[a] = pow(10, alpha[arc.source_node_id]
+                              + scale * (arc.am_weight + arc.lm_weight)
+                              + beta[order[i]] - total);
+    }
+  }
+}
+
+void TokenPassSearch::mark_probable_word_graph_nodes(int final_node,
+                                                     float threshold,
+                                                     float scale)
+{
+  std::vector<int> order;
+  std::vector<float> arc_posteriors;
+  compute_word_graph_posteriors(final_node, scale, order, arc_posteriors);
+
+  // The posterior of a node is the sum of the posteriors of its incoming
+  // arcs. Keep the nodes that can be reached from the start node (node 0)
+  // through probable nodes.
+  std::vector<char> forward(word_graph.nodes.size(), 0);
+  for (int i = 0; i < order.size(); i++) {
+    WordGraph::Node &node = word_graph.nodes[order[i]];
+    if (order[i] == 0) {
+      forward[order[i]] = 1;
+      continue;
+    }
+    float posterior = 0;
+    bool connected = false;
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      posterior += arc_posteriors[a];
+      if (forward[word_graph.arcs[a].source_node_id])
+        connected = true;
+    }
+    forward[order[i]] = connected && posterior >= threshold;
+  }
+
+  // Of those, keep the ones that lead to the final node.
+  word_graph.reset_reachability();
+  if (!forward[final_node])
+    return;
+  word_graph.nodes[final_node].reachable = true;
+  for (int i = order.size() - 1; i >= 0; i--) {
+    WordGraph::Node &node = word_graph.nodes[order[i]];
+    if (!node.reachable)
+      continue;
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      int source = word_graph.arcs[a].source_node_id;
+      if (forward[source])
+        word_graph.nodes[source].reachable = true;
+    }
+  }
+}
+
+bool TokenPassSearch::get_nbest(int n, std::vector<Hypothesis> &result,
+                                int max_expansions)
+{
+  if (!m_generate_word_graph) {
+    throw WordGraphNotGenerated();
   }
+
+  return get_word_graph_nbest(get_best_final_token().recent_word_graph_node,
+                              n, result, max_expansions);
+}
+
+bool TokenPassSearch::get_word_graph_nbest(int final_node, int n,
+                                           std::vector<Hypothesis> &result,
+                                           int max_expansions)
+{
+  result.clear();
+
+  // The best path scores from the start node are the exact heuristic for
+  // the backward A* search.
+  std::vector<int> order;
+  word_graph.topological_order(final_node, order);
+  std::vector<float> forward(word_graph.nodes.size(), -FLT_MAX);
+  for (int i = 0; i < order.size(); i++) {
+    WordGraph::Node &node = word_graph.nodes[order[i]];
+    if (order[i] == 0)
+      forward[order[i]] = 0;
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      const WordGraph::Arc &arc = word_graph.arcs[a];
+      float score = forward[arc.source_node_id] + arc.am_weight
+        + arc.lm_weight;
+      if (score > forward[order[i]])
+        forward[order[i]] = score;
+    }
+  }
+
+  // Partial paths from a node to the final node. The arc is the one
+  // leaving the node towards the previous path.
+  struct PartialPath
+  {
+    int node;
+    int arc;
+    int previous;
+    float score;
+  };
+  std::vector<PartialPath> paths;
+  std::vector<std::pair<float, int> > queue;
+  std::set<std::vector<int> > found;
+
+  PartialPath path = { final_node, -1, -1, 0 };
+  paths.push_back(path);
+  queue.push_back(std::make_pair(forward[final_node], 0));
+
+  int expansions = 0;
+  while (!queue.empty() && result.size() < n) {
+    // Limit the work when the paths differ only by segmentation.
+    if (max_expansions >= 0 && expansions++ >= max_expansions)
+      return false;
+    std::pop_heap(queue.begin(), queue.end());
+    int index = queue.back().second;
+    queue.pop_back();
+    path = paths[index];
+
+    if (path.node == 0) {
+      // Reached the start node, collect the words.
+      Hypothesis hypo;
+      hypo.am_log_prob = 0;
+      hypo.lm_log_prob = 0;
+      hypo.total_log_prob = path.score;
+      for (int p = index; paths[p].previous >= 0; p = paths[p].previous) {
+        const WordGraph::Arc &arc = word_graph.arcs[paths[p].arc];
+        const WordGraph::Node &target =
+          word_graph.nodes[paths[paths[p].previous].node];
+        hypo.am_log_prob += arc.am_weight;
+        hypo.lm_log_prob += arc.lm_weight / m_lm_scale;
+        if (target.symbol != m_sentence_start_id &&
+            target.symbol != m_sentence_end_id) {
+          hypo.word_ids.push_back(target.symbol);
+          hypo.end_frames.push_back(target.frame);
+        }
+      }
+      if (found.insert(hypo.word_ids).second)
+        result.push_back(hypo);
+      continue;
+    }
+
+    WordGraph::Node &node = word_graph.nodes[path.node];
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      const WordGraph::Arc &arc = word_graph.arcs[a];
+      if (forward[arc.source_node_id] == -FLT_MAX)
+        continue;
+      PartialPath new_path;
+      new_path.node = arc.source_node_id;
+      new_path.arc = a;
+      new_path.previous = index;
+      new_path.score = path.score + arc.am_weight + arc.lm_weight;
+      paths.push_back(new_path);
+      queue.push_back(std::make_pair(
+        new_path.score + forward[new_path.node], (int)paths.size() - 1));
+      std::push_heap(queue.begin(), queue.end());
+    }
+  }
+  return true;
+}
+
+void TokenPassSearch::write_nbest(const std::string &file_name, int n,
+                                  int max_expansions)
+{
+  if (!m_generate_word_graph) {
+    throw WordGraphNotGenerated();
+  }
+
+  FILE *file = fopen(file_name.c_str(), "w");
+  if (!file) {
+    throw IOError("Could not open N-best file for writing.");
+  }
+  write_nbest(file, n, max_expansions);
+  fclose(file);
+}
+
+void TokenPassSearch::write_nbest(FILE *file, int n, int max_expansions)
+{
+  std::vector<Hypothesis> nbest;
+  if (!get_nbest(n, nbest, max_expansions)) {
+    cerr << "Warning: N-best search stopped after " << max_expansions
+         << " expansions with " << nbest.size() << " paths." << endl;
+  }
+  for (int i = 0; i < nbest.size(); i++) {
+    fprintf(file, "%.3f\t%.3f\t%.3f\t", nbest[i].total_log_prob,
+            nbest[i].am_log_prob, nbest[i].lm_log_prob);
+    for (int j = 0; j < nbest[i].word_ids.size(); j++)
+      fprintf(file, "%s ", m_vocabulary.word(nbest[i].word_ids[j]).c_str());
+    fprintf(file, "\n");
+  }
+  fflush(file);
+}
+
+void TokenPassSearch::get_confusion_network(std::vector<ConfusionSet> &result,
+                                            float posterior_scale)
+{
+  if (!m_generate_word_graph) {
+    throw WordGraphNotGenerated();
+  }
+
+  get_word_graph_confusion_network(
+    get_best_final_token().recent_word_graph_node, result, posterior_scale);
+}
+
+void TokenPassSearch::get_word_graph_confusion_network(
+  int final_node, std::vector<ConfusionSet> &result, float posterior_scale)
+{
+  result.clear();
+  std::vector<int> order;
+  std::vector<float> posteriors;
+  compute_word_graph_posteriors(final_node, posterior_scale, order,
+                                posteriors);
+
+  // Find the best path for the pivots, following the best incoming arcs.
+  std::vector<float> forward(word_graph.nodes.size(), -FLT_MAX);
+  std::vector<int> best_arc(word_graph.nodes.size(), -1);
+  for (int i = 0; i < order.size(); i++) {
+    WordGraph::Node &node = word_graph.nodes[order[i]];
+    if (order[i] == 0)
+      forward[order[i]] = 0;
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      const WordGraph::Arc &arc = word_graph.arcs[a];
+      if (forward[arc.source_node_id] == -FLT_MAX)
+        continue;
+      float score = forward[arc.source_node_id] + arc.am_weight
+        + arc.lm_weight;
+      if (score > forward[order[i]]) {
+        forward[order[i]] = score;
+        best_arc[order[i]] = a;
+      }
+    }
+  }
+  std::vector<int> pivot_start, pivot_end;
+  for (int n = final_node; best_arc[n] >= 0;
+       n = word_graph.arcs[best_arc[n]].source_node_id) {
+    const WordGraph::Node &node = word_graph.nodes[n];
+    if (node.symbol == m_sentence_start_id || node.symbol == m_sentence_end_id)
+      continue;
+    pivot_start.push_back(
+      word_graph.nodes[word_graph.arcs[best_arc[n]].source_node_id].frame);
+    pivot_end.push_back(node.frame);
+  }
+  std::reverse(pivot_start.begin(), pivot_start.end());
+  std::reverse(pivot_end.begin(), pivot_end.end());
+  if (pivot_start.empty())
+    return;
+
+  // Align every arc to the pivot that contains its midpoint, or the nearest
+  // pivot. The midpoints increase along a path, so the words of one path
+  // fall into a slot consecutively, but several of them can share a slot.
+  result.resize(pivot_start.size());
+  for (int i = 0; i < order.size(); i++) {
+    const WordGraph::Node &node = word_graph.nodes[order[i]];
+    if (node.symbol < 0 || node.symbol == m_sentence_start_id ||
+        node.symbol == m_sentence_end_id)
+      continue;
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      int start = word_graph.nodes[word_graph.arcs[a].source_node_id].frame;
+      // Compare twice the frames to keep the midpoint integral.
+      int midpoint = start + node.frame;
+      int slot = 0;
+      int best_distance = INT_MAX;
+      for (int p = 0; p < pivot_start.size(); p++) {
+        int distance = 0;
+        if (midpoint < 2 * pivot_start[p])
+          distance = 2 * pivot_start[p] - midpoint;
+        else if (midpoint >= 2 * pivot_end[p])
+          distance = midpoint - 2 * pivot_end[p] + 1;
+        if (distance < best_distance) {
+          best_distance = distance;
+          slot = p;
+        }
+      }
+
+      ConfusionSet &set = result[slot];
+      int j;
+      for (j = 0; j < set.size(); j++)
+        if (set[j].word_id == node.symbol)
+          break;
+      if (j == set.size()) {
+        ConfusionItem item;
+        item.word_id = node.symbol;
+        item.posterior = 0;
+        item.start_frame = start;
+        item.end_frame = node.frame;
+        set.push_back(item);
+      }
+      set[j].posterior += posteriors[a];
+      if (start < set[j].start_frame)
+        set[j].start_frame = start;
+      if (node.frame > set[j].end_frame)
+        set[j].end_frame = node.frame;
+    }
+  }
+
+  for (int s = 0; s < result.size(); s++) {
+    ConfusionSet &set = result[s];
+    float total = 0;
+    for (int j = 0; j < set.size(); j++)
+      total += set[j].posterior;
+    // The words of a path that share a slot are counted more than once, so
+    // the sum can exceed one. Normalize the slot in that case.
+    if (total > 1) {
+      for (int j = 0; j < set.size(); j++)
+        set[j].posterior /= total;
+    }
+    // Ignore rounding errors in the sum.
+    else if (total < 0.999) {
+      ConfusionItem item;
+      item.word_id = -1;
+      item.posterior = 1 - total;
+      item.start_frame = pivot_start[s];
+      item.end_frame = pivot_end[s];
+      set.push_back(item);
+    }
+    for (int j = 1; j < set.size(); j++) {
+      ConfusionItem item = set[j];
+      int k;
+      for (k = j; k > 0 && set[k - 1].posterior < item.posterior; k--)
+        set[k] = set[k - 1];
+      set[k] = item;
+    }
+  }
+}
+
+void TokenPassSearch::write_confusion_network(const std::string &file_name,
+                                              float posterior_scale)
+{
+  if (!m_generate_word_graph) {
+    throw WordGraphNotGenerated();
+  }
+
+  FILE *file = fopen(file_name.c_str(), "w");
+  if (!file) {
+    throw IOError("Could not open confusion network file for writing.");
+  }
+  write_confusion_network(file, posterior_scale);
+  fclose(file);
+}
+
+void TokenPassSearch::write_confusion_network(FILE *file,
+                                              float posterior_scale)
+{
+  std::vector<ConfusionSet> network;
+  get_confusion_network(network, posterior_scale);
+  fprintf(file, "numaligns %zd\n"
+          "posterior 1\n", network.size());
+  for (int s = 0; s < network.size(); s++) {
+    fprintf(file, "align %d", s);
+    for (int j = 0; j < network[s].size(); j++) {
+      const ConfusionItem &item = network[s][j];
+      fprintf(file, " %s %g", item.word_id < 0 ? "*DELETE*"
+              : m_vocabulary.word(item.word_id).c_str(), item.posterior);
+    }
+    fprintf(file, "\n");
+  }
+  fflush(file);
+}
+
+void TokenPassSearch::rescore_word_graph(Hypothesis &result)
+{
+  if (!m_generate_word_graph) {
+    throw WordGraphNotGenerated();
+  }
+  if (m_rescoring_ngram == NULL) {
+    throw InvalidSetup("Rescoring language model has not been set.");
+  }
+
+  float lm_scale = m_rescoring_lm_scale < 0 ? m_lm_scale : m_rescoring_lm_scale;
+  int final_node = get_best_final_token().recent_word_graph_node;
+  std::vector<int> order;
+  word_graph.topological_order(final_node, order);
+
+  // Word graph nodes expanded by the LM context. The arc is the one that
+  // leads to the node from the previous entry.
+  struct Entry
+  {
+    int node;
+    int arc;
+    int previous;
+    float am_log_prob;
+    float lm_log_prob;
+    float total_log_prob;
+    NGram::Gram context;
+  };
+  std::vector<Entry> entries;
+  std::vector<std::map<std::vector<int>, int> > node_entries(
+    word_graph.nodes.size());
+  bool use_states = m_rescoring_ngram->supports_context_states();
+  int max_context = m_rescoring_ngram->order() - 1;
+  NGram::Gram gram;
+  std::vector<int> key;
+
+  for (int i = 0; i < order.size(); i++) {
+    int n = order[i];
+    const WordGraph::Node &node = word_graph.nodes[n];
+    if (n == 0) {
+      Entry entry = { n, -1, -1, 0, 0, 0, NGram::Gram() };
+      node_entries[n][std::vector<int>()] = entries.size();
+      entries.push_back(entry);
+      continue;
+    }
+
+    for (int a = node.first_arc; a >= 0; a = word_graph.arcs[a].sibling_arc) {
+      const WordGraph::Arc &arc = word_graph.arcs[a];
+      const std::map<std::vector<int>, int> &sources =
+        node_entries[arc.source_node_id];
+      std::map<std::vector<int>, int>::const_iterator it;
+      for (it = sources.begin(); it != sources.end(); ++it) {
+        const Entry &source = entries[it->second];
+        gram = source.context;
+        float lm_log_prob = 0;
+        if (node.symbol == m_sentence_start_id) {
+          gram.clear();
+          gram.push_back(m_rescoring_lm_ids[node.symbol]);
+        }
+        else if (node.symbol >= 0) {
+          gram.push_back(m_rescoring_lm_ids[node.symbol]);
+          lm_log_prob = m_rescoring_ngram->log_prob(gram)
+            + m_word_repository[node.symbol].cm_log_prob()
+            + m_insertion_penalty;
+        }
+        while (gram.size() > max_context)
+          gram.pop_front();
+
+        key.clear();
+        if (use_states)
+          key.push_back(m_rescoring_ngram->context_state(gram));
+        else
+          key.assign(gram.begin(), gram.end());
+
+        Entry entry;
+        entry.node = n;
+        entry.arc = a;
+        entry.previous = it->second;
+        entry.am_log_prob = source.am_log_prob + arc.am_weight;
+        entry.lm_log_prob = source.lm_log_prob + lm_log_prob;
+        entry.total_log_prob = source.total_log_prob + arc.am_weight
+          + lm_scale * lm_log_prob;
+        entry.context = gram;
+
+        std::pair<std::map<std::vector<int>, int>::iterator, bool> ins =
+          node_entries[n].insert(std::make_pair(key, (int)entries.size()));
+        if (ins.second)
+          entries.push_back(entry);
+        else if (entry.total_log_prob
+                 > entries[ins.first->second].total_log_prob)
+          entries[ins.first->second] = entry;
+      }
+    }
+
+  }
+
+  int best = -1;
+  std::map<std::vector<int>, int>::const_iterator it;
+  for (it = node_entries[final_node].begin();
+       it != node_entries[final_node].end(); ++it) {
+    if (best < 0
+        || entries[it->second].total_log_prob > entries[best].total_log_prob)
+      best = it->second;
+  }
+  assert(best >= 0);
+
+  result.word_ids.clear();
+  result.end_frames.clear();
+  result.am_log_prob = entries[best].am_log_prob;
+  result.lm_log_prob = entries[best].lm_log_prob;
+  result.total_log_prob = entries[best].total_log_prob;
+  for (int e = best; entries[e].previous >= 0; e = entries[e].previous) {
+    const WordGraph::Node &node = word_graph.nodes[entries[e].node];
+    if (node.symbol == m_sentence_start_id || node.symbol == m_sentence_end_id)
+      continue;
+    result.word_ids.push_back(node.symbol);
+    result.end_frames.push_back(node.frame);
+  }
+  std::reverse(result.word_ids.begin(), result.word_ids.end());
+  std::reverse(result.end_frames.begin(), result.end_frames.end());
+}
+
+void TokenPassSearch::print_rescored_result(FILE *file)
+{
+  Hypothesis hypo;
+  rescore_word_graph(hypo);
+  for (int i = 0; i < hypo.word_ids.size(); i++)
+    fprintf(file, "%s ", m_vocabulary.word(hypo.word_ids[i]).c_str());
+  fprintf(file, "\n");
+  fflush(file);
 }
 
 // void
@@ -2,7 +2,9 @@
 #define TOKENPASSSEARCH_HH
 
 #include <stdexcept>
+#include <deque>
 #include <vector>
+#include <map>
 #include <cmath>
 
 #include "config.hh"
@@ -69,6 +71,9 @@ public:
   /// Clears the active token list and adds one token that refers to
   /// \ref m_lexicon.start_node().
   ///
+  /// \exception InvalidSetup If the lookahead settings do not fit the
+  /// language models or the acoustics.
+  ///
   void reset_search(int start_frame);
   void set_end_frame(int end_frame) { m_end_frame = end_frame; }
 
@@ -154,6 +159,30 @@ public:
   void set_fan_in_beam(float beam) { m_fan_in_beam = beam; }
   void set_fan_out_beam(float beam) { m_fan_out_beam = beam; }
   void set_state_beam(float beam) { m_state_beam = beam; }
+
+  /// \brief Enables acoustic lookahead pruning at word starts.
+  ///
+  /// When a token enters the first state of a word, the acoustic scores of
+  /// the next \a frames frames are used to estimate how well the first
+  /// phone can match: for each frame, the best score among the states of
+  /// the phone is compared to the best score of any state.  The estimate,
+  /// multiplied by \a scale, is added to the token score for the global
+  /// beam test only, so that poor word-start branches are pruned before
+  /// they multiply.
+  ///
+  /// Requires acoustics that can read ahead, e.g. an LNA reader whose
+  /// buffer holds more than \a frames frames.
+  ///
+  /// \param frames Number of frames to look ahead, 0 disables (default).
+  /// \param scale Weight of the estimate.
+  /// reset_search() throws InvalidSetup if \a frames is positive and the
+  /// acoustics cannot read ahead (e.g. OneFrameAcoustics).
+  ///
+  void set_acoustic_lookahead(int frames, float scale = 1)
+  {
+    m_acoustic_lookahead_frames = frames;
+    m_acoustic_lookahead_scale = scale;
+  }
   
   void set_similar_lm_history_span(int n) { m_similar_lm_hist_span = n; }
   void set_lm_scale(float lm_scale) { m_lm_scale = lm_scale; }
@@ -161,6 +190,14 @@ public:
   void set_transition_scale(float trans_scale) { m_transition_scale = trans_scale; }
   void set_max_num_tokens(int tokens) { m_max_num_tokens = tokens; }
 
+  float get_global_beam() const { return m_global_beam; }
+  float get_word_end_beam() const { return m_word_end_beam; }
+  float get_state_beam() const { return m_state_beam; }
+  float get_lm_scale() const { return m_lm_scale; }
+  float get_duration_scale() const { return m_duration_scale; }
+  float get_transition_scale() const { return m_transition_scale; }
+  int get_max_num_tokens() const { return m_max_num_tokens; }
+
 #ifdef ENABLE_MULTIWORD_SUPPORT
   void set_split_multiwords(bool value)
   {
@@ -170,6 +207,7 @@ public:
 
   void set_print_probs(bool value) { m_print_probs = value; }
   void set_print_text_result(int print) { m_print_text_result = print; }
+  int get_print_text_result() const { return m_print_text_result; }
   void set_print_state_segmentation(int print) 
   { 
     m_print_state_segmentation = print; 
@@ -179,6 +217,38 @@ public:
   {
     m_keep_state_segmentation = value;
   }
+
+  /// \brief Sets how often (in frames) the history common to all active
+  /// tokens is frozen.
+  ///
+  /// Freezing writes the converged prefix of the word and state histories
+  /// into the files given with set_frozen_history_files() and releases it,
+  /// keeping only the newest frozen entry of each history as the start of
+  /// the chains.  This keeps the memory used for the histories bounded on
+  /// very long utterances.  The histories written at the end of the
+  /// utterance start after the frozen part.  Zero (the default) disables
+  /// freezing.
+  ///
+  void set_history_freeze_interval(int frames)
+  {
+    m_history_freeze_interval = frames;
+  }
+
+  /// \brief Sets the files where the frozen histories are written.
+  ///
+  /// The frozen words are written to \a word_file as by
+  /// write_word_history(), and the frozen state segments to \a state_file
+  /// as by print_state_history(), so writing the rest of the utterance to
+  /// the same files at the end gives the complete result.  If \a
+  /// state_file is NULL and the state segmentation is printed, the frozen
+  /// segments are written to stdout.  Otherwise the frozen histories that
+  /// have no file are discarded.
+  ///
+  void set_frozen_history_files(FILE *word_file, FILE *state_file)
+  {
+    m_frozen_word_history_file = word_file;
+    m_frozen_state_history_file = state_file;
+  }
   void set_verbose(int verbose) { m_verbose = verbose; }
 
   /// \brief Sets the word that represents word boundary.
@@ -198,11 +268,59 @@ public:
   ///
   /// Can be enabled only before reading the lexicon.
   ///
-  /// \param order 0=None, 1=Only in first subtree nodes, 2=Full.
+  /// \param order 0=None, 1=Bigram, 2=Trigram, 3=Full order of the
+  /// lookahead LM. With 3, the scores are cached by the context state of the
+  /// lookahead LM, and the FSA LM is used if no lookahead n-gram is set.
+  /// Changing the order discards the cached and preloaded score lists.
   ///
-  void set_lm_lookahead(int order) { m_lm_lookahead = order; }
+  void set_lm_lookahead(int order)
+  {
+    m_lm_lookahead = order;
+    m_lm_lookahead_initialized = false;
+    clear_preloaded_lookahead_scores();
+  }
+
+  /// \brief Sets the memory (in bytes) used for caching the lookahead
+  /// scores of whole vocabularies.
+  ///
+  /// The number of cached contexts is derived from the vocabulary size
+  /// when the search is reset for the first time. The default, 0, uses as
+  /// much memory as 512 lists of full precision scores.
+  ///
+  void set_lm_lookahead_cache_memory(size_t bytes)
+  {
+    m_lookahead_score_list_memory = bytes;
+  }
+
+  /// \brief Writes the most used lookahead score lists to a file.
+  ///
+  /// The cached lists and the lists read by read_lm_lookahead_scores() are
+  /// written in the order of how many times they have been used. A decoder
+  /// with the same lexicon, lookahead LM and lookahead order can read the
+  /// file at start-up instead of computing the frequent contexts again.
+  ///
+  /// \param max_lists The maximum number of lists to write, 0 for all.
+  /// \exception IOError If unable to write the file.
+  ///
+  void write_lm_lookahead_scores(const std::string &file_name,
+                                 int max_lists = 0);
+
+  /// \brief Reads lookahead score lists written by
+  /// write_lm_lookahead_scores().
+  ///
+  /// Must be called after the language models have been set. The lists are
+  /// kept in addition to the cache, and are not evicted, until the language
+  /// models are changed.
+  ///
+  /// \return The number of lists read.
+  /// \exception IOError If unable to read the file, or if it was written
+  /// with a different vocabulary, lookahead LM or lookahead order. The LM
+  /// is compared by its order, gram counts and a sample of probabilities.
+  ///
+  int read_lm_lookahead_scores(const std::string &file_name);
 
   void set_insertion_penalty(float ip) { m_insertion_penalty = ip; }
+  float get_insertion_penalty() const { return m_insertion_penalty; }
 
   void set_require_sentence_end(bool s) { m_require_sentence_end = s; }
 
@@ -256,6 +374,26 @@ public:
   ///
   int set_lookahead_ngram(NGram *ngram);
 
+  /// \brief Sets an n-gram language model for rescoring the word graph
+  /// after decoding, see rescore_word_graph().
+  ///
+  /// The model is not owned by the search, so one model can be loaded once
+  /// and used for every utterance. Recreates the word repository, like
+  /// set_lookahead_ngram().
+  ///
+  /// \return The number of vocabulary entries that were not found in the
+  /// language models.
+  ///
+  int set_rescoring_ngram(NGram *ngram);
+
+  /// \brief Sets the LM scale of the rescoring. A negative value (the
+  /// default) uses the scale of the first pass.
+  ///
+  void set_rescoring_lm_scale(float scale)
+  {
+    m_rescoring_lm_scale = scale;
+  }
+
   /// \brief If set to true, generates a word graph of the hypotheses during
   /// decoding (requires memory).
   ///
@@ -281,11 +419,39 @@ public:
     m_use_word_pair_approximation = value;
   }
 
+  /// \brief Sets how often (in frames) the word graph is compacted during
+  /// decoding.
+  ///
+  /// Compaction renumbers the live nodes and arcs into dense arrays, so
+  /// that the memory used by the graph stays proportional to the
+  /// surviving lattice.  It is done only when at least half of the node
+  /// slots are free.  Zero disables compaction during decoding.  The
+  /// default is 100.
+  ///
+  void set_word_graph_compaction_interval(int frames)
+  {
+    m_word_graph_compaction_interval = frames;
+  }
+
   void set_use_lm_cache(bool value)
   {
     m_use_lm_cache = value;
   }
 
+  /// \brief Enables or disables recombining tokens by the context state of
+  /// the n-gram language model.
+  ///
+  /// When enabled, two LM histories are considered similar if the language
+  /// model backs off to the same context after them, instead of comparing
+  /// the last m_similar_lm_hist_span words. When generating a word graph,
+  /// the last words have to match too. FSA language models always recombine
+  /// by their state.
+  ///
+  void set_use_lm_state_recombination(bool value)
+  {
+    m_use_lm_state_recombination = value;
+  }
+
   int frame(void)
   {
     return m_frame;
@@ -294,11 +460,138 @@ public:
   /// \brief Writes nodes and arcs from word_graph to a Standard Lattice
   /// Format file.
   ///
+  /// If \a posterior_threshold is positive, the word graph is pruned like
+  /// SRILM lattice-tool -posterior-prune: the posterior probabilities of the
+  /// nodes are computed with the forward-backward algorithm, scaling the log
+  /// probabilities by \a posterior_scale, and the nodes whose posterior is
+  /// below the threshold are left out together with their arcs. Nodes that
+  /// are not on a path from the start node to the end node after pruning are
+  /// left out too.
+  ///
+  /// \exception WordGraphNotGenerated If word graph has not been generated.
+  /// \exception CannotGenerateWordGraph If the end node is pruned. Nothing
+  /// is written then.
+  /// \exception IOError If unable to write the file.
+  ///
+  void write_word_graph(const std::string &file_name,
+                        float posterior_threshold = 0,
+                        float posterior_scale = 1);
+  void write_word_graph(FILE *file, float posterior_threshold = 0,
+                        float posterior_scale = 1);
+
+  /// \brief A path through the word graph.
+  struct Hypothesis
+  {
+    std::vector<int> word_ids; ///< Words, without sentence boundaries.
+    std::vector<int> end_frames; ///< The end frame of each word.
+    float am_log_prob; ///< Sum of the acoustic log probabilities.
+    /// Sum of the language model log probabilities of the words and the
+    /// sentence end, each including the insertion penalty, before
+    /// multiplying by the LM scale.
+    float lm_log_prob;
+    float total_log_prob; ///< \a am_log_prob + LM scale * \a lm_log_prob.
+  };
+
+  /// \brief A word in a confusion network slot.
+  struct ConfusionItem
+  {
+    int word_id; ///< -1 for an empty word (deletion).
+    float posterior;
+    int start_frame;
+    int end_frame;
+  };
+  typedef std::vector<ConfusionItem> ConfusionSet;
+
+  /// \brief Finds the \a n best distinct word sequences from the word graph.
+  ///
+  /// The paths are searched backwards from the final node of the best
+  /// token using A* search, with the best path score from the start node as
+  /// the heuristic, so they are found in the order of their total log
+  /// probability. Paths with the same words but different segmentation
+  /// count only once.
+  ///
+  /// \param max_expansions The search stops after expanding this many
+  /// partial paths, which limits the work when the paths differ only by
+  /// segmentation. Negative means no limit.
+  /// \return False if the search stopped at \a max_expansions before
+  /// finding \a n paths or all the paths.
+  ///
+  /// \exception WordGraphNotGenerated If word graph has not been generated.
+  ///
+  bool get_nbest(int n, std::vector<Hypothesis> &result,
+                 int max_expansions = 100000);
+
+  /// \brief Finds the \a n best distinct word sequences from the start node
+  /// of the word graph to \a final_node, as get_nbest().
+  ///
+  bool get_word_graph_nbest(int final_node, int n,
+                            std::vector<Hypothesis> &result,
+                            int max_expansions = 100000);
+
+  /// \brief Writes the \a n best hypotheses, one per line: the total, AM
+  /// and LM log probabilities followed by the words. A warning is printed
+  /// if the search stops at \a max_expansions.
+  ///
   /// \exception WordGraphNotGenerated If word graph has not been generated.
   /// \exception IOError If unable to write the file.
   ///
-  void write_word_graph(const std::string &file_name);
-  void write_word_graph(FILE *file);
+  void write_nbest(const std::string &file_name, int n,
+                   int max_expansions = 100000);
+  void write_nbest(FILE *file, int n, int max_expansions = 100000);
+
+  /// \brief Builds a confusion network from the word graph.
+  ///
+  /// Computes the posterior probability of every word graph arc with the
+  /// forward-backward algorithm, scaling the log probabilities by
+  /// \a posterior_scale. The words of the best path are used as pivots: every
+  /// arc is added to the one slot whose pivot word contains the midpoint of
+  /// the arc in time, or is nearest to it, and the posteriors of the same
+  /// word are summed. A slot whose posteriors sum over one, because a path
+  /// has several words in it, is normalized; otherwise the remaining
+  /// probability mass of the slot is given to an empty word. Each slot is
+  /// sorted by decreasing posterior.
+  ///
+  /// \exception WordGraphNotGenerated If word graph has not been generated.
+  ///
+  void get_confusion_network(std::vector<ConfusionSet> &result,
+                             float posterior_scale = 1);
+
+  /// \brief Builds a confusion network from the paths of the word graph
+  /// that lead from the start node to \a final_node, as
+  /// get_confusion_network().
+  ///
+  void get_word_graph_confusion_network(int final_node,
+                                        std::vector<ConfusionSet> &result,
+                                        float posterior_scale = 1);
+
+  /// \brief Writes the confusion network in the SRILM text format, with
+  /// *DELETE* as the empty word.
+  ///
+  /// \exception WordGraphNotGenerated If word graph has not been generated.
+  /// \exception IOError If unable to write the file.
+  ///
+  void write_confusion_network(const std::string &file_name,
+                               float posterior_scale = 1);
+  void write_confusion_network(FILE *file, float posterior_scale = 1);
+
+  /// \brief Finds the best path through the word graph using the rescoring
+  /// language model instead of the LM weights of the first pass.
+  ///
+  /// The word graph nodes are expanded on the fly by the LM context, so
+  /// the result is exact for any n-gram order. If the model supports context
+  /// states, contexts that back off to the same state are recombined. The
+  /// acoustic weights, the insertion penalty and the word class membership
+  /// probabilities are kept. Multiwords are scored as whole words.
+  ///
+  /// \exception WordGraphNotGenerated If word graph has not been generated.
+  /// \exception InvalidSetup If no rescoring model has been set.
+  ///
+  void rescore_word_graph(Hypothesis &result);
+
+  /// \brief Writes the words of the rescored best path into a file,
+  /// separated by spaces.
+  ///
+  void print_rescored_result(FILE *file = stdout);
 
   void debug_ensure_all_paths_contain_history(LMHistory *limit);
 
@@ -383,6 +676,11 @@ private:
   ///
   int find_word_from_lookahead_lm(int word_id, std::string word) const;
 
+  /// \brief Finds the ID of a word or its class in the rescoring language
+  /// model, like find_word_from_lookahead_lm().
+  ///
+  int find_word_from_rescoring_lm(int word_id, std::string word) const;
+
   /// \brief Finds the globally best token that is in the NODE_FINAL state,
   /// i.e. at the end of a word.
   ///
@@ -430,6 +728,37 @@ private:
 			    TPLexPrefixTree::WordHistory *word_history);
   void build_word_graph(TPLexPrefixTree::Token *new_token);
 
+  /// \brief Compacts the word graph and updates the node indices held by
+  /// the active tokens.
+  ///
+  void compact_word_graph();
+
+  /// \brief Freezes the word and state histories that are common to all
+  /// active tokens, writes the frozen part and releases it.
+  ///
+  void freeze_histories();
+
+  /// \brief Writes a word history entry in the format of
+  /// write_word_history() and marks it printed.
+  ///
+  void write_word_history_entry(FILE *file,
+                                TPLexPrefixTree::WordHistory *history);
+
+  /// \brief Sorts the word graph nodes that lead to \a final_node
+  /// topologically, and computes the posterior probability of each of their
+  /// arcs, indexed like word_graph.arcs.
+  ///
+  void compute_word_graph_posteriors(int final_node, float scale,
+                                     std::vector<int> &order,
+                                     std::vector<float> &arc_posteriors);
+
+  /// \brief Marks reachable the word graph nodes that have a posterior
+  /// probability of at least \a threshold and are on a path from the start
+  /// node to \a final_node through such nodes.
+  ///
+  void mark_probable_word_graph_nodes(int final_node, float threshold,
+                                      float scale);
+
   /// \brief Moves the token towards all the arcs leaving the token's node.
   ///
   void propagate_token(TPLexPrefixTree::Token *token);
@@ -488,6 +817,11 @@ private:
   ///
   int compute_lm_hist_hash_code(LMHistory *wh) const;
 
+  /// \brief Returns the context state of the n-gram language model after
+  /// \a wh, computing it only once for each LMHistory.
+  ///
+  int get_lm_context_state(LMHistory *wh);
+
   // language model scoring
 
 #ifdef ENABLE_MULTIWORD_SUPPORT
@@ -535,7 +869,7 @@ private:
   /// Note! Doesn't work if the sentence end is the first one in the word
   /// history. Returns 0 in that case.
   ///
-  float get_lm_lookahead_score(LMHistory *lm_hist,
+  float get_lm_lookahead_score(LMHistory *lm_hist, int fsa_lm_node,
                                 TPLexPrefixTree::Node *node, int depth);
 
   /// \brief Computes bi-gram probabilities for every word pair starting with
@@ -550,6 +884,71 @@ private:
   float get_lm_trigram_lookahead(int w1, int w2,
                                  TPLexPrefixTree::Node *node, int depth);
 
+  /// \brief Returns the context state of the lookahead LM after \a lm_hist,
+  /// computing it only once for each LMHistory.
+  ///
+  int get_lookahead_context_state(LMHistory *lm_hist);
+
+  /// \brief Creates m_lookahead_context from the lookahead LM IDs of the
+  /// last words in \a lm_hist that the lookahead model can condition on.
+  ///
+  void create_lookahead_context(LMHistory *lm_hist);
+
+  /// \brief Reads the acoustic scores of the frames needed for acoustic
+  /// lookahead after the current frame.
+  ///
+  /// Must be called before the acoustics are moved to the current frame.
+  ///
+  void read_acoustic_lookahead();
+
+  /// \brief Returns the acoustic lookahead estimate for a token entering
+  /// \a node, i.e. the sum over the lookahead frames of the difference
+  /// between the best state in the phone of \a node and the best state
+  /// overall.
+  ///
+  float get_acoustic_lookahead_score(TPLexPrefixTree::Node *node);
+
+  class LMLookaheadScoreList;
+
+  /// \brief Creates a lookahead score list from m_lookahead_scores and adds
+  /// it to the cache with key \a index.
+  ///
+  LMLookaheadScoreList *cache_lookahead_scores(int index);
+
+  /// \brief Returns the lookahead score list with key \a index from the
+  /// cache or the preloaded lists, or NULL if it has not been computed.
+  ///
+  LMLookaheadScoreList *find_lookahead_scores(int index);
+
+  /// \brief Returns a checksum of the lookahead LM IDs of the vocabulary,
+  /// used to check that a score list file matches the models.
+  ///
+  unsigned int lookahead_checksum() const;
+
+  /// \brief Returns a hash of the order, the gram counts and the
+  /// probabilities of a few contexts of the LM used for lookahead, used to
+  /// check that a score list file was written with the same LM.
+  ///
+  unsigned int lookahead_lm_fingerprint();
+
+  /// \brief Deletes the score lists read by read_lm_lookahead_scores().
+  void clear_preloaded_lookahead_scores();
+
+  /// \brief Returns the maximum score in \a score_list of the words that
+  /// are possible after \a node.
+  ///
+  float max_lookahead_score(const LMLookaheadScoreList &score_list,
+                            const TPLexPrefixTree::Node *node) const;
+
+  /// \brief Computes the probabilities of every word following the context
+  /// state \a state, and returns the maximum over the possible word ends of
+  /// \a node.
+  ///
+  /// Contexts that back off to the same state share the cached scores.
+  ///
+  float get_lm_context_lookahead(int state, LMHistory *lm_hist,
+                                 TPLexPrefixTree::Node *node, int depth);
+
   void clear_active_node_token_lists(void);
 
   inline float get_token_log_prob(float am_score, float lm_score)
@@ -592,14 +991,40 @@ private:
 
   std::vector<TPLexPrefixTree::Node*> m_active_node_list;
 
+  /// Lookahead scores of every word following a context, quantized to
+  /// 16 bits. Code 0 is reserved for impossible words (score -1e10), and
+  /// the other codes are spaced linearly between the lowest and the
+  /// highest possible score. Since the quantization is monotonic, the
+  /// maximum over a set of words can be selected using the codes.
   class LMLookaheadScoreList
   {
   public:
+    /// Quantizes \a scores and stores them in the list.
+    void set_scores(const std::vector<float> &scores);
+
+    /// Returns the score corresponding to \a code.
+    float score(unsigned short code) const
+    {
+      if (code == 0)
+        return -1e10;
+      return min_score + (code - 1) * step;
+    }
+
     int index;
-    std::vector<float> lm_scores;
+    int uses; //!< How many times the list has been used to compute a score
+    float min_score;
+    float step;
+    std::vector<unsigned short> lm_scores;
   };
+
+  /// Lookahead scores of the current context. Temporary variable used while
+  /// creating a new LMLookaheadScoreList.
+  std::vector<float> m_lookahead_scores;
   HashCache<LMLookaheadScoreList*> lm_lookahead_score_list;
 
+  /// Score lists read by read_lm_lookahead_scores(), indexed like the cache.
+  std::map<int, LMLookaheadScoreList*> m_preloaded_lookahead_scores;
+
   class LMScoreInfo
   {
   public:
@@ -633,6 +1058,16 @@ private:
   /// time instance.
   std::vector<WordGraphInfo> m_recent_word_graph_info;
 
+  /// Word and state histories common to all tokens, frozen by
+  /// freeze_histories().  The oldest history comes first.  Only the
+  /// newest one is kept between the calls.
+  std::deque<TPLexPrefixTree::WordHistory> m_frozen_word_history;
+  std::deque<TPLexPrefixTree::StateHistory> m_frozen_state_history;
+
+  /// Files where the frozen histories are written, or NULL.
+  FILE *m_frozen_word_history_file;
+  FILE *m_frozen_state_history_file;
+
   TPLexPrefixTree::Token *m_best_final_token;
 
   /// The language model.
@@ -654,12 +1089,17 @@ private:
 
   NGram::Gram m_history_ngram; // Temporary variable used by compute_ngram_score().
   NGram *m_lookahead_ngram;
+  NGram::Gram m_lookahead_context; // Temporary variable used by get_lm_context_lookahead().
+  NGram *m_rescoring_ngram;
+  std::vector<int> m_rescoring_lm_ids; // Rescoring LM ID of each word ID.
+  float m_rescoring_lm_scale;
 
   // Options
   float m_print_probs;
   int m_print_text_result;
   bool m_print_state_segmentation;
   bool m_keep_state_segmentation;
+  int m_history_freeze_interval;
   float m_global_beam;
   float m_word_end_beam;
   int m_similar_lm_hist_span;
@@ -669,8 +1109,8 @@ private:
   int m_max_num_tokens;
   int m_verbose;
   int m_word_boundary_id;
-  int m_lm_lookahead; // 0=none, 1=bigram, 2=trigram
-  int m_max_lookahead_score_list_size;
+  int m_lm_lookahead; // 0=none, 1=bigram, 2=trigram, 3=full
+  size_t m_lookahead_score_list_memory;
   int m_max_node_lookahead_buffer_size;
   float m_insertion_penalty;
 
@@ -679,10 +1119,12 @@ private:
   std::vector<int> m_hesitation_ids;
   bool m_use_sentence_boundary;
   bool m_generate_word_graph;
+  int m_word_graph_compaction_interval;
   bool m_require_sentence_end;
   bool m_remove_pronunciation_id;
   bool m_use_word_pair_approximation;
   bool m_use_lm_cache;
+  bool m_use_lm_state_recombination;
 
   float m_current_glob_beam;
   float m_current_we_beam;
@@ -692,6 +1134,27 @@ private:
   float m_fan_out_beam;
   float m_state_beam;
 
+  int m_acoustic_lookahead_frames;
+  float m_acoustic_lookahead_scale;
+
+  /// Log probabilities of the frames after the current frame, in a ring
+  /// buffer indexed by frame modulo m_acoustic_lookahead_frames.
+  std::vector<std::vector<float> > m_acoustic_lookahead_buffer;
+
+  /// The best state log probability of each frame in the ring buffer.
+  std::vector<float> m_acoustic_lookahead_max;
+
+  /// The last frame read to the ring buffer.
+  int m_acoustic_lookahead_last_frame;
+
+  /// The first frame past the end of the acoustics, or -1 if not reached.
+  int m_acoustic_lookahead_eof_frame;
+
+  /// Estimates computed for each lexicon node, and the frames for which
+  /// they were computed.
+  std::vector<float> m_acoustic_lookahead_score;
+  std::vector<int> m_acoustic_lookahead_score_frame;
+
   int filecount;
 
   float m_wc_llh[MAX_WC_COUNT];
@@ -703,6 +1166,7 @@ private:
   float m_fan_out_last_log_prob;
 
   bool m_lm_lookahead_initialized;
+  bool m_use_lookahead_context_states;
 
   int lm_la_cache_count[MAX_LEX_TREE_DEPTH];
   int lm_la_cache_miss[MAX_LEX_TREE_DEPTH];
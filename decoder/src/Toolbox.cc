@@ -34,6 +34,7 @@ Toolbox::Toolbox(int decoder, const char * hmm_path, const char * dur_path)
     m_one_frame_acoustics(),
     m_fsa_lm(NULL),
     m_lookahead_ngram(NULL),
+    m_rescoring_ngram(NULL),
 
     m_expander(NULL),
     m_search(NULL),
@@ -55,6 +56,9 @@ Toolbox::~Toolbox()
   if (m_lookahead_ngram) {
     delete m_lookahead_ngram;
   }
+  if (m_rescoring_ngram) {
+    delete m_rescoring_ngram;
+  }
 
   if (m_fsa_lm) {
     delete m_fsa_lm;
@@ -399,6 +403,25 @@ void Toolbox::interpolated_lookahead_ngram_read(const std::vector<std::string> l
   m_tp_search->set_lookahead_ngram(m_lookahead_ngram);;
 }
 
+void
+Toolbox::rescoring_ngram_read(const char *file, const bool binary, bool quiet)
+{
+  io::Stream in(file,"r");
+  if (!in.file) {
+    throw OpenError();
+  }
+  if (m_rescoring_ngram) {
+    delete m_rescoring_ngram;
+  }
+  m_rescoring_ngram = new TreeGram();
+  m_rescoring_ngram->read(in.file, binary);
+  int num_oolm = m_tp_search->set_rescoring_ngram(m_rescoring_ngram);
+
+  if ((num_oolm > 0) && !quiet) {
+    cerr << num_oolm << " words in the vocabulary were not found in the LMs." << endl;
+  }
+}
+
 void
 Toolbox::read_word_classes(const char *file)
 {
@@ -532,6 +555,72 @@ void Toolbox::set_lm_scale(float lm_scale)
   }
 }
 
+SweepConfig
+Toolbox::sweep_config() const
+{
+  SweepConfig config;
+  config.lm_scale = m_tp_search->get_lm_scale();
+  config.insertion_penalty = m_tp_search->get_insertion_penalty();
+  config.global_beam = m_tp_search->get_global_beam();
+  config.word_end_beam = m_tp_search->get_word_end_beam();
+  config.state_beam = m_tp_search->get_state_beam();
+  config.duration_scale = m_tp_search->get_duration_scale();
+  config.transition_scale = m_tp_search->get_transition_scale();
+  config.token_limit = m_tp_search->get_max_num_tokens();
+  return config;
+}
+
+void
+Toolbox::set_sweep_config(const SweepConfig &config)
+{
+  // The global beam limits the word end beam, so it is set first
+  m_tp_search->set_global_beam(config.global_beam);
+  m_tp_search->set_word_end_beam(config.word_end_beam);
+  m_tp_search->set_state_beam(config.state_beam);
+  m_tp_search->set_lm_scale(config.lm_scale);
+  m_tp_search->set_insertion_penalty(config.insertion_penalty);
+  m_tp_search->set_duration_scale(config.duration_scale);
+  m_tp_search->set_transition_scale(config.transition_scale);
+  m_tp_search->set_max_num_tokens(config.token_limit);
+}
+
+int
+Toolbox::sweep(int start_frame, int end_frame)
+{
+  assert(!m_use_stack_decoder);
+  if (m_tp_search->get_print_text_result())
+    throw TokenPassSearch::InvalidSetup("sweep() requires "
+                                        "set_print_text_result(0).");
+
+  int frames = m_sweep_acoustics.read(*m_acoustics, start_frame, end_frame);
+  m_tp_search->set_acoustics(&m_sweep_acoustics);
+
+  SweepConfig original = sweep_config();
+  m_sweep_results.assign(m_sweep_configs.size(), std::string());
+  m_sweep_log_probs.assign(m_sweep_configs.size(), 0);
+
+  HistoryVector hist_vec;
+  for (int c = 0; c < (int)m_sweep_configs.size(); c++) {
+    set_sweep_config(m_sweep_configs[c]);
+    reset(start_frame);
+    set_end(end_frame);
+    while (run());
+
+    std::string &result = m_sweep_results[c];
+    m_tp_search->get_path(hist_vec, true, NULL);
+    for (int i = hist_vec.size() - 1; i >= 0; i--) {
+      if (!result.empty())
+        result += " ";
+      result += word(hist_vec[i]->last().word_id());
+    }
+    m_sweep_log_probs[c] = m_tp_search->get_total_log_prob(true);
+  }
+
+  set_sweep_config(original);
+  m_tp_search->set_acoustics(m_acoustics);
+  return frames;
+}
+
 void Toolbox::set_word_boundary(const std::string & word)
 {
   if (m_use_stack_decoder) {
@@ -546,3 +635,54 @@ void Toolbox::set_word_boundary(const std::string & word)
     m_word_boundary = word;
   }
 }
+
+void
+Toolbox::set_frozen_history_files(const std::string &word_file,
+                                  const std::string &state_file)
+{
+  m_frozen_word_history_file.close();
+  m_frozen_state_history_file.close();
+  m_frozen_word_history_file_name = word_file;
+  m_frozen_state_history_file_name = state_file;
+  if (!word_file.empty())
+    m_frozen_word_history_file.open(word_file, "w");
+  if (!state_file.empty())
+    m_frozen_state_history_file.open(state_file, "w");
+  m_tp_search->set_frozen_history_files(m_frozen_word_history_file.file,
+                                        m_frozen_state_history_file.file);
+}
+
+void
+Toolbox::write_word_history(const std::string file_name)
+{
+  if (m_frozen_word_history_file.file == NULL
+      || file_name != m_frozen_word_history_file_name)
+  {
+    io::Stream out(file_name, "w");
+    m_tp_search->write_word_history(out.file);
+    return;
+  }
+
+  // The frozen words have been written already.
+  m_tp_search->write_word_history(m_frozen_word_history_file.file);
+  m_frozen_word_history_file.close();
+  m_tp_search->set_frozen_history_files(NULL,
+                                        m_frozen_state_history_file.file);
+}
+
+void
+Toolbox::write_state_segmentation(const std::string &file)
+{
+  if (m_frozen_state_history_file.file == NULL
+      || file != m_frozen_state_history_file_name)
+  {
+    m_tp_search->print_state_history(io::Stream(file, "w").file);
+    return;
+  }
+
+  // The frozen segments have been written already.
+  m_tp_search->print_state_history(m_frozen_state_history_file.file);
+  m_frozen_state_history_file.close();
+  m_tp_search->set_frozen_history_files(m_frozen_word_history_file.file,
+                                        NULL);
+}
@@ -14,9 +14,27 @@
 #include "Search.hh"
 #include "TokenPassSearch.hh"
 #include "OneFrameAcoustics.hh"
+#include "BufferedAcoustics.hh"
 
 typedef std::string bytestype;
 
+/// \brief Token pass search parameters of one configuration in a
+/// decoding sweep.
+///
+/// Use Toolbox::sweep_config() to get the current parameters and modify
+/// the ones that are varied.
+///
+struct SweepConfig {
+  float lm_scale;
+  float insertion_penalty;
+  float global_beam;
+  float word_end_beam;
+  float state_beam;
+  float duration_scale;
+  float transition_scale;
+  int token_limit;
+};
+
 class Toolbox {
 public:
   /// \brief Loads the acoustic model. It cannot be changed at a later time.
@@ -78,6 +96,19 @@ public:
   /// \brief Reads several lookahead n-gram models for interpolation
   void interpolated_lookahead_ngram_read(const std::vector<std::string>, const std::vector<float>);
 
+  /// \brief Reads an n-gram language model for rescoring the word graph
+  /// after decoding.
+  ///
+  /// The model is read once and used for every utterance until another
+  /// model is read.
+  ///
+  /// \param binary If false, the file is expected to be in ARPA file format.
+  /// \param quiet If true, doesn't print warnings to stderr.
+  ///
+  void rescoring_ngram_read(const char *file, bool binary=true, bool quiet=false);
+  void set_rescoring_lm_scale(float scale)
+  { m_tp_search->set_rescoring_lm_scale(scale); }
+
   /// \brief Reads a finite-state automaton language model.
   ///
   /// \param file Name of the file where the language model is read from.
@@ -151,14 +182,78 @@ public:
 
   // Token pass search
   WordGraph &tp_word_graph() { return m_tp_search->word_graph; } 
-  void write_word_graph(const std::string &file_name)
-  { m_tp_search->write_word_graph(file_name); }
+  void write_word_graph(const std::string &file_name,
+                        float posterior_threshold = 0,
+                        float posterior_scale = 1)
+  { m_tp_search->write_word_graph(file_name, posterior_threshold,
+                                  posterior_scale); }
+  void write_nbest(const std::string &file_name, int n,
+                   int max_expansions = 100000)
+  { m_tp_search->write_nbest(file_name, n, max_expansions); }
+  void write_confusion_network(const std::string &file_name,
+                               float posterior_scale = 1)
+  { m_tp_search->write_confusion_network(file_name, posterior_scale); }
   void print_best_lm_history(FILE *out=stdout) 
   { 
     m_tp_search->print_lm_history(out, true); 
   }
   void print_best_lm_history_to_file(FILE *out) {print_best_lm_history(out);}
 
+  /// \brief Prints the best path of the word graph rescored with the model
+  /// read by rescoring_ngram_read().
+  ///
+  void print_rescored_result(FILE *out=stdout)
+  { m_tp_search->print_rescored_result(out); }
+
+  // Parameter sweep
+
+  /// \brief Returns the current token pass search parameters.
+  SweepConfig sweep_config() const;
+
+  /// \brief Adds a configuration to be decoded by sweep().
+  void add_sweep_config(const SweepConfig &config)
+  { m_sweep_configs.push_back(config); }
+  void clear_sweep_configs()
+  {
+    m_sweep_configs.clear();
+    m_sweep_results.clear();
+    m_sweep_log_probs.clear();
+  }
+  int num_sweep_configs() const { return m_sweep_configs.size(); }
+
+  /// \brief Decodes a segment once with each sweep configuration.
+  ///
+  /// The acoustic scores of the segment are read once from the current
+  /// acoustics (e.g. an opened LNA file) into memory, and the searches are
+  /// run one after another over them, sharing the lexicon and the language
+  /// models.  The searches cannot run concurrently, because the tokens are
+  /// kept in the nodes of the lexicon tree.  The search parameters are
+  /// restored afterwards.
+  ///
+  /// The LM scale of a configuration does not change the scaling of the
+  /// pronunciation probabilities, which is fixed when the lexicon is read.
+  ///
+  /// The best paths are available from sweep_result().  They are read
+  /// from the word histories, so set_print_text_result() must be off.
+  /// The other output options apply to each search.
+  ///
+  /// \param start_frame The first frame of the segment.
+  /// \param end_frame The end frame of the segment, or -1 for the end of
+  /// the acoustics.
+  /// \return The number of frames decoded.
+  /// \exception TokenPassSearch::InvalidSetup If the text result is printed.
+  ///
+  int sweep(int start_frame = 0, int end_frame = -1);
+
+  /// \brief Returns the best path of a configuration in the last sweep().
+  const std::string &sweep_result(int config) const
+  { return m_sweep_results.at(config); }
+
+  /// \brief Returns the total log probability of the best path of a
+  /// configuration in the last sweep().
+  float sweep_log_prob(int config) const
+  { return m_sweep_log_probs.at(config); }
+
   // Miscellaneous
   void segment(const std::string &str, int start_frame, int end_frame);
 
@@ -211,6 +306,7 @@ public:
   void set_fan_in_beam(float beam) { m_tp_search->set_fan_in_beam(beam); }
   void set_fan_out_beam(float beam) { m_tp_search->set_fan_out_beam(beam); }
   void set_tp_state_beam(float beam) { m_tp_search->set_state_beam(beam); }
+  void set_acoustic_lookahead(int frames, float scale = 1) { m_tp_search->set_acoustic_lookahead(frames, scale); }
   void set_max_state_duration(int duration) 
   { m_expander->set_max_state_duration(duration); }
 
@@ -232,12 +328,36 @@ public:
   /// \param lmlh 0=None, 1=Only in first subtree nodes, 2=Full.
   ///
   void set_lm_lookahead(int lmlh) { m_tp_lexicon->set_lm_lookahead(lmlh); m_tp_search->set_lm_lookahead(lmlh); }
+  void set_lm_lookahead_cache_memory(size_t bytes) { m_tp_search->set_lm_lookahead_cache_memory(bytes); }
+
+  /// \brief Writes the most used LM lookahead score lists to a file, so that
+  /// another decoder can start with them (see read_lm_lookahead_scores()).
+  ///
+  /// \param max_lists The maximum number of lists to write, 0 for all.
+  ///
+  void write_lm_lookahead_scores(const std::string &file_name,
+                                 int max_lists = 0)
+  { m_tp_search->write_lm_lookahead_scores(file_name, max_lists); }
+
+  /// \brief Reads LM lookahead score lists written with the same lexicon,
+  /// lookahead LM and lookahead order. Has to be called after reading the
+  /// language models.
+  ///
+  /// \return The number of lists read.
+  ///
+  int read_lm_lookahead_scores(const std::string &file_name)
+  { return m_tp_search->read_lm_lookahead_scores(file_name); }
 
   void set_cross_word_triphones(bool cw_triphones) { m_tp_lexicon->set_cross_word_triphones(cw_triphones);
  }
   void set_insertion_penalty(float ip) { m_tp_search->set_insertion_penalty(ip); }
   void set_silence_is_word(bool b) { m_tp_lexicon->set_silence_is_word(b); m_tp_lexicon_reader->set_silence_is_word(b); }
   void set_ignore_case(bool b) { m_tp_lexicon->set_ignore_case(b);}
+
+  /// \brief Shares the common word tails after the word identity in the
+  /// lexical network. Has to be set before reading the lexicon.
+  ///
+  void set_suffix_sharing(bool b) { m_tp_lexicon->set_suffix_sharing(b); }
   void set_verbose(int verbose) { if (m_use_stack_decoder) m_search->set_verbose(verbose); else {m_tp_lexicon->set_verbose(verbose); m_tp_search->set_verbose(verbose);}}
   void set_print_text_result(int print) { m_tp_search->set_print_text_result(print); }
   void set_print_state_segmentation(int print) { m_tp_search->set_print_state_segmentation(print); }
@@ -306,25 +426,40 @@ public:
   ///
   void set_use_word_pair_approximation(bool b)
   { m_tp_search->set_use_word_pair_approximation(b); }
+  void set_word_graph_compaction_interval(int frames)
+  { m_tp_search->set_word_graph_compaction_interval(frames); }
+  void set_history_freeze_interval(int frames)
+  { m_tp_search->set_history_freeze_interval(frames); }
+
+  /// \brief Writes the frozen word and state histories into files as soon
+  /// as they are frozen (see set_history_freeze_interval()).
+  ///
+  /// write_word_history() and write_state_segmentation() with the same file
+  /// names write the rest of the utterance into the open files and close
+  /// them, so the files are set for each utterance.  An empty file name
+  /// disables writing that history.
+  ///
+  void set_frozen_history_files(const std::string &word_file,
+                                const std::string &state_file);
 
   void set_use_lm_cache(bool value)
   { m_tp_search->set_use_lm_cache(value); }
 
+  /// \brief Enables or disables recombining tokens by the context state of
+  /// the n-gram language model instead of the last words.
+  ///
+  void set_use_lm_state_recombination(bool value)
+  { m_tp_search->set_use_lm_state_recombination(value); }
+
   // Debug
   void print_prunings()
   { m_search->print_prunings(); }
   void print_hypo(Hypo &hypo);
   void print_sure() { m_search->print_sure(); }
-  void write_word_history(const std::string file_name) {
-    io::Stream out(file_name, "w");
-    m_tp_search->write_word_history(out.file);
-  }
+  void write_word_history(const std::string file_name);
   void write_word_history() { m_tp_search->write_word_history(); }
   void print_lm_history() { m_tp_search->print_lm_history(); }
-  void write_state_segmentation(const std::string &file)
-  { 
-    m_tp_search->print_state_history(io::Stream(file, "w").file);
-  }
+  void write_state_segmentation(const std::string &file);
 
   TokenPassSearch &debug_get_tp() { return *m_tp_search; }
   TPLexPrefixTree &debug_get_tp_lex() { return *m_tp_lexicon; }
@@ -362,6 +497,11 @@ private:
   Acoustics *m_acoustics;
   LnaReaderCircular *m_lna_reader;
   OneFrameAcoustics m_one_frame_acoustics;
+  BufferedAcoustics m_sweep_acoustics;
+
+  std::vector<SweepConfig> m_sweep_configs;
+  std::vector<std::string> m_sweep_results;
+  std::vector<float> m_sweep_log_probs;
 
   std::string m_word_boundary;
 
@@ -369,6 +509,7 @@ private:
   fsalm::LM *m_fsa_lm;
   std::deque<int> m_history;
   NGram *m_lookahead_ngram;
+  NGram *m_rescoring_ngram;
 
   Expander *m_expander;
 
@@ -376,6 +517,12 @@ private:
 
   LMHistory *m_last_guaranteed_history;
 
+  /// The files where the frozen histories are written, and their names.
+  io::Stream m_frozen_word_history_file;
+  io::Stream m_frozen_state_history_file;
+  std::string m_frozen_word_history_file_name;
+  std::string m_frozen_state_history_file_name;
+
   /// \brief Reads the acoustic model from a file.
   ///
   void hmm_read(const char *file);
@@ -388,6 +535,9 @@ private:
 
   /// \brief Has to be called after reading acoustic model.
   void reinitialize_search();
+
+  /// \brief Sets the token pass search parameters.
+  void set_sweep_config(const SweepConfig &config);
 };
 
 #endif /* TOOLBOX_HH */
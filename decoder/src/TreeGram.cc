@@ -590,6 +590,75 @@ TreeGram::fetch_trigram_list(int w1, int w2,
   }
 }
 
+int
+TreeGram::find_context_node(const Gram &context, int *length)
+{
+  // Contexts longer than order-1 words are never used.
+  int first = std::max(0, (int)context.size() - (m_order - 1));
+
+  for (; first < context.size(); first++) {
+    fetch_gram(context, first);
+    if (m_fetch_stack.size() != context.size() - first)
+      continue;
+
+    // A context without children and back-off gives the same
+    // probabilities as the next shorter one.
+    int node = m_fetch_stack.back();
+    bool has_children = node < m_nodes.size() - 1 &&
+      m_nodes[node].child_index >= 0 &&
+      m_nodes[node + 1].child_index > m_nodes[node].child_index;
+    if (has_children || m_nodes[node].back_off != 0) {
+      if (length != NULL)
+        *length = context.size() - first;
+      return node;
+    }
+  }
+
+  if (length != NULL)
+    *length = 0;
+  return -1;
+}
+
+void
+TreeGram::fetch_context_list(const Gram &context,
+                             std::vector<float> &result_buffer)
+{
+  assert(m_type==BACKOFF);
+
+  // Collect the nodes of the suffixes of the context that exist in the
+  // model, longest first.
+  std::vector<int> nodes;
+  int first = std::max(0, (int)context.size() - (m_order - 1));
+  for (; first < context.size(); first++) {
+    fetch_gram(context, first);
+    if (m_fetch_stack.size() == context.size() - first)
+      nodes.push_back(m_fetch_stack.back());
+  }
+
+  // back_offs[k] is the sum of back-off weights of the contexts longer
+  // than nodes[k].
+  std::vector<float> back_offs(nodes.size() + 1, 0);
+  for (int k = 0; k < nodes.size(); k++)
+    back_offs[k + 1] = back_offs[k] + m_nodes[nodes[k]].back_off;
+
+  // Fill the unigram probabilities
+  result_buffer.resize(m_words.size());
+  float temp = back_offs[nodes.size()];
+  for (int i = 0; i < m_words.size(); i++)
+    result_buffer[i] = temp + m_nodes[i].log_prob;
+
+  // Fill the higher order probabilities, shortest context first
+  for (int k = nodes.size() - 1; k >= 0; k--) {
+    int child_index = m_nodes[nodes[k]].child_index;
+    int next_child_index = m_nodes[nodes[k]+1].child_index;
+    if (child_index != -1 && next_child_index > child_index)
+    {
+      for (int i = child_index; i < next_child_index; i++)
+        result_buffer[m_nodes[i].word] = back_offs[k] + m_nodes[i].log_prob;
+    }
+  }
+}
+
 float
 TreeGram::log_prob_bo(const Gram &gram)
 {
@@ -156,6 +156,28 @@ public:
   void fetch_trigram_list(int w1, int w2,
                           std::vector<float> &result_buffer);
 
+  /// \brief Finds the node of the longest suffix of \a context that the
+  /// model conditions on, i.e. that has children or a back-off weight.
+  ///
+  /// \param length If not NULL, will be set to the number of words in the
+  /// suffix.
+  /// \return The node index, or -1 if only unigrams apply.
+  ///
+  int find_context_node(const Gram &context, int *length = NULL);
+
+  bool supports_context_states() { return m_type == BACKOFF; }
+  int context_state(const Gram &context)
+  { return find_context_node(context) + 1; }
+
+  /// \brief Computes probabilities for every word following \a context.
+  ///
+  /// Generalizes fetch_trigram_list() to arbitrary context length.
+  ///
+  void fetch_context_list(const Gram &context,
+                          std::vector<float> &result_buffer);
+
+  int num_nodes() const { return m_nodes.size(); }
+
   void print_debuglist();
   void finalize(bool add_missing_unigrams=false);
   void convert_to_backoff();
@@ -4,6 +4,7 @@
 #include <cstddef>  // NULL
 #include <cfloat>
 #include <assert.h>
+#include <utility>
 #include <vector>
 
 /** A structure for maintaining WordGraphs during recognition.  Each
@@ -204,6 +205,40 @@ struct WordGraph {
     }
   }
 
+  /** Sort the nodes reachable backwards from the given node
+   * topologically.
+   *
+   * Every node is placed after the source nodes of its arcs, so the
+   * start node comes first and \c final_node last.
+   *
+   * \param final_node = the last node of the graph
+   * \param order = the sorted node indices are stored here
+   */
+  void topological_order(int final_node, std::vector<int> &order)
+  {
+    std::vector<char> visited(nodes.size(), 0);
+    std::vector<std::pair<int, int> > stack; // (node, next arc to visit)
+    order.clear();
+    stack.push_back(std::make_pair(final_node, nodes[final_node].first_arc));
+    visited[final_node] = 1;
+
+    // Depth-first search with post-order output
+    while (!stack.empty()) {
+      int a = stack.back().second;
+      if (a < 0) {
+        order.push_back(stack.back().first);
+        stack.pop_back();
+        continue;
+      }
+      stack.back().second = arcs[a].sibling_arc;
+      int source = arcs[a].source_node_id;
+      if (!visited[source]) {
+        visited[source] = 1;
+        stack.push_back(std::make_pair(source, nodes[source].first_arc));
+      }
+    }
+  }
+
   /** Increase the reference count of the node. */
   void link(int node_index) {
     nodes[node_index].reference_count++;
@@ -236,6 +271,54 @@ struct WordGraph {
     }
   }
 
+  /** The number of node slots that are free for reuse. */
+  int num_free_nodes() const { return m_free_node_indices.size(); }
+
+  /** Move the live nodes and arcs to the beginning of the arrays and
+   * drop the freed slots.
+   *
+   * A node is live if its reference count is positive.  The relative
+   * order of the nodes is preserved, so the start node keeps the
+   * index 0.  The arcs are stored grouped by their target node in the
+   * order of the nodes.
+   *
+   * \param node_map = the new index of each old node is stored here,
+   * or -1 if the node was not live
+   */
+  void compact(std::vector<int> &node_map)
+  {
+    node_map.assign(nodes.size(), -1);
+    int num_nodes = 0;
+    for (size_t n = 0; n < nodes.size(); n++)
+      if (nodes[n].reference_count > 0)
+        node_map[n] = num_nodes++;
+
+    std::vector<Node> new_nodes;
+    std::vector<Arc> new_arcs;
+    new_nodes.reserve(num_nodes);
+    for (size_t n = 0; n < nodes.size(); n++) {
+      if (node_map[n] < 0)
+        continue;
+      new_nodes.push_back(nodes[n]);
+      Node &node = new_nodes.back();
+      int a = node.first_arc;
+      node.first_arc = a < 0 ? -1 : (int)new_arcs.size();
+      while (a >= 0) {
+        const Arc &arc = arcs[a];
+        assert(node_map[arc.source_node_id] >= 0);
+        a = arc.sibling_arc;
+        new_arcs.push_back(Arc(a < 0 ? -1 : (int)new_arcs.size() + 1,
+                               node_map[arc.source_node_id],
+                               arc.am_weight, arc.lm_weight));
+      }
+    }
+
+    nodes.swap(new_nodes);
+    arcs.swap(new_arcs);
+    m_free_node_indices.clear();
+    m_free_arc_indices.clear();
+  }
+
   /** Reset the structure to initial state. */
   void reset()
   {
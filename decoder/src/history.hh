@@ -3,6 +3,9 @@
 
 #include <cstddef>  // NULL
 #include <cassert>
+#include <deque>
+#include <map>
+#include <vector>
 
 namespace hist {
 
@@ -78,7 +81,101 @@ namespace hist {
     T *m_obj; //!< Pointer to the object.
     std::vector<T *> *m_pool;
   };
-  
+
+  /** Move the history common to all given chains to a frozen record.
+   *
+   * Finds the deepest structure that every chain in \c heads passes
+   * through, copies the structures older than it to the end of \c
+   * frozen, links it to the copies, and unlinks the originals.  The
+   * chains look the same afterwards, but the copies are stored
+   * contiguously and are released only by release_frozen().
+   * Structures that are referenced from outside the chains are not
+   * frozen.
+   *
+   * The frozen copies must outlive every chain that reaches them.
+   *
+   * \param heads = the newest structure of each chain (NULLs are skipped)
+   * \param frozen = the frozen record, oldest structure first
+   * \param pool = the pool for unlink()
+   * \return the oldest structure that was not frozen, whose previous
+   * is now the newest frozen copy, or NULL if nothing was frozen
+   */
+  template <class T>
+  T *freeze(const std::vector<T*> &heads, std::deque<T> &frozen,
+            std::vector<T*> *pool = NULL)
+  {
+    T *limit = frozen.empty() ? NULL : &frozen.back();
+
+    // Count the references to each structure from the chains, stopping
+    // at the previously frozen part.
+    std::map<T*, int> refs;
+    T *first = NULL;
+    for (size_t i = 0; i < heads.size(); i++) {
+      T *t = heads[i];
+      if (t == NULL)
+        continue;
+      if (first == NULL)
+        first = t;
+      if (refs[t]++ > 0)
+        continue;
+      for (t = t->previous; t != NULL && t != limit; t = t->previous) {
+        if (refs[t]++ > 0)
+          break;
+      }
+    }
+    if (first == NULL)
+      return NULL;
+
+    // The chains split at the oldest structure with several references.
+    std::vector<T*> path;
+    for (T *t = first; t != NULL && t != limit; t = t->previous)
+      path.push_back(t);
+    size_t cut = 0;
+    for (size_t i = path.size(); i-- > 0; ) {
+      if (refs[path[i]] > 1) {
+        cut = i;
+        break;
+      }
+    }
+    for (size_t i = cut + 1; i < path.size(); i++) {
+      if (path[i]->reference_count != 1)
+        cut = i;
+    }
+    if (cut + 1 >= path.size())
+      return NULL;
+
+    // Copy the structures older than the cut, oldest first.  A
+    // reference count of two stops unlink() at the copies.
+    T *tail = limit;
+    for (size_t i = path.size() - 1; i > cut; i--) {
+      frozen.push_back(*path[i]);
+      frozen.back().previous = tail;
+      frozen.back().reference_count = 2;
+      tail = &frozen.back();
+    }
+
+    T *old = path[cut]->previous;
+    path[cut]->previous = tail;
+    unlink(old, pool);
+    return path[cut];
+  }
+
+  /** Release the frozen record except its newest structure.
+   *
+   * The newest structure becomes the first structure of the chains,
+   * so the released part is no longer reachable from them.
+   *
+   * \param frozen = the frozen record, oldest structure first
+   */
+  template <class T>
+  void release_frozen(std::deque<T> &frozen)
+  {
+    if (frozen.empty())
+      return;
+    frozen.erase(frozen.begin(), frozen.end() - 1);
+    frozen.front().previous = NULL;
+  }
+
 };
 
 #endif /* HISTORY_HH */
@@ -84,8 +84,9 @@ public:
   Hypo &back();
   int size();
   bool empty();
+  Hypo &hypo(int handle);
   int find_similar(const Hypo &hypo, int words);
-  void sorted_insert(const Hypo &hypo);
+  int sorted_insert(const Hypo &hypo);
 };
 
 class Expander {
@@ -100,6 +101,17 @@ class Expander {
   Word* word(int index);
 };
 
+struct SweepConfig {
+  float lm_scale;
+  float insertion_penalty;
+  float global_beam;
+  float word_end_beam;
+  float state_beam;
+  float duration_scale;
+  float transition_scale;
+  int token_limit;
+};
+
 class Toolbox {
 public:
   Toolbox(int decoder, const char * hmm_path, const char * dur_path);
@@ -123,6 +135,10 @@ public:
   void read_lookahead_ngram(const char *file, const bool binary, bool quiet);
   void read_lookahead_ngram(const char *file, const bool binary);
   void read_lookahead_ngram(const char *file);
+  void rescoring_ngram_read(const char *file, const bool binary, bool quiet);
+  void rescoring_ngram_read(const char *file, const bool binary);
+  void rescoring_ngram_read(const char *file);
+  void set_rescoring_lm_scale(float scale);
 
   // Lna
   void lna_open(const char *file, int size);
@@ -156,12 +172,27 @@ public:
   HypoStack &stack(int frame);
   int paths();
 
-  void write_word_graph(const std::string &file_name);
+  void write_word_graph(const std::string &file_name,
+                        float posterior_threshold = 0,
+                        float posterior_scale = 1);
+  void write_nbest(const std::string &file_name, int n,
+                   int max_expansions = 100000);
+  void write_confusion_network(const std::string &file_name,
+                               float posterior_scale = 1);
   void print_best_lm_history();
   void print_best_lm_history_to_file(FILE *out);
+  void print_rescored_result();
   const bytestype &best_hypo_string(bool print_all, bool output_time);
   void write_state_segmentation(const std::string &file);
 
+  SweepConfig sweep_config();
+  void add_sweep_config(const SweepConfig &config);
+  void clear_sweep_configs();
+  int num_sweep_configs();
+  int sweep(int start_frame = 0, int end_frame = -1);
+  const std::string &sweep_result(int config);
+  float sweep_log_prob(int config);
+
   void set_forced_end(bool forced_end);
   void set_hypo_limit(int hypo_limit);
   void set_prune_similar(int prune_similar);
@@ -182,13 +213,20 @@ public:
   void set_eq_word_count_beam(float beam);
 	void set_fan_in_beam(float beam);
 	void set_fan_out_beam(float beam);
+	void set_acoustic_lookahead(int frames, float scale);
+	void set_acoustic_lookahead(int frames);
 	void set_tp_state_beam(float beam);
   void set_max_state_duration(int duration);
   void set_split_multiwords(bool b);
   void set_cross_word_triphones(bool cw_triphones);
   void set_silence_is_word(bool b);
 	void set_ignore_case(bool b);		
+  void set_suffix_sharing(bool b);
   void set_lm_lookahead(int lmlh);
+  void set_lm_lookahead_cache_memory(size_t bytes);
+  void write_lm_lookahead_scores(const std::string &file_name,
+                                 int max_lists = 0);
+  int read_lm_lookahead_scores(const std::string &file_name);
 	void set_insertion_penalty(float ip);
   void set_print_text_result(int print);
   void set_print_state_segmentation(int print);
@@ -205,7 +243,12 @@ public:
   void set_dummy_word_boundaries(bool value);
   void set_generate_word_graph(bool value);
   void set_use_word_pair_approximation(bool value);
+  void set_word_graph_compaction_interval(int frames);
+  void set_history_freeze_interval(int frames);
+  void set_frozen_history_files(const std::string &word_file,
+                                const std::string &state_file);
   void set_use_lm_cache(bool value);
+  void set_use_lm_state_recombination(bool value);
   void set_require_sentence_end(bool s);
   void set_remove_pronunciation_id(bool remove);
 
@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include "TokenPassSearch.hh"
+
+// Builds a small word graph by hand and checks the N-best list and the
+// confusion network extracted from it.
+//
+//   0 --a--> 1 --c--> 3
+//   0 --b--> 2 --c--> 3
+//            4 --c--> 3   (4 has no incoming arcs, so it is not a start)
+
+int
+main(int argc, char *argv[])
+{
+  std::map<std::string, int> hmm_map;
+  std::vector<Hmm> hmms;
+  TPLexPrefixTree lex(hmm_map, hmms);
+  Vocabulary vocab;
+  int a = vocab.add_word("a");
+  int b = vocab.add_word("b");
+  int c = vocab.add_word("c");
+  int d = vocab.add_word("d");
+  TokenPassSearch search(lex, vocab, NULL);
+
+  WordGraph &graph = search.word_graph;
+  int start = graph.add_node(0, -1, 0, 0);
+  int node_a = graph.add_node(10, a, 0);
+  int node_b = graph.add_node(10, b, 0);
+  int node_c = graph.add_node(20, c, 0);
+  int node_d = graph.add_node(10, d, 0);
+  assert(start == 0);
+  graph.add_arc(start, node_a, -1, -1, false);
+  graph.add_arc(start, node_b, -2, -1, false);
+  graph.add_arc(node_a, node_c, -1, 0, false);
+  graph.add_arc(node_b, node_c, -1, 0, false);
+  graph.add_arc(node_d, node_c, 0, 0, false);
+
+  std::vector<TokenPassSearch::Hypothesis> nbest;
+  bool complete = search.get_word_graph_nbest(node_c, 3, nbest);
+  assert(complete);
+  assert(nbest.size() == 2);
+  assert(nbest[0].word_ids.size() == 2);
+  assert(nbest[0].word_ids[0] == a && nbest[0].word_ids[1] == c);
+  assert(fabs(nbest[0].total_log_prob - -3) < 1e-4);
+  assert(nbest[1].word_ids[0] == b && nbest[1].word_ids[1] == c);
+  assert(fabs(nbest[1].total_log_prob - -4) < 1e-4);
+
+  complete = search.get_word_graph_nbest(node_c, 2, nbest, 1);
+  assert(!complete);
+  assert(nbest.size() < 2);
+
+  std::vector<TokenPassSearch::ConfusionSet> network;
+  search.get_word_graph_confusion_network(node_c, network);
+  assert(network.size() == 2);
+  assert(network[0].size() == 2);
+  assert(network[0][0].word_id == a);
+  assert(fabs(network[0][0].posterior - 1 / 1.1) < 1e-4);
+  assert(network[0][1].word_id == b);
+  assert(fabs(network[0][1].posterior - 0.1 / 1.1) < 1e-4);
+  assert(network[1].size() == 1);
+  assert(network[1][0].word_id == c);
+  assert(fabs(network[1][0].posterior - 1) < 1e-4);
+
+  printf("OK\n");
+  return 0;
+}
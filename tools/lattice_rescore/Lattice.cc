@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <map>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
 #include <stdlib.h>
 #include "str.hh"
 #include "Lattice.hh"
@@ -13,7 +17,7 @@ Lattice::Arc::Arc(int target_node_id, std::string label, float ac_log_prob,
 }
 
 Lattice::Lattice()
-  : initial_node_id(-1), final_node_id(-1), m_num_arcs(0)
+  : initial_node_id(-1), final_node_id(-1), lm_scale(1), m_num_arcs(0)
 {
 }
 
@@ -24,6 +28,7 @@ Lattice::clear()
   m_num_arcs = 0;
   initial_node_id = -1;
   final_node_id = -1;
+  lm_scale = 1;
 }
 
 Lattice::Node&
@@ -40,6 +45,15 @@ Lattice::new_arc(int S, int E, std::string W, float a, float l)
   m_num_arcs++;
 }
 
+void
+Lattice::new_arc(int S, int E, std::string W, float a,
+                 const std::vector<float> &l)
+{
+  m_nodes.at(S).arcs.push_back(Arc(E, W, a, l.at(0)));
+  m_nodes.at(S).arcs.back().lm_log_probs = l;
+  m_num_arcs++;
+}
+
 
 
 void
@@ -49,6 +63,7 @@ Lattice::read(FILE *file)
   m_num_arcs = 0;
   final_node_id = -1;
   initial_node_id = -1;
+  lm_scale = 1;
 
   std::map<int, int> label_map;
   std::string line;
@@ -110,6 +125,8 @@ Lattice::read(FILE *file)
 	    initial_node_id = str::str2long(&attribute[1], &ok);
 	  else if (attribute[0] == "end")
 	    final_node_id = str::str2long(&attribute[1], &ok);
+	  else if (attribute[0] == "lmscale")
+	    lm_scale = str::str2float(&attribute[1], &ok);
 	}
       }
 
@@ -132,6 +149,12 @@ Lattice::read(FILE *file)
 
 void
 Lattice::write(FILE *file)
+{
+  write(file, -1);
+}
+
+void
+Lattice::write(FILE *file, int lm_index)
 {
   fprintf(file, "VERSION=1.1\n"
 	  "base=10\n"
@@ -146,10 +169,77 @@ Lattice::write(FILE *file)
   for (int n = 0; n < (int)m_nodes.size(); n++) {
     for (int a = 0; a < (int)m_nodes[n].arcs.size(); a++) {
       Arc &arc = m_nodes[n].arcs[a];
+      float lm_log_prob = arc.lm_log_prob;
+      if (lm_index >= 0)
+        lm_log_prob = arc.lm_log_probs.at(lm_index);
       fprintf(file, "J=%d S=%d E=%d W=%s a=%e l=%e\n",
 	      J, n, arc.target_node_id, arc.label.c_str(), arc.ac_log_prob,
-	      arc.lm_log_prob);
+	      lm_log_prob);
       J++;
     }
   }
 }
+
+float
+Lattice::best_path(const std::vector<float> &weights, float lm_scale,
+                   std::vector<std::string> &words)
+{
+  // Sort the nodes topologically.  The rescored lattices may contain
+  // arcs to lower node ids, when an arc merges into a context that
+  // was created earlier.
+  std::vector<int> num_incoming(m_nodes.size(), 0);
+  for (int n = 0; n < (int)m_nodes.size(); n++)
+    for (int a = 0; a < (int)m_nodes[n].arcs.size(); a++)
+      num_incoming.at(m_nodes[n].arcs[a].target_node_id)++;
+  std::vector<int> sorted_nodes;
+  sorted_nodes.reserve(m_nodes.size());
+  for (int n = 0; n < (int)m_nodes.size(); n++)
+    if (num_incoming[n] == 0)
+      sorted_nodes.push_back(n);
+  for (int i = 0; i < (int)sorted_nodes.size(); i++) {
+    const Node &node = m_nodes[sorted_nodes[i]];
+    for (int a = 0; a < (int)node.arcs.size(); a++)
+      if (--num_incoming[node.arcs[a].target_node_id] == 0)
+        sorted_nodes.push_back(node.arcs[a].target_node_id);
+  }
+  if (sorted_nodes.size() != m_nodes.size()) {
+    fprintf(stderr, "ERROR: Lattice::best_path(): lattice contains a cycle\n");
+    exit(1);
+  }
+
+  std::vector<float> score(m_nodes.size(), -FLT_MAX);
+  std::vector<const Arc*> best_arc(m_nodes.size(), (const Arc*)NULL);
+  std::vector<int> best_source(m_nodes.size(), -1);
+  score.at(initial_node_id) = 0;
+
+  for (int i = 0; i < (int)sorted_nodes.size(); i++) {
+    int n = sorted_nodes[i];
+    if (score[n] == -FLT_MAX)
+      continue;
+    for (int a = 0; a < (int)m_nodes[n].arcs.size(); a++) {
+      const Arc &arc = m_nodes[n].arcs[a];
+
+      // Interpolate the probabilities in linear domain (base 10)
+      double lm_prob = 0;
+      for (int m = 0; m < (int)weights.size(); m++)
+        lm_prob += weights[m] * pow(10, arc.lm_log_probs.at(m));
+      float lm_log_prob = lm_prob > 0 ? log10(lm_prob) : -FLT_MAX / 2;
+
+      float new_score = score[n] + arc.ac_log_prob + lm_scale * lm_log_prob;
+      if (new_score > score[arc.target_node_id]) {
+        score[arc.target_node_id] = new_score;
+        best_arc[arc.target_node_id] = &arc;
+        best_source[arc.target_node_id] = n;
+      }
+    }
+  }
+
+  words.clear();
+  for (int n = final_node_id; best_source.at(n) >= 0; n = best_source[n]) {
+    const std::string &label = best_arc[n]->label;
+    if (label != "!NULL" && label != "<s>" && label != "</s>")
+      words.push_back(label);
+  }
+  std::reverse(words.begin(), words.end());
+  return score.at(final_node_id);
+}
@@ -18,6 +18,7 @@ public:
     std::string label; //!< Label of the arc (0 = null)
     float ac_log_prob; //!< Acoustic probability
     float lm_log_prob; //!< Language model probability
+    std::vector<float> lm_log_probs; //!< Probabilities of several models
   };
 
   /** Node of the lattice. */
@@ -48,14 +49,38 @@ public:
   /** Create an arc. */
   void new_arc(int S, int E, std::string W, float a, float l);
 
+  /** Create an arc with the probabilities of several language models.
+   * The first one is also used as the language model probability. */
+  void new_arc(int S, int E, std::string W, float a,
+               const std::vector<float> &l);
+
   /** Read lattice from file in HTK format */
   void read(FILE *file);
   
   /** Write lattice in HTK format */
   void write(FILE *file);
 
+  /** Write lattice in HTK format with the probabilities of the given
+   * language model. */
+  void write(FILE *file, int lm_index);
+
+  /** Find the best path using the linear interpolation of the
+   * language model probabilities.  The nodes are processed in
+   * topological order, so the arcs may lead to lower node ids, as
+   * they do in the rescored lattices.  Exits if the lattice contains
+   * a cycle.
+   *
+   * \param weights = the interpolation weights of the models
+   * \param lm_scale = the language model scale
+   * \param words = the words of the best path, except null words
+   * \return the log probability of the best path
+   */
+  float best_path(const std::vector<float> &weights, float lm_scale,
+                  std::vector<std::string> &words);
+
   int initial_node_id; //!< Initial node id;
   int final_node_id; //!< Final node id;
+  float lm_scale; //!< Language model scale in the header (1 if missing)
 
 private:
   std::vector<Node> m_nodes; //!< Node of the lattice
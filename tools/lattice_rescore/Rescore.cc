@@ -1,31 +1,128 @@
 #include <assert.h>
+#include <float.h>
+#include <algorithm>
 #include "Rescore.hh"
 
+/** Orders contexts by decreasing score. */
+static bool
+better_context(const Rescore::Context &a, const Rescore::Context &b)
+{
+  return a.log_prob > b.log_prob;
+}
+
 Rescore::Rescore()
-  : m_tree_gram(NULL),
-    m_src_lattice(NULL),
+  : m_src_lattice(NULL),
     m_sentence_start_label("<s>"),
     m_sentence_end_label("</s>"),
-    m_null_label("!NULL")
+    m_null_label("!NULL"),
+    m_beam(0),
+    m_max_contexts(0),
+    m_lm_scale(0),
+    m_cur_lm_scale(1),
+    m_pruned(false)
 {
 }
 
-Lattice::Node& // private
-Rescore::find_or_create_node(int node_id, Context &context)
+int // private
+Rescore::find_or_create_node(int node_id, const Context &context)
 {
   // Check if the context is defined already
   for (int c = 0; c < (int)m_node_contexts[node_id].size(); c++) {
     Context &old_context = m_node_contexts[node_id][c];
-    if (old_context == context)
-      return m_rescored_lattice.node(old_context.node_id);
+    if (old_context == context) {
+      if (context.log_prob > old_context.log_prob)
+        old_context.log_prob = context.log_prob;
+      if (context.log_prob > m_best_log_prob[node_id])
+        m_best_log_prob[node_id] = context.log_prob;
+      return old_context.node_id;
+    }
   }
 
+  // Do not create hopeless contexts
+  if (m_beam > 0 && context.log_prob < m_best_log_prob[node_id] - m_beam) {
+    m_pruned = true;
+    return -1;
+  }
+  if (context.log_prob > m_best_log_prob[node_id])
+    m_best_log_prob[node_id] = context.log_prob;
+
   // Context not found, create a new node and context
   Lattice::Node &node = m_rescored_lattice.new_node();
   Context new_context = context;
   new_context.node_id = node.id;
   m_node_contexts[node_id].push_back(new_context);
-  return node;
+  return node.id;
+}
+
+void // private
+Rescore::prune_contexts(int node_id)
+{
+  std::vector<Context> &contexts = m_node_contexts[node_id];
+  int old_size = contexts.size();
+
+  // The contexts created before the best one may be outside the beam
+  if (m_beam > 0) {
+    float threshold = m_best_log_prob[node_id] - m_beam;
+    int c = 0;
+    for (int i = 0; i < (int)contexts.size(); i++)
+      if (contexts[i].log_prob >= threshold)
+        contexts[c++] = contexts[i];
+    contexts.resize(c);
+  }
+
+  if (m_max_contexts > 0 && (int)contexts.size() > m_max_contexts) {
+    std::nth_element(contexts.begin(), contexts.begin() + m_max_contexts,
+                     contexts.end(), better_context);
+    contexts.resize(m_max_contexts);
+  }
+
+  if ((int)contexts.size() < old_size)
+    m_pruned = true;
+}
+
+void // private
+Rescore::remove_dead_ends()
+{
+  // Find the nodes leading to the final node
+  std::vector<std::vector<int> > sources(m_rescored_lattice.num_nodes());
+  for (int n = 0; n < m_rescored_lattice.num_nodes(); n++) {
+    Lattice::Node &node = m_rescored_lattice.node(n);
+    for (int a = 0; a < (int)node.arcs.size(); a++)
+      sources[node.arcs[a].target_node_id].push_back(n);
+  }
+  std::vector<int> new_id(m_rescored_lattice.num_nodes(), -1);
+  std::vector<int> stack(1, m_rescored_lattice.final_node_id);
+  new_id[m_rescored_lattice.final_node_id] = 0;
+  while (!stack.empty()) {
+    int node_id = stack.back();
+    stack.pop_back();
+    for (int i = 0; i < (int)sources[node_id].size(); i++) {
+      if (new_id[sources[node_id][i]] < 0) {
+        new_id[sources[node_id][i]] = 0;
+        stack.push_back(sources[node_id][i]);
+      }
+    }
+  }
+
+  // Copy the live nodes and arcs to a new lattice in the same order
+  Lattice lattice;
+  for (int n = 0; n < m_rescored_lattice.num_nodes(); n++)
+    if (new_id[n] >= 0)
+      new_id[n] = lattice.new_node().id;
+  for (int n = 0; n < m_rescored_lattice.num_nodes(); n++) {
+    if (new_id[n] < 0)
+      continue;
+    Lattice::Node &node = m_rescored_lattice.node(n);
+    for (int a = 0; a < (int)node.arcs.size(); a++) {
+      Lattice::Arc &arc = node.arcs[a];
+      if (new_id[arc.target_node_id] >= 0)
+        lattice.new_arc(new_id[n], new_id[arc.target_node_id], arc.label,
+                        arc.ac_log_prob, arc.lm_log_probs);
+    }
+  }
+  lattice.initial_node_id = new_id[m_rescored_lattice.initial_node_id];
+  lattice.final_node_id = new_id[m_rescored_lattice.final_node_id];
+  m_rescored_lattice = lattice;
 }
 
 void
@@ -73,10 +170,22 @@ Rescore::sort_nodes()
 void
 Rescore::rescore(Lattice *src_lattice, TreeGram *tree_gram, bool quiet)
 {
+  rescore(src_lattice, std::vector<TreeGram*>(1, tree_gram), quiet);
+}
+
+void
+Rescore::rescore(Lattice *src_lattice,
+                 const std::vector<TreeGram*> &tree_grams, bool quiet)
+{
+  int num_models = tree_grams.size();
   m_src_lattice = src_lattice;
-  m_tree_gram = tree_gram;
+  m_tree_grams = tree_grams;
   m_rescored_lattice.clear();
-  m_sentence_end_id = tree_gram->word_index(m_sentence_end_label);
+  m_cur_lm_scale = m_lm_scale > 0 ? m_lm_scale : src_lattice->lm_scale;
+  m_pruned = false;
+  m_sentence_end_ids.resize(num_models);
+  for (int m = 0; m < num_models; m++)
+    m_sentence_end_ids[m] = tree_grams[m]->word_index(m_sentence_end_label);
 
   // Create a new final node for source lattice and add sentence end
   // arc.
@@ -93,10 +202,16 @@ Rescore::rescore(Lattice *src_lattice, TreeGram *tree_gram, bool quiet)
     m_rescored_lattice.initial_node_id = node.id;
     m_node_contexts.clear();
     m_node_contexts.resize(src_lattice->num_nodes());
+    m_best_log_prob.assign(src_lattice->num_nodes(), -FLT_MAX);
     Context context;
-    context.gram.push_back(tree_gram->word_index(m_sentence_start_label));
+    context.grams.resize(num_models);
+    for (int m = 0; m < num_models; m++)
+      context.grams[m].push_back(
+        tree_grams[m]->word_index(m_sentence_start_label));
     context.node_id = node.id;
+    context.log_prob = 0;
     m_node_contexts[src_lattice->initial_node_id].push_back(context);
+    m_best_log_prob[src_lattice->initial_node_id] = 0;
   }
 
   // Traverse source lattice in topological order
@@ -105,9 +220,12 @@ Rescore::rescore(Lattice *src_lattice, TreeGram *tree_gram, bool quiet)
   sort_nodes();
   if (!quiet)
     fprintf(stderr, "rescoring...");
+  std::vector<float> lm_log_probs;
   for (int s = 0; s < (int)m_sorted_nodes.size(); s++) {
     int src_id = m_sorted_nodes[s];
     Lattice::Node &src_node = m_src_lattice->node(src_id);
+    if (m_beam > 0 || m_max_contexts > 0)
+      prune_contexts(src_id);
 
     // Process all arcs from the source node
     for (int a = 0; a < (int)src_node.arcs.size(); a++) {
@@ -117,35 +235,44 @@ Rescore::rescore(Lattice *src_lattice, TreeGram *tree_gram, bool quiet)
       // Process all contexts of the source node
       for (int c = 0; c < (int)m_node_contexts[src_id].size(); c++) {
 
-	// Compute the language model probability and cut the context
-	// to the maximum length needed by the model.
-	Context &src_context = m_node_contexts[src_id][c];
+	// Compute the language model probabilities and cut the
+	// contexts to the maximum lengths needed by the models.  The
+	// target context is the union of the contexts of the models.
+	const Context &src_context = m_node_contexts[src_id][c];
 	Context tgt_context = src_context;
-	float lm_log_prob = 0;
-	if (arc.label != m_null_label) {
-	  int word_id = tree_gram->word_index(arc.label);
-	  tgt_context.gram.push_back(word_id);
-	  lm_log_prob = tree_gram->log_prob(tgt_context.gram);
-
-	  while (((int)tgt_context.gram.size() > tree_gram->last_history_length())
-	          && (tgt_context.gram.size() > 0))
-	    tgt_context.gram.pop_front();
-	}
+	lm_log_probs.assign(num_models, 0);
+	for (int m = 0; m < num_models; m++) {
+	  TreeGram *tree_gram = tree_grams[m];
+	  TreeGram::Gram &gram = tgt_context.grams[m];
+	  if (arc.label != m_null_label) {
+	    int word_id = tree_gram->word_index(arc.label);
+	    gram.push_back(word_id);
+	    lm_log_probs[m] = tree_gram->log_prob(gram);
+
+	    while (((int)gram.size() > tree_gram->last_history_length())
+		   && (gram.size() > 0))
+	      gram.pop_front();
+	  }
 
-	// Create the resulting lattice (final state has </s> context)
-	bool final_node = false;
-	if ((tgt_context.gram.size() > 0) && (tgt_context.gram.back() == m_sentence_end_id)) {
-	  tgt_context.gram.erase(tgt_context.gram.begin(),
-				 tgt_context.gram.end() - 1);
-	  final_node = true;
+	  // Create the resulting lattice (final state has </s> context)
+	  if ((gram.size() > 0) && (gram.back() == m_sentence_end_ids[m]))
+	    gram.erase(gram.begin(), gram.end() - 1);
 	}
-	Lattice::Node &new_tgt_node = find_or_create_node(tgt_id, tgt_context);
-	m_rescored_lattice.final_node_id = new_tgt_node.id;
-	Lattice::Node &new_src_node =
-	  m_rescored_lattice.node(src_context.node_id);
-	m_rescored_lattice.new_arc(new_src_node.id, new_tgt_node.id,
-				   arc.label, arc.ac_log_prob, lm_log_prob);
+
+	// The first model is used in pruning
+	tgt_context.log_prob = src_context.log_prob + arc.ac_log_prob +
+	  m_cur_lm_scale * lm_log_probs[0];
+	int new_tgt_id = find_or_create_node(tgt_id, tgt_context);
+	if (new_tgt_id < 0)
+	  continue;
+	if (tgt_id == m_src_lattice->final_node_id)
+	  m_rescored_lattice.final_node_id = new_tgt_id;
+	m_rescored_lattice.new_arc(src_context.node_id, new_tgt_id,
+				   arc.label, arc.ac_log_prob, lm_log_probs);
       }
     }
   }
+
+  if (m_pruned && m_rescored_lattice.final_node_id >= 0)
+    remove_dead_ends();
 }
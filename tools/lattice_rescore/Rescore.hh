@@ -9,17 +9,46 @@ class Rescore {
 public:
   /** Context structure for expanding lattices. */
   struct Context {
-    TreeGram::Gram gram; //!< Gram specifying the context
+    std::vector<TreeGram::Gram> grams; //!< Grams specifying the context for each model
     int node_id; //!< Node id in the rescored lattice corresponding to context
-    bool operator==(const Context &c) { return gram == c.gram; } //!< Compare
+    float log_prob; //!< Score of the best path reaching the context
+    bool operator==(const Context &c) { return grams == c.grams; } //!< Compare
   };
 
   /** Default constructor. */
   Rescore();
 
-  /** Expand and rescore the lattice with a language model. */
+  /** Expand and rescore the lattice with a language model.
+   *
+   * Each node of the source lattice is expanded into one node per
+   * language model context.  If a beam or a context limit has been
+   * set, the contexts are scored by the best path reaching them
+   * (acoustic plus scaled new language model log probabilities), and
+   * the contexts falling outside the beam of the best context of the
+   * same source node, or beyond the limit, are not expanded further.
+   * Nodes that do not lead to the final node are removed afterwards.
+   */
   void rescore(Lattice *src_lattice, TreeGram *tree_gram, bool quiet=false);
 
+  /** Expand the lattice once and rescore it with several language
+   * models.  The contexts are expanded to the union of the contexts
+   * required by the models, and the arcs of the rescored lattice get
+   * the probabilities of all the models.  The first model is used in
+   * pruning.
+   */
+  void rescore(Lattice *src_lattice, const std::vector<TreeGram*> &tree_grams,
+               bool quiet=false);
+
+  /** Set the beam for pruning contexts (0 disables pruning). */
+  void set_beam(float beam) { m_beam = beam; }
+
+  /** Set the maximum number of contexts per source node (0 = no limit). */
+  void set_max_contexts(int max_contexts) { m_max_contexts = max_contexts; }
+
+  /** Set the language model scale used in the pruning scores.  If
+   * not set, the lmscale of the source lattice is used. */
+  void set_lm_scale(float lm_scale) { m_lm_scale = lm_scale; }
+
   /** Get the rescored lattice. */
   Lattice &rescored_lattice() { return m_rescored_lattice; }
 
@@ -29,16 +58,32 @@ private:
   void sort_nodes();
 
   /** Create a new node corresponding to the context for the rescored
-      lattice if necessary, and return the corresponding node. */
-  Lattice::Node &find_or_create_node(int node_id, Context &context);
+      lattice if necessary, and return the id of the corresponding
+      node, or -1 if the context falls outside the beam. */
+  int find_or_create_node(int node_id, const Context &context);
 
-  TreeGram *m_tree_gram; //!< Language model used in rescoring
+  /** Prune the contexts of a source node before expanding them. */
+  void prune_contexts(int node_id);
+
+  /** Remove the nodes of the rescored lattice that do not lead to the
+      final node. */
+  void remove_dead_ends();
+
+  std::vector<TreeGram*> m_tree_grams; //!< Language models used in rescoring
   Lattice *m_src_lattice; //!< The lattice to be rescored
   Lattice m_rescored_lattice; //!< The result lattice of the rescoring
   std::string m_sentence_start_label; //!< Sentence start label in LM
   std::string m_sentence_end_label; //!< Sentence end label in LM
-  int m_sentence_end_id; //!< Sentence end label id in LM
+  std::vector<int> m_sentence_end_ids; //!< Sentence end label ids in LMs
   std::string m_null_label; //!< Null arc label
+  float m_beam; //!< Beam for pruning contexts, 0 if not used
+  int m_max_contexts; //!< Maximum contexts per source node, 0 if no limit
+  float m_lm_scale; //!< Language model scale, or 0 to use the lattice's
+  float m_cur_lm_scale; //!< Language model scale of the current lattice
+  bool m_pruned; //!< Were contexts pruned in the current lattice
+
+  //!< The best context score of each source lattice node.
+  std::vector<float> m_best_log_prob;
 
   //!< Node ids of the source lattice in sorted order.
   std::vector<int> m_sorted_nodes;
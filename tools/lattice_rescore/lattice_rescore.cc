@@ -24,6 +24,36 @@ read_file_list(FILE *file)
   return files;
 }
 
+/** Read interpolation weights from a file, one set per line. */
+std::vector<std::vector<float> >
+read_weights(FILE *file, int num_models)
+{
+  std::vector<std::vector<float> > weights;
+  std::string line;
+  std::vector<std::string> fields;
+  while (str::read_line(&line, file, true)) {
+    str::clean(&line, " \t\n");
+    if (line.empty())
+      continue;
+    str::split(&line, " \t", true, &fields);
+    if ((int)fields.size() != num_models) {
+      fprintf(stderr, "ERROR: expected %d weights: %s\n", num_models,
+              line.c_str());
+      exit(1);
+    }
+    weights.push_back(std::vector<float>());
+    for (int i = 0; i < (int)fields.size(); i++) {
+      bool ok = true;
+      weights.back().push_back(str::str2float(&fields[i], &ok));
+      if (!ok) {
+        fprintf(stderr, "ERROR: invalid weight: %s\n", line.c_str());
+        exit(1);
+      }
+    }
+  }
+  return weights;
+}
+
 std::string
 strip_dir(std::string path)
 {
@@ -53,10 +83,13 @@ int
 main(int argc, char *argv[])
 {
   config("usage: lattice_rescore [OPTION...]\n")
+    ('b', "beam=FLOAT", "arg", "0", "beam for pruning contexts during expansion (0 = no pruning)")
+    ('c', "max-contexts=INT", "arg", "0", "maximum number of contexts per lattice node (0 = no limit)")
     ('C', "config=FILE", "arg", "", "configuration file")
     ('f', "force", "", "", "force overwriting existing files")
     ('h', "help", "", "", "display help")
-    ('l', "lm=FILE", "arg must", "", "language model used in rescoring")
+    ('B', "best-paths=FILE", "arg", "", "write the best paths for each set of interpolation weights")
+    ('l', "lm=FILE", "arg must", "", "language model used in rescoring, or several separated by commas")
     ('i', "in=FILE", "arg", "", "input lattice")
     ('I', "in-list=FILE", "arg", "", "input list of lattices")
     ('o', "out=FILE", "arg", "", "output lattice file")
@@ -64,6 +97,8 @@ main(int argc, char *argv[])
     ('p', "post-process=FILE", "arg", "", 
      "run a post-processor for each output file")
     ('q', "quiet", "", "", "suppress all output on standard error")
+    ('s', "lm-scale=FLOAT", "arg", "0", "language model scale for pruning and best paths (default: lmscale of the lattice)")
+    ('w', "weights=FILE", "arg", "", "interpolation weights of the language models, one set per line")
     ;
   config.parse(argc, argv);
   if (config["help"].specified) {
@@ -80,14 +115,39 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // Read the language model
-  if (!quiet)
-    fprintf(stderr, "reading the language model...");
-  TreeGram tree_gram;
-  if (config["lm"].specified)
-    tree_gram.read(io::Stream(config["lm"].get_str(), "r").file);
-  if (!quiet)
-    fprintf(stderr, "\n");
+  // Read the language models
+  std::string lm_list = config["lm"].get_str();
+  std::vector<std::string> lm_files;
+  str::split(&lm_list, ",", false, &lm_files);
+  std::vector<TreeGram*> tree_grams;
+  for (int i = 0; i < (int)lm_files.size(); i++) {
+    if (!quiet)
+      fprintf(stderr, "reading the language model %s...",
+              lm_files[i].c_str());
+    tree_grams.push_back(new TreeGram());
+    tree_grams.back()->read(io::Stream(lm_files[i], "r").file);
+    if (!quiet)
+      fprintf(stderr, "\n");
+  }
+
+  // Read the interpolation weights
+  std::vector<std::vector<float> > weights;
+  if (config["weights"].specified)
+    weights = read_weights(io::Stream(config["weights"].get_str(), "r").file,
+                           tree_grams.size());
+  if (config["best-paths"].specified && weights.empty()) {
+    if (!quiet)
+      fprintf(stderr, "ERROR: --best-paths requires --weights\n");
+    exit(1);
+  }
+  if (config["weights"].specified && !config["best-paths"].specified) {
+    if (!quiet)
+      fprintf(stderr, "ERROR: --weights requires --best-paths\n");
+    exit(1);
+  }
+  io::Stream best_paths;
+  if (config["best-paths"].specified)
+    best_paths.open(config["best-paths"].get_str(), "w");
 
   // Parse input lattices
   std::vector<std::string> input_files;
@@ -113,6 +173,9 @@ main(int argc, char *argv[])
 
   // Rescore lattices
   Rescore rescore;
+  rescore.set_beam(config["beam"].get_float());
+  rescore.set_max_contexts(config["max-contexts"].get_int());
+  rescore.set_lm_scale(config["lm-scale"].get_float());
   Lattice src_lattice;
   for (int i = 0; i < (int)input_files.size(); i++) {
     std::string output_file;
@@ -121,7 +184,10 @@ main(int argc, char *argv[])
     else if (config["out-dir"].specified)
       output_file = 
         config["out-dir"].get_str() + "/" + strip_dir(input_files[i]);
-    if (file_exists(output_file) && !config["force"].specified) {
+    bool write_lattice = !output_file.empty() ||
+      !config["best-paths"].specified;
+    if (write_lattice && file_exists(output_file) &&
+        !config["force"].specified) {
       if (!quiet)
         fprintf(stderr, "skipped existing file %s\n", output_file.c_str());
       continue;
@@ -130,23 +196,55 @@ main(int argc, char *argv[])
     if (!quiet)
       fprintf(stderr, "processing %s...", input_files[i].c_str());
     src_lattice.read(io::Stream(input_files[i], "r").file);
-    rescore.rescore(&src_lattice, &tree_gram, quiet);
+    rescore.rescore(&src_lattice, tree_grams, quiet);
+    Lattice &lattice = rescore.rescored_lattice();
 
-    if (!quiet)
-      fprintf(stderr, "writing %s...", output_file.c_str());
-    rescore.rescored_lattice().write(io::Stream(output_file, "w").file);
-    if (!quiet)
-      fprintf(stderr, "\n");
+    // Best paths for each set of weights
+    float lm_scale = config["lm-scale"].specified ?
+      config["lm-scale"].get_float() : src_lattice.lm_scale;
+    std::vector<std::string> words;
+    for (int w = 0; w < (int)weights.size(); w++) {
+      float log_prob = lattice.best_path(weights[w], lm_scale, words);
+      fprintf(best_paths.file, "%s", input_files[i].c_str());
+      for (int m = 0; m < (int)weights[w].size(); m++)
+        fprintf(best_paths.file, "%c%g", m == 0 ? ' ' : ',', weights[w][m]);
+      fprintf(best_paths.file, " %g", log_prob);
+      for (int j = 0; j < (int)words.size(); j++)
+        fprintf(best_paths.file, " %s", words[j].c_str());
+      fprintf(best_paths.file, "\n");
+    }
+    if (!weights.empty())
+      fflush(best_paths.file);
 
-    if (config["post-process"].specified) {
-      std::string cmd = config["post-process"].get_str() + 
-        " \"" + output_file + "\"";
+    // A lattice for each model
+    for (int m = 0; write_lattice && m < (int)tree_grams.size(); m++) {
+      std::string file = output_file;
+      if (tree_grams.size() > 1) {
+        char suffix[16];
+        sprintf(suffix, ".lm%d", m + 1);
+        file += suffix;
+      }
+      if (!quiet)
+        fprintf(stderr, "writing %s...", file.c_str());
+      lattice.write(io::Stream(file, "w").file, m);
       if (!quiet)
-        fprintf(stderr, "running post-processor: %s\n", cmd.c_str());
-      int ret = system(cmd.c_str());
-      if ((ret < 0) && !quiet) {
-        fprintf(stderr, "WARNING: command failed\n");
+        fprintf(stderr, "\n");
+
+      if (config["post-process"].specified) {
+        std::string cmd = config["post-process"].get_str() +
+          " \"" + file + "\"";
+        if (!quiet)
+          fprintf(stderr, "running post-processor: %s\n", cmd.c_str());
+        int ret = system(cmd.c_str());
+        if ((ret < 0) && !quiet) {
+          fprintf(stderr, "WARNING: command failed\n");
+        }
       }
     }
+    if (!write_lattice && !quiet)
+      fprintf(stderr, "\n");
   }
+
+  for (int i = 0; i < (int)tree_grams.size(); i++)
+    delete tree_grams[i];
 }